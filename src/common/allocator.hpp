@@ -18,6 +18,18 @@ class ArenaAllocator {
     offset_ += size;
     return ret;
   }
+  /* align must be a power of 2 and not larger than alignof(max_align_t) */
+  uint8_t* AllocateAligned(size_t size, size_t align) {
+    size_t offset = (offset_ + align - 1) & ~(align - 1);
+    if (offset + size > BlockSize) {
+      ptrs_.push_back(
+          std::unique_ptr<uint8_t[]>(new uint8_t[std::max(size, BlockSize)]));
+      offset = 0;
+    }
+    auto ret = ptrs_.back().get() + offset;
+    offset_ = offset + size;
+    return ret;
+  }
   void Clear() {
     ptrs_.clear();
     offset_ = BlockSize + 1;
@@ -1,5 +1,11 @@
 #include "common/bloomfilter.hpp"
 
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 #include "common/serializer.hpp"
 
 namespace wing {
@@ -65,6 +71,134 @@ bool BloomFilter::Find(size_t h, std::string_view bloom_bits) {
   return true;
 }
 
+namespace {
+
+/* The odd multipliers which derive the probes from the hash. */
+alignas(32) constexpr uint32_t
+    kBlockedBloomSalt[BlockedBloomFilter::kMaxProbes] = {0x47b6137bU,
+        0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU,
+        0x9efc4947U, 0x5c6bfb31U, 0x6a09e667U, 0xbb67ae85U, 0x3c6ef373U,
+        0xa54ff53bU, 0x510e527fU, 0x9b05688dU, 0x1f83d9abU, 0x5be0cd19U};
+
+struct BlockedBloomHeader {
+  uint32_t num_lines_;
+  uint32_t num_probes_;
+};
+
+BlockedBloomHeader ReadBlockedBloomHeader(const char* data) {
+  BlockedBloomHeader header;
+  memcpy(&header, data, sizeof(header));
+  return header;
+}
+
+/* Map the high 32 bits of the hash to [0, num_lines) without division. */
+const char* BlockedBloomLine(
+    const char* data, size_t h, uint32_t num_lines) {
+  size_t line = ((h >> 32) * num_lines) >> 32;
+  return data + BlockedBloomFilter::kHeaderSize +
+         line * BlockedBloomFilter::kLineBytes;
+}
+
+/**
+ * The j-th probe of the low 32 bits of the hash. The top 4 bits of the
+ * product pick the word in the line, and the next 5 bits pick the bit.
+ */
+void BlockedBloomProbe(uint32_t h, size_t j, size_t* word, uint32_t* bit) {
+  uint32_t p = h * kBlockedBloomSalt[j];
+  *word = p >> 28;
+  *bit = 1U << ((p >> 23) & 31);
+}
+
+#if defined(__x86_64__)
+/* Check 8 probes at a time. The words are gathered from the line. */
+__attribute__((target("avx2"))) bool FindBlockedAVX2(
+    const char* line, uint32_t h, uint32_t num_probes) {
+  const __m256i hash = _mm256_set1_epi32(h);
+  const __m256i probes = _mm256_set1_epi32(num_probes);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i bit_mask = _mm256_set1_epi32(31);
+  __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  for (uint32_t j = 0; j < num_probes; j += 8) {
+    auto salt = _mm256_load_si256(
+        reinterpret_cast<const __m256i*>(kBlockedBloomSalt + j));
+    auto p = _mm256_mullo_epi32(hash, salt);
+    auto word = _mm256_srli_epi32(p, 28);
+    auto shift = _mm256_and_si256(_mm256_srli_epi32(p, 23), bit_mask);
+    auto bits = _mm256_sllv_epi32(one, shift);
+    // The lanes after the last probe are not checked.
+    bits = _mm256_and_si256(bits, _mm256_cmpgt_epi32(probes, lane));
+    auto words = _mm256_i32gather_epi32(
+        reinterpret_cast<const int*>(line), word, sizeof(uint32_t));
+    if (!_mm256_testc_si256(words, bits)) {
+      return false;
+    }
+    lane = _mm256_add_epi32(lane, _mm256_set1_epi32(8));
+  }
+  return true;
+}
+
+bool CPUHasAVX2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+#endif
+
+}  // namespace
+
+void BlockedBloomFilter::Create(
+    size_t key_n, size_t bits_per_key, std::string& bloom_bits) {
+  size_t bits = std::max<size_t>(kLineBytes * 8, key_n * bits_per_key);
+  size_t num_lines = std::min<size_t>(
+      (bits + kLineBytes * 8 - 1) / (kLineBytes * 8), UINT32_MAX);
+  size_t num_probes = std::min<size_t>(
+      kMaxProbes, std::max<size_t>(1, bits_per_key * 0.69));
+  bloom_bits.assign(kHeaderSize + num_lines * kLineBytes, 0);
+  utils::Serializer(bloom_bits.data())
+      .Write<uint32_t>(num_lines)
+      .Write<uint32_t>(num_probes);
+}
+
+void BlockedBloomFilter::Add(size_t h, std::string& bloom_bits) {
+  auto header = ReadBlockedBloomHeader(bloom_bits.data());
+  auto* line = const_cast<char*>(
+      BlockedBloomLine(bloom_bits.data(), h, header.num_lines_));
+  for (size_t j = 0; j < header.num_probes_; j++) {
+    size_t w;
+    uint32_t bit, word;
+    BlockedBloomProbe(h, j, &w, &bit);
+    memcpy(&word, line + w * sizeof(uint32_t), sizeof(uint32_t));
+    word |= bit;
+    memcpy(line + w * sizeof(uint32_t), &word, sizeof(uint32_t));
+  }
+}
+
+bool BlockedBloomFilter::Find(size_t h, std::string_view bloom_bits) {
+#if defined(__x86_64__)
+  if (CPUHasAVX2()) {
+    auto header = ReadBlockedBloomHeader(bloom_bits.data());
+    return FindBlockedAVX2(
+        BlockedBloomLine(bloom_bits.data(), h, header.num_lines_), h,
+        header.num_probes_);
+  }
+#endif
+  return FindPortable(h, bloom_bits);
+}
+
+bool BlockedBloomFilter::FindPortable(size_t h, std::string_view bloom_bits) {
+  auto header = ReadBlockedBloomHeader(bloom_bits.data());
+  auto* line = BlockedBloomLine(bloom_bits.data(), h, header.num_lines_);
+  for (size_t j = 0; j < header.num_probes_; j++) {
+    size_t w;
+    uint32_t bit, word;
+    BlockedBloomProbe(h, j, &w, &bit);
+    memcpy(&word, line + w * sizeof(uint32_t), sizeof(uint32_t));
+    if ((word & bit) != bit) {
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace utils
 
 }  // namespace wing
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 #include "common/murmurhash.hpp"
 
 namespace wing {
@@ -29,6 +31,44 @@ class BloomFilter {
   static bool Find(size_t hash1, std::string_view bloom_bits);
 };
 
+/**
+ * A cache-line-blocked bloom filter. A key is mapped to one 64-byte line, and
+ * all of its probes set bits in that line, so a lookup touches a single cache
+ * line and needs no division. The probes are checked 8 at a time with AVX2 if
+ * the CPU supports it.
+ *
+ * The layout: num_lines (uint32), num_probes (uint32), then the lines.
+ */
+class BlockedBloomFilter {
+ public:
+  static constexpr size_t kLineBytes = 64;
+  static constexpr size_t kMaxProbes = 16;
+  static constexpr size_t kHeaderSize = sizeof(uint32_t) * 2;
+
+  /* Create a bloom filter buffer */
+  static void Create(
+      size_t key_n, size_t bits_per_key, std::string& bloom_bits);
+
+  /* Add a key to the bloom filter */
+  static void Add(std::string_view key, std::string& bloom_bits) {
+    Add(BloomFilter::BloomHash(key), bloom_bits);
+  }
+
+  /* Add a key hash (i.e. BloomFilter::BloomHash(key)) to the bloom filter */
+  static void Add(size_t hash1, std::string& bloom_bits);
+
+  /* Check if a key may be added */
+  static bool Find(std::string_view key, std::string_view bloom_bits) {
+    return Find(BloomFilter::BloomHash(key), bloom_bits);
+  }
+
+  /* Check if a key hash may be added. It uses AVX2 if it is available. */
+  static bool Find(size_t hash1, std::string_view bloom_bits);
+
+  /* The portable probe kernel, which gives the same results as Find. */
+  static bool FindPortable(size_t hash1, std::string_view bloom_bits);
+};
+
 }  // namespace utils
 
 }  // namespace wing
@@ -0,0 +1,169 @@
+#include "common/lz.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace wing {
+
+namespace utils {
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+/* The last kLastLiterals bytes are always literals. */
+constexpr size_t kLastLiterals = 5;
+/* A match cannot start in the last kMatchFindLimit bytes. */
+constexpr size_t kMatchFindLimit = 12;
+constexpr size_t kMaxOffset = 65535;
+constexpr int kHashLog = 12;
+
+uint32_t Read32(const uint8_t* p) {
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+uint32_t HashSequence(uint32_t x) {
+  return (x * 2654435761U) >> (32 - kHashLog);
+}
+
+uint8_t* WriteLength(uint8_t* op, size_t len) {
+  while (len >= 255) {
+    *(op++) = 255;
+    len -= 255;
+  }
+  *(op++) = static_cast<uint8_t>(len);
+  return op;
+}
+
+uint8_t* WriteSequence(uint8_t* op, const uint8_t* literals, size_t lit_len,
+    size_t offset, size_t match_len) {
+  uint8_t* token = op++;
+  *token = static_cast<uint8_t>(std::min<size_t>(lit_len, 15) << 4);
+  if (lit_len >= 15) {
+    op = WriteLength(op, lit_len - 15);
+  }
+  memcpy(op, literals, lit_len);
+  op += lit_len;
+  if (match_len == 0) {
+    return op;
+  }
+  *(op++) = static_cast<uint8_t>(offset);
+  *(op++) = static_cast<uint8_t>(offset >> 8);
+  match_len -= kMinMatch;
+  *token |= static_cast<uint8_t>(std::min<size_t>(match_len, 15));
+  if (match_len >= 15) {
+    op = WriteLength(op, match_len - 15);
+  }
+  return op;
+}
+
+/* Read the extra bytes of a length. Return false if src runs out. */
+bool ReadLength(const uint8_t*& ip, const uint8_t* end, size_t* len) {
+  uint8_t b;
+  do {
+    if (ip >= end) {
+      return false;
+    }
+    b = *(ip++);
+    *len += b;
+  } while (b == 255);
+  return true;
+}
+
+}  // namespace
+
+size_t LZCompress(const char* src, size_t n, char* dst) {
+  auto in = reinterpret_cast<const uint8_t*>(src);
+  auto op = reinterpret_cast<uint8_t*>(dst);
+  size_t anchor = 0;
+  if (n > kMatchFindLimit) {
+    /* The position + 1 of the last sequence with the hash. 0 means none. */
+    uint32_t table[1 << kHashLog] = {0};
+    size_t ip = 0;
+    size_t match_limit = n - kMatchFindLimit;
+    size_t end_limit = n - kLastLiterals;
+    while (ip < match_limit) {
+      auto seq = Read32(in + ip);
+      auto h = HashSequence(seq);
+      size_t cand = table[h];
+      table[h] = ip + 1;
+      if (cand == 0 || ip - (cand - 1) > kMaxOffset ||
+          Read32(in + cand - 1) != seq) {
+        ip += 1;
+        continue;
+      }
+      size_t ref = cand - 1;
+      size_t len = kMinMatch;
+      while (ip + len < end_limit && in[ip + len] == in[ref + len]) {
+        len += 1;
+      }
+      while (ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1]) {
+        ip -= 1;
+        ref -= 1;
+        len += 1;
+      }
+      op = WriteSequence(op, in + anchor, ip - anchor, ip - ref, len);
+      ip += len;
+      anchor = ip;
+      if (ip >= 2 && ip < match_limit) {
+        table[HashSequence(Read32(in + ip - 2))] = ip - 2 + 1;
+      }
+    }
+  }
+  op = WriteSequence(op, in + anchor, n - anchor, 0, 0);
+  return op - reinterpret_cast<uint8_t*>(dst);
+}
+
+bool LZDecompress(const char* src, size_t n, char* dst, size_t dst_size) {
+  auto ip = reinterpret_cast<const uint8_t*>(src);
+  auto end = ip + n;
+  auto op = reinterpret_cast<uint8_t*>(dst);
+  auto op_end = op + dst_size;
+  while (ip < end) {
+    uint8_t token = *(ip++);
+    size_t lit_len = token >> 4;
+    if (lit_len == 15 && !ReadLength(ip, end, &lit_len)) {
+      return false;
+    }
+    if (lit_len > size_t(end - ip) || lit_len > size_t(op_end - op)) {
+      return false;
+    }
+    memcpy(op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+    if (ip == end) {
+      break;
+    }
+    if (end - ip < 2) {
+      return false;
+    }
+    size_t offset = ip[0] | (size_t(ip[1]) << 8);
+    ip += 2;
+    size_t match_len = token & 15;
+    if (match_len == 15 && !ReadLength(ip, end, &match_len)) {
+      return false;
+    }
+    match_len += kMinMatch;
+    if (offset == 0 || offset > size_t(op - reinterpret_cast<uint8_t*>(dst)) ||
+        match_len > size_t(op_end - op)) {
+      return false;
+    }
+    const uint8_t* ref = op - offset;
+    if (offset >= match_len) {
+      memcpy(op, ref, match_len);
+      op += match_len;
+    } else {
+      // The match overlaps the output, e.g., a run of the same byte.
+      for (size_t i = 0; i < match_len; i++) {
+        *(op++) = *(ref++);
+      }
+    }
+  }
+  return op == op_end;
+}
+
+}  // namespace utils
+
+}  // namespace wing
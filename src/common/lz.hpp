@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+
+namespace wing {
+
+namespace utils {
+
+/**
+ * A small LZ77 codec which writes the LZ4 block format: a sequence is a token
+ * (the lengths of the literals and the match), the literals and the 2-byte
+ * offset of the match. It is fast but the ratio is modest, which suits data
+ * blocks of several KB.
+ */
+
+/* The maximum size of the compressed data of n bytes. */
+inline size_t LZMaxCompressedSize(size_t n) { return n + n / 255 + 16; }
+
+/**
+ * Compress n bytes in src into dst, which has at least LZMaxCompressedSize(n)
+ * bytes. Return the size of the compressed data.
+ */
+size_t LZCompress(const char* src, size_t n, char* dst);
+
+/**
+ * Decompress n bytes in src into dst, whose size must be exactly the size of
+ * the original data. Return false if the data is corrupted.
+ */
+bool LZDecompress(const char* src, size_t n, char* dst, size_t dst_size);
+
+}  // namespace utils
+
+}  // namespace wing
@@ -0,0 +1,132 @@
+#include "common/xorfilter.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/serializer.hpp"
+
+namespace wing {
+
+namespace utils {
+
+namespace {
+
+/* The finalizer of MurmurHash3, which mixes the seed into the key hash. */
+size_t XorFilterMix(size_t h, uint64_t seed) {
+  h += seed;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+uint8_t XorFilterFingerprint(size_t h) { return h ^ (h >> 32); }
+
+/* Map x to [0, n) without division. */
+uint32_t XorFilterReduce(uint32_t x, uint32_t n) {
+  return (uint64_t(x) * n) >> 32;
+}
+
+/* The 3 slots of a mixed hash, one in each third of the array. */
+void XorFilterSlots(size_t h, uint32_t block_length, uint32_t* slots) {
+  slots[0] = XorFilterReduce(h, block_length);
+  slots[1] = XorFilterReduce((h << 21) | (h >> 43), block_length) +
+             block_length;
+  slots[2] = XorFilterReduce((h << 42) | (h >> 22), block_length) +
+             2 * block_length;
+}
+
+}  // namespace
+
+void XorFilter::Build(std::vector<size_t> hashes, std::string& filter_bits) {
+  // A duplicated key can never be peeled, so it is removed first.
+  std::sort(hashes.begin(), hashes.end());
+  hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+  uint32_t block_length = (32 + hashes.size() * 123 / 100 + 2) / 3;
+  size_t capacity = 3 * size_t(block_length);
+  std::vector<size_t> xor_mask(capacity);
+  std::vector<uint32_t> count(capacity);
+  std::vector<uint32_t> queue;
+  /* The mixed hashes in peeling order, and the slot each one owns. */
+  std::vector<std::pair<size_t, uint32_t>> stack;
+  uint64_t seed = 0x202404171423;
+  while (true) {
+    std::fill(xor_mask.begin(), xor_mask.end(), 0);
+    std::fill(count.begin(), count.end(), 0);
+    queue.clear();
+    stack.clear();
+    uint32_t slots[3];
+    for (auto h : hashes) {
+      auto m = XorFilterMix(h, seed);
+      XorFilterSlots(m, block_length, slots);
+      for (auto s : slots) {
+        xor_mask[s] ^= m;
+        count[s] += 1;
+      }
+    }
+    for (uint32_t i = 0; i < capacity; i++) {
+      if (count[i] == 1) {
+        queue.push_back(i);
+      }
+    }
+    // Repeatedly remove a key which is the only one in one of its slots.
+    while (!queue.empty()) {
+      auto i = queue.back();
+      queue.pop_back();
+      if (count[i] != 1) {
+        continue;
+      }
+      auto m = xor_mask[i];
+      stack.emplace_back(m, i);
+      XorFilterSlots(m, block_length, slots);
+      for (auto s : slots) {
+        xor_mask[s] ^= m;
+        count[s] -= 1;
+        if (count[s] == 1) {
+          queue.push_back(s);
+        }
+      }
+    }
+    if (stack.size() == hashes.size()) {
+      break;
+    }
+    // The hypergraph has a cycle. Retry with another seed.
+    seed = XorFilterMix(seed, 0x9e3779b97f4a7c15ULL);
+  }
+  filter_bits.assign(kHeaderSize + capacity, 0);
+  utils::Serializer(filter_bits.data())
+      .Write<uint64_t>(seed)
+      .Write<uint32_t>(block_length);
+  auto* fingerprints =
+      reinterpret_cast<uint8_t*>(filter_bits.data() + kHeaderSize);
+  // A key owns a slot which is not used by the keys peeled before it.
+  for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+    auto [m, i] = *it;
+    uint32_t slots[3];
+    XorFilterSlots(m, block_length, slots);
+    fingerprints[i] = XorFilterFingerprint(m) ^ fingerprints[slots[0]] ^
+                      fingerprints[slots[1]] ^ fingerprints[slots[2]];
+  }
+}
+
+bool XorFilter::Find(size_t h, std::string_view filter_bits) {
+  uint64_t seed;
+  uint32_t block_length;
+  memcpy(&seed, filter_bits.data(), sizeof(uint64_t));
+  memcpy(&block_length, filter_bits.data() + sizeof(uint64_t),
+      sizeof(uint32_t));
+  auto* fingerprints =
+      reinterpret_cast<const uint8_t*>(filter_bits.data() + kHeaderSize);
+  auto m = XorFilterMix(h, seed);
+  uint32_t slots[3];
+  XorFilterSlots(m, block_length, slots);
+  return XorFilterFingerprint(m) == (fingerprints[slots[0]] ^
+                                        fingerprints[slots[1]] ^
+                                        fingerprints[slots[2]]);
+}
+
+}  // namespace utils
+
+}  // namespace wing
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace wing {
+
+namespace utils {
+
+/**
+ * A static xor filter with 8-bit fingerprints (Graf and Lemire, 2020).
+ * It takes about 9.84 bits per key and its false positive rate is 1/256,
+ * while a bloom filter with 10 bits per key has about 1%. A key is checked by
+ * xoring the fingerprints in 3 slots, one in each third of the array.
+ *
+ * The layout: seed (uint64), block_length (uint32), then 3 * block_length
+ * fingerprints.
+ */
+class XorFilter {
+ public:
+  static constexpr size_t kHeaderSize = sizeof(uint64_t) + sizeof(uint32_t);
+
+  /**
+   * Build the filter from the key hashes (i.e. BloomFilter::BloomHash(key)).
+   * Duplicated hashes are allowed.
+   */
+  static void Build(std::vector<size_t> hashes, std::string& filter_bits);
+
+  /* Check if a key hash may be added */
+  static bool Find(size_t hash1, std::string_view filter_bits);
+};
+
+}  // namespace utils
+
+}  // namespace wing
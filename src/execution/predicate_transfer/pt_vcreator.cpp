@@ -29,10 +29,10 @@ void PtVecCreator::Execute() {
   result_.clear();
   result_.resize(num_cols_);
   for(size_t i = 0; i < num_cols_; ++i){
-    utils::BloomFilter::Create(
+    utils::BlockedBloomFilter::Create(
         key_hashes[i].size(), bloom_bit_per_key_n_, result_[i]);
     for(auto hash : key_hashes[i]){
-      utils::BloomFilter::Add(hash, result_[i]);
+      utils::BlockedBloomFilter::Add(hash, result_[i]);
     }
   }
 }
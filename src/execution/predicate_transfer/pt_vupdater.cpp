@@ -38,7 +38,7 @@ void PtVecUpdater::Execute(
           hash = utils::BloomFilter::BloomHash(std::string_view(
               reinterpret_cast<const char*>(&data), sizeof(uint64_t)));
         }
-        if(!utils::BloomFilter::Find(hash, bloom_filter[i])){
+        if(!utils::BlockedBloomFilter::Find(hash, bloom_filter[i])){
           valid_bits[index] = 0;
           break;
         }
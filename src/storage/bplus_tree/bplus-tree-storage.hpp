@@ -139,6 +139,16 @@ class BPlusTreeTable : public AbstractBPlusTreeTable {
       // P4 TODO
       return table_.Update(key, value);
     }
+    bool BulkInsert(
+        std::span<const std::pair<std::string_view, std::string_view>> rows)
+        override {
+      for (auto [key, value] : rows) {
+        if (!Insert(key, value)) {
+          return false;
+        }
+      }
+      return true;
+    }
 
    private:
     BPlusTreeTable& table_;
@@ -158,11 +168,28 @@ class BPlusTreeTable : public AbstractBPlusTreeTable {
       last_ = std::move(ret.value());
       return reinterpret_cast<const uint8_t*>(last_.data());
     }
+    std::vector<const uint8_t*> MultiSearch(
+        std::span<const std::string_view> keys) override {
+      std::vector<const uint8_t*> ret;
+      batch_.resize(keys.size());
+      for (size_t i = 0; i < keys.size(); i++) {
+        auto value = tree_.Get(keys[i]);
+        if (!value.has_value()) {
+          ret.push_back(nullptr);
+          continue;
+        }
+        batch_[i] = std::move(value.value());
+        ret.push_back(reinterpret_cast<const uint8_t*>(batch_[i].data()));
+      }
+      return ret;
+    }
 
    private:
     tree_t& tree_;
     std::unique_ptr<TxnExecCtx> ctx_;
     std::string last_;
+    /* The results of the last MultiSearch. */
+    std::vector<std::string> batch_;
     friend class BPlusTreeTable<KeyCompare>;
   };
 
@@ -1,35 +1,224 @@
 #include "storage/lsm/block.hpp"
 
+#include "common/lz.hpp"
+#include "common/murmurhash.hpp"
+
 namespace wing {
 
 namespace lsm {
 
+namespace {
+
+size_t VarintLength(uint32_t x) {
+  size_t len = 1;
+  while (x >= 128) {
+    x >>= 7;
+    len += 1;
+  }
+  return len;
+}
+
+char* EncodeVarint32(char* dst, uint32_t x) {
+  while (x >= 128) {
+    *(dst++) = static_cast<char>(x | 128);
+    x >>= 7;
+  }
+  *(dst++) = static_cast<char>(x);
+  return dst;
+}
+
+constexpr size_t kBlockChecksumSeed = 0x202404101345;
+
+template <typename T>
+void AppendValue(std::string* dst, T x) {
+  dst->append(reinterpret_cast<const char*>(&x), sizeof(T));
+}
+
+const char* DecodeVarint32(const char* p, uint32_t* x) {
+  uint32_t result = 0;
+  for (uint32_t shift = 0; shift <= 28; shift += 7) {
+    uint32_t byte = static_cast<uint8_t>(*(p++));
+    result |= (byte & 127) << shift;
+    if (byte < 128) {
+      break;
+    }
+  }
+  *x = result;
+  return p;
+}
+
+}  // namespace
+
 bool BlockBuilder::Append(ParsedKey key, Slice value) {
+  if (format_version_ == kLegacyFormatVersion) {
+    return AppendLegacy(key, value);
+  }
+  InternalKey ikey(key);
+  Slice k = ikey.GetSlice();
+  size_t shared = 0;
+  bool restart = count_ % restart_interval_ == 0;
+  if (!restart) {
+    auto limit = std::min(k.size(), last_key_.size());
+    while (shared < limit && k[shared] == last_key_[shared]) {
+      shared += 1;
+    }
+  }
+  size_t non_shared = k.size() - shared;
+  size_t record_size = VarintLength(shared) + VarintLength(non_shared) +
+                       VarintLength(value.size()) + non_shared + value.size();
+  if (size() + record_size + (restart ? sizeof(offset_t) : 0) > block_size_) {
+    return false;
+  }
+  if (restart) {
+    restarts_.push_back(current_size_);
+  }
+  char header[15];
+  char* p = EncodeVarint32(header, shared);
+  p = EncodeVarint32(p, non_shared);
+  p = EncodeVarint32(p, value.size());
+  buffer_.append(header, p - header);
+  buffer_.append(k.substr(shared)).append(value);
+  last_key_.resize(shared);
+  last_key_.append(k.substr(shared));
+  current_size_ += record_size;
+  count_ += 1;
+  return true;
+}
+
+bool BlockBuilder::AppendLegacy(ParsedKey key, Slice value) {
   InternalKey ikey(key);
   offset_t key_length = ikey.size();
   offset_t value_length = value.size();
-  if (current_size_ + key_length + value_length + 
+  if (current_size_ + key_length + value_length +
     sizeof(offset_t) * 3UL > block_size_){
       return false;
     }
-  file_->AppendValue<offset_t>(key_length)
-        .AppendString(ikey.GetSlice())
-        .AppendValue<offset_t>(value_length)
-        .AppendString(value);
+  AppendValue<offset_t>(&buffer_, key_length);
+  buffer_.append(ikey.GetSlice());
+  AppendValue<offset_t>(&buffer_, value_length);
+  buffer_.append(value);
   offset_t offset = current_size_ - offsets_.size() * sizeof(offset_t);
   offsets_.push_back(offset);
   current_size_ += key_length + value_length + sizeof(offset_t) * 3UL;
+  count_ += 1;
   return true;
 }
 
-void BlockBuilder::Finish() {
-  for(auto it : offsets_){
-    file_->AppendValue<offset_t>(it);
+size_t BlockBuilder::Finish() {
+  if (format_version_ == kLegacyFormatVersion) {
+    for(auto it : offsets_){
+      AppendValue<offset_t>(&buffer_, it);
+    }
+  } else {
+    for (auto it : restarts_) {
+      AppendValue<offset_t>(&buffer_, it);
+    }
+    AppendValue<offset_t>(&buffer_, restarts_.size());
+  }
+  if (format_version_ < kChecksumFormatVersion) {
+    file_->AppendString(buffer_);
+    return buffer_.size();
+  }
+  auto type = CompressionType::kNone;
+  std::string compressed;
+  if (compression_ == CompressionType::kLZ) {
+    compressed.resize(
+        sizeof(offset_t) + utils::LZMaxCompressedSize(buffer_.size()));
+    offset_t raw_size = buffer_.size();
+    memcpy(compressed.data(), &raw_size, sizeof(offset_t));
+    auto len = utils::LZCompress(buffer_.data(), buffer_.size(),
+        compressed.data() + sizeof(offset_t));
+    compressed.resize(sizeof(offset_t) + len);
+    if (compressed.size() < buffer_.size() - buffer_.size() / 8) {
+      type = CompressionType::kLZ;
+    }
+  }
+  auto& stored = type == CompressionType::kNone ? buffer_ : compressed;
+  AppendValue<CompressionType>(&stored, type);
+  AppendValue<uint32_t>(&stored, BlockChecksum(stored));
+  file_->AppendString(stored);
+  return stored.size();
+}
+
+uint32_t BlockChecksum(Slice data) {
+  return static_cast<uint32_t>(
+      utils::Hash(data.data(), data.size(), kBlockChecksumSeed));
+}
+
+Slice DecodeBlock(Slice stored, std::string* buf) {
+  if (stored.size() < kBlockTrailerSize) {
+    DB_ERR("Corrupted block: size {}", stored.size());
+  }
+  auto data_size = stored.size() - kBlockTrailerSize;
+  uint32_t checksum;
+  memcpy(&checksum, stored.data() + data_size + sizeof(CompressionType),
+      sizeof(uint32_t));
+  if (BlockChecksum(stored.substr(0, data_size + sizeof(CompressionType))) !=
+      checksum) {
+    DB_ERR("Corrupted block: checksum mismatch");
+  }
+  auto type = static_cast<CompressionType>(stored[data_size]);
+  if (type == CompressionType::kNone) {
+    return stored.substr(0, data_size);
+  }
+  offset_t raw_size;
+  if (type != CompressionType::kLZ || data_size < sizeof(offset_t)) {
+    DB_ERR("Corrupted block: unknown compression type {}", uint8_t(type));
   }
+  memcpy(&raw_size, stored.data(), sizeof(offset_t));
+  buf->resize(raw_size);
+  if (!utils::LZDecompress(stored.data() + sizeof(offset_t),
+          data_size - sizeof(offset_t), buf->data(), raw_size)) {
+    DB_ERR("Corrupted block: decompression fails");
+  }
+  return *buf;
+}
+
+void BlockIterator::ParseRecord(offset_t offset) {
+  current_ = offset;
+  uint32_t shared, non_shared, value_length;
+  const char* p = DecodeVarint32(data_ + offset, &shared);
+  p = DecodeVarint32(p, &non_shared);
+  p = DecodeVarint32(p, &value_length);
+  key_.resize(shared);
+  key_.append(p, non_shared);
+  value_ = Slice(p + non_shared, value_length);
+  next_ = p + non_shared + value_length - data_;
+}
+
+Slice BlockIterator::RestartKey(offset_t id) const {
+  auto offset = reinterpret_cast<const offset_t*>(offset_)[id];
+  uint32_t shared, non_shared, value_length;
+  const char* p = DecodeVarint32(data_ + offset, &shared);
+  p = DecodeVarint32(p, &non_shared);
+  p = DecodeVarint32(p, &value_length);
+  return Slice(p, non_shared);
 }
 
 void BlockIterator::Seek(Slice user_key, seq_t seq) {
   ParsedKey seek_key(user_key, seq, RecordType::Value);
+  if (format_version_ != kLegacyFormatVersion) {
+    if (num_restarts_ == 0) {
+      current_ = next_ = limit_;
+      return;
+    }
+    // Find the last restart point < seek_key, then scan from it.
+    offset_t lr = 0u, rr = num_restarts_ - 1;
+    while (lr < rr) {
+      offset_t mid = (lr + rr + 1) >> 1;
+      if (ParsedKey(RestartKey(mid)) < seek_key) {
+        lr = mid;
+      } else {
+        rr = mid - 1;
+      }
+    }
+    key_.clear();
+    ParseRecord(reinterpret_cast<const offset_t*>(offset_)[lr]);
+    while (Valid() && ParsedKey(key()) < seek_key) {
+      Next();
+    }
+    return;
+  }
   offset_t lr = 0u, rr = count_;
   while(lr < rr){
     current_id_ = (lr + rr) >> 1;
@@ -45,15 +234,29 @@ void BlockIterator::Seek(Slice user_key, seq_t seq) {
 
 void BlockIterator::SeekToFirst() {
   current_id_ = 0u;
+  if (format_version_ != kLegacyFormatVersion) {
+    key_.clear();
+    if (limit_ > 0) {
+      ParseRecord(0);
+    } else {
+      current_ = next_ = 0;
+    }
+  }
 }
 
 Slice BlockIterator::key() const {
+  if (format_version_ != kLegacyFormatVersion) {
+    return key_;
+  }
   offset_t entry_offset = *reinterpret_cast<const offset_t*>(offset_ + sizeof(offset_t) * current_id_);
   offset_t key_length = *reinterpret_cast<const offset_t*>(data_ + entry_offset);
   return Slice(data_ + entry_offset + sizeof(offset_t), key_length);
 }
 
 Slice BlockIterator::value() const {
+  if (format_version_ != kLegacyFormatVersion) {
+    return value_;
+  }
   offset_t entry_offset = *reinterpret_cast<const offset_t*>(offset_ + sizeof(offset_t) * current_id_);
   offset_t key_length = *reinterpret_cast<const offset_t*>(data_ + entry_offset);
   offset_t value_length = *reinterpret_cast<const offset_t*>(data_ + entry_offset + sizeof(offset_t) + key_length);
@@ -61,12 +264,24 @@ Slice BlockIterator::value() const {
 }
 
 void BlockIterator::Next() {
+  if (format_version_ != kLegacyFormatVersion) {
+    if (Valid()) {
+      current_ = next_;
+      if (current_ < limit_) {
+        ParseRecord(current_);
+      }
+    }
+    return;
+  }
   if(Valid()){
     ++current_id_;
   }
 }
 
 bool BlockIterator::Valid() {
+  if (format_version_ != kLegacyFormatVersion) {
+    return current_ < limit_;
+  }
   return current_id_ != count_;
 }
 
@@ -8,10 +8,31 @@ namespace wing {
 
 namespace lsm {
 
+/**
+ * The layout of a data block in kPrefixFormatVersion:
+ * record_0, record_1, ..., restart_0, restart_1, ..., num_restarts
+ * A record is: shared (varint32), non_shared (varint32), value_length
+ * (varint32), the last non_shared bytes of the key, the value.
+ * The first shared bytes of the key are the same as the previous key.
+ * A restart point is the offset of a record whose shared is 0.
+ *
+ * In kLegacyFormatVersion, a record is: key_length, key, value_length, value,
+ * and the offsets of all records are at the end of the block.
+ *
+ * In kChecksumFormatVersion, the block is compressed if it saves at least
+ * 1/8 of the space, and the trailer is appended. See lsm/format.hpp.
+ */
 class BlockBuilder {
  public:
-  BlockBuilder(size_t block_size, FileWriter* file)
-    : block_size_(block_size), file_(file) {}
+  BlockBuilder(size_t block_size, FileWriter* file,
+      size_t restart_interval = 16,
+      CompressionType compression = CompressionType::kNone,
+      uint32_t format_version = kLatestFormatVersion)
+    : block_size_(block_size),
+      file_(file),
+      restart_interval_(std::max<size_t>(restart_interval, 1)),
+      compression_(compression),
+      format_version_(format_version) {}
 
   /**
    * It appends key and value to the end of the block
@@ -26,22 +47,35 @@ class BlockBuilder {
    *
    * It is called when the block is full,
    * or there is no more key value pairs.
-   * It writes all the offsets to the end of the block.
+   * It writes all the offsets (or restart points) to the end of the block,
+   * then writes the block to the file.
+   * Return the number of bytes written, i.e., the size in BlockHandle.
    * */
-  void Finish();
+  size_t Finish();
 
   /* The size of the block (including key, value and the offsets)*/
-  size_t size() const { return current_size_; }
+  size_t size() const {
+    if (format_version_ == kLegacyFormatVersion) {
+      return current_size_;
+    }
+    return current_size_ + sizeof(offset_t) * (restarts_.size() + 1);
+  }
 
   /* The number of key-value pairs. */
-  size_t count() const { return offsets_.size(); }
+  size_t count() const { return count_; }
 
   void Clear() {
     current_size_ = offset_ = 0;
+    count_ = 0;
+    buffer_.clear();
     offsets_.clear();
+    restarts_.clear();
+    last_key_.clear();
   }
 
  private:
+  bool AppendLegacy(ParsedKey key, Slice value);
+
   /* The maximum size of a block */
   size_t block_size_{0};
   /* The current used size of the block. */
@@ -50,19 +84,55 @@ class BlockBuilder {
   offset_t offset_{0};
   /* The writer. */
   FileWriter* file_{nullptr};
-
-  /* The offsets of the records in the block. */
+  /* The content of the block, which is written to file_ in Finish. */
+  std::string buffer_;
+  /* The number of key-value pairs. */
+  size_t count_{0};
+  /* The number of records between two restart points. */
+  size_t restart_interval_{16};
+  /* The compression type. It is used since kChecksumFormatVersion. */
+  CompressionType compression_{CompressionType::kNone};
+  /* The format version of the block. */
+  uint32_t format_version_{kLatestFormatVersion};
+
+  /* The offsets of the records in the block. (kLegacyFormatVersion) */
   std::vector<offset_t> offsets_;
+  /* The offsets of the restart points. (kPrefixFormatVersion) */
+  std::vector<offset_t> restarts_;
+  /* The key of the last record. (kPrefixFormatVersion) */
+  std::string last_key_;
 };
 
+/* The checksum in the trailer of a block, which covers the compression type. */
+uint32_t BlockChecksum(Slice data);
+
+/**
+ * Check the trailer of a block in kChecksumFormatVersion and return the
+ * uncompressed block. If it is compressed, it is decompressed into buf.
+ * Otherwise the returned block points into stored.
+ */
+Slice DecodeBlock(Slice stored, std::string* buf);
+
 class BlockIterator final : public Iterator {
  public:
   BlockIterator() = default;
 
-  /* data is a pointer to the beginning of the block. */
-  BlockIterator(const char* data, BlockHandle handle) : data_(data) {
-    offset_ = data_ + handle.size_ - sizeof(offset_t) * handle.count_;
-    count_ = handle.count_;
+  /**
+   * data is a pointer to the beginning of the block.
+   * The iterator is positioned at the first record.
+   */
+  BlockIterator(const char* data, BlockHandle handle,
+      uint32_t format_version = kLatestFormatVersion)
+    : data_(data), count_(handle.count_), format_version_(format_version) {
+    if (format_version_ == kLegacyFormatVersion) {
+      offset_ = data_ + handle.size_ - sizeof(offset_t) * handle.count_;
+    } else {
+      num_restarts_ = *reinterpret_cast<const offset_t*>(
+          data_ + handle.size_ - sizeof(offset_t));
+      offset_ = data_ + handle.size_ - sizeof(offset_t) * (num_restarts_ + 1);
+      limit_ = offset_ - data_;
+    }
+    SeekToFirst();
   }
 
   /* Move the the beginning */
@@ -80,10 +150,28 @@ class BlockIterator final : public Iterator {
   bool Valid() override;
 
  private:
+  /* Parse the record at offset, whose key shares a prefix with key_. */
+  void ParseRecord(offset_t offset);
+
+  /* The full key of the record at the restart point id. */
+  Slice RestartKey(offset_t id) const;
+
   const char* data_{nullptr};
+  /* The offsets of the records, or the restart points. */
   const char* offset_{nullptr};
   offset_t count_{0u};
   offset_t current_id_{0u};
+  uint32_t format_version_{kLatestFormatVersion};
+  /* The fields below are used in kPrefixFormatVersion. */
+  offset_t num_restarts_{0u};
+  /* The end of the records. */
+  offset_t limit_{0u};
+  /* The offset of the current record and the next record. */
+  offset_t current_{0u};
+  offset_t next_{0u};
+  /* The key of the current record, which is decompressed. */
+  std::string key_;
+  Slice value_;
 };
 
 }  // namespace lsm
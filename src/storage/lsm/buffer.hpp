@@ -12,11 +12,13 @@ class AlignedBuffer {
  public:
   AlignedBuffer() = default;
 
-  AlignedBuffer(size_t size, size_t alignment) : size_(size) {
+  /* The size is rounded up to a multiple of alignment for aligned_alloc. */
+  AlignedBuffer(size_t size, size_t alignment)
+    : size_((size + alignment - 1) / alignment * alignment) {
 #ifdef __linux__
-    data_ = reinterpret_cast<char *>(aligned_alloc(alignment, size));
+    data_ = reinterpret_cast<char *>(aligned_alloc(alignment, size_));
 #elif defined(__MINGW64__)
-    data_ = reinterpret_cast<char *>(_aligned_malloc(size, alignment));
+    data_ = reinterpret_cast<char *>(_aligned_malloc(size_, alignment));
 #endif
 
     if (!data_) {
@@ -0,0 +1,83 @@
+#include "storage/lsm/bulk_load.hpp"
+
+#include <algorithm>
+
+#include "storage/lsm/compaction_job.hpp"
+#include "storage/lsm/iterator_heap.hpp"
+#include "storage/lsm/lsm.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+void BulkLoader::Add(Slice key, Slice value) {
+  size_ += key.size() + value.size();
+  records_.emplace_back(key, value);
+  if (size_ >= db_->GetOptions().sst_file_size) {
+    Spill();
+  }
+}
+
+void BulkLoader::Finish() {
+  if (spills_.empty()) {
+    SortRecords();
+    RecordIterator it(records_, 0);
+    db_->Ingest(&it);
+  } else {
+    if (!records_.empty()) {
+      Spill();
+    }
+    // The spills are read once, so they should not pollute the cache.
+    std::vector<SortedRunIterator> its;
+    for (auto& run : spills_) {
+      its.push_back(run->Begin(CacheFill::kNone));
+    }
+    IteratorHeap<Iterator> it_heap;
+    for (auto& it : its) {
+      it_heap.Push(&it);
+    }
+    it_heap.Build();
+    db_->Ingest(&it_heap);
+  }
+  records_.clear();
+  size_ = 0;
+  // The temporary SSTables are removed with the sorted runs.
+  spills_.clear();
+}
+
+void BulkLoader::SortRecords() {
+  std::stable_sort(records_.begin(), records_.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+  size_t n = 0;
+  for (size_t i = 0; i < records_.size(); i++) {
+    if (i + 1 < records_.size() && records_[i + 1].first == records_[i].first) {
+      continue;
+    }
+    if (n != i) {
+      records_[n] = std::move(records_[i]);
+    }
+    n += 1;
+  }
+  records_.resize(n);
+}
+
+void BulkLoader::Spill() {
+  SortRecords();
+  auto& options = db_->GetOptions();
+  CompactionJob worker(db_->filename_gen_.get(), options.block_size,
+      options.sst_file_size, options.write_buffer_size,
+      options.bloom_bits_per_key, options.use_direct_io,
+      options.block_restart_interval, options.compression, options.filter_type);
+  auto run = std::make_shared<SortedRun>(
+      worker.Run(RecordIterator(records_, spills_.size() + 1)),
+      options.block_size, options.use_direct_io, nullptr, false,
+      db_->file_purger_.get());
+  run->SetRemoveTag(true);
+  spills_.push_back(std::move(run));
+  records_.clear();
+  size_ = 0;
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "storage/lsm/iterator.hpp"
+#include "storage/lsm/level.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+class DBImpl;
+
+/**
+ * Load many records into the database without the MemTable and the
+ * write-ahead log. The records are sorted in memory. If they do not fit in
+ * sst_file_size bytes, the sorted chunks are spilled to temporary SSTables and
+ * merged at last. The merged records are written to new SSTables, which are
+ * installed at the lowest level that they do not overlap. See DBImpl::Ingest.
+ */
+class BulkLoader {
+ public:
+  explicit BulkLoader(DBImpl* db) : db_(db) {}
+
+  /* If a key is added many times, the last value is loaded. */
+  void Add(Slice key, Slice value);
+
+  /* Write and install the SSTables. The loader can be reused after it. */
+  void Finish();
+
+ private:
+  /* Sort records_ and keep the last record of each key. */
+  void SortRecords();
+
+  /* Write records_ to a temporary sorted run. */
+  void Spill();
+
+  DBImpl* db_;
+  /* The records that are not spilled, and their size in bytes. */
+  std::vector<std::pair<std::string, std::string>> records_;
+  size_t size_{0};
+  /**
+   * The spilled chunks. The records of chunk i have sequence number i + 1, so
+   * that the last chunk comes first when they are merged.
+   */
+  std::vector<std::shared_ptr<SortedRun>> spills_;
+};
+
+/* It returns the sorted records of a vector at one sequence number. */
+class RecordIterator final : public Iterator {
+ public:
+  RecordIterator(
+      const std::vector<std::pair<std::string, std::string>>& records,
+      seq_t seq)
+    : records_(records), seq_(seq) {
+    Update();
+  }
+
+  bool Valid() override { return id_ < records_.size(); }
+
+  Slice key() const override { return key_.GetSlice(); }
+
+  Slice value() const override { return records_[id_].second; }
+
+  void Next() override {
+    id_ += 1;
+    Update();
+  }
+
+ private:
+  void Update() {
+    if (Valid()) {
+      key_ = InternalKey(records_[id_].first, seq_, RecordType::Value);
+    }
+  }
+
+  const std::vector<std::pair<std::string, std::string>>& records_;
+  seq_t seq_;
+  size_t id_{0};
+  InternalKey key_;
+};
+
+/**
+ * It returns the records of another iterator at one sequence number, which is
+ * the sequence number of the ingested records.
+ */
+class IngestIterator final : public Iterator {
+ public:
+  IngestIterator(Iterator* it, seq_t seq) : it_(it), seq_(seq) { Update(); }
+
+  bool Valid() override { return it_->Valid(); }
+
+  Slice key() const override { return key_.GetSlice(); }
+
+  Slice value() const override { return it_->value(); }
+
+  void Next() override {
+    it_->Next();
+    Update();
+  }
+
+ private:
+  void Update() {
+    if (it_->Valid()) {
+      key_ = InternalKey(
+          ParsedKey(it_->key()).user_key_, seq_, RecordType::Value);
+    }
+  }
+
+  Iterator* it_;
+  seq_t seq_;
+  InternalKey key_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
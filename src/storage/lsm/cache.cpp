@@ -11,69 +11,129 @@ namespace wing {
 
 namespace lsm {
 
-void Cache::unref_block(CacheKey cache_key) {
+Cache::Handle::~Handle() {
+  if (block_.data() != nullptr) {
+    shard_->unref_block(block_id_, info_);
+  }
+}
+
+Cache::Cache(const CacheOptions &options) {
+  if (options.num_shard_bits >= 0) {
+    shard_bits_ = options.num_shard_bits;
+  } else {
+    shard_bits_ = 0;
+    while (shard_bits_ < 6 && (options.capacity >> (shard_bits_ + 1)) >=
+                                  CacheOptions::kMinShardSize) {
+      shard_bits_ += 1;
+    }
+  }
+  size_t shard_count = size_t(1) << shard_bits_;
+  for (size_t i = 0; i < shard_count; i++) {
+    shards_.push_back(std::make_unique<Shard>(
+        options.capacity / shard_count, options.policy));
+  }
+}
+
+Cache::Shard &Cache::GetShard(const CacheKey &cache_key) {
+  if (shard_bits_ == 0) {
+    return *shards_[0];
+  }
+  // The blocks of an SSTable have adjacent keys, so the hash is mixed.
+  uint64_t h = CacheKey::Hash()(cache_key) * 0x9e3779b97f4a7c15ULL;
+  return *shards_[h >> (64 - shard_bits_)];
+}
+
+std::optional<Cache::Handle> Cache::get(
+    uint64_t sstable_id, BlockHandle block, CachePriority priority) {
+  CacheKey cache_key(sstable_id, block.offset_);
+  return GetShard(cache_key).get(cache_key, priority);
+}
+
+Cache::Handle Cache::insert(uint64_t sstable_id, BlockHandle block,
+    std::string &&content, CachePriority priority) {
+  CacheKey cache_key(sstable_id, block.offset_);
+  return GetShard(cache_key).insert(cache_key, std::move(content), priority);
+}
+
+void Cache::Shard::unref_block(CacheKey cache_key, BlockInfo *info) {
+  // The block cannot be evicted while other references remain.
+  if (info->refcount.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  // Before the lock is acquired, other threads may pin and release the block,
+  // and it may even be evicted. So info cannot be used any more.
   std::unique_lock<std::mutex> lock(mu_);
   auto it = cache_.find(cache_key);
-  wing_assert(it != cache_.end());
-  size_t ori = it->second.refcount.fetch_sub(1, std::memory_order_relaxed);
-  if (ori == 1) {
-    auto lru_it = lru_list_.insert(lru_list_.end(), cache_key);
-    auto ret = lru_map_.insert(std::make_pair(cache_key, lru_it));
-    wing_assert(ret.second == true);
+  if (it == cache_.end()) {
+    return;
+  }
+  if (it->second.refcount.load(std::memory_order_relaxed) == 0 &&
+      !it->second.evictable) {
+    policy_->Unpin(cache_key);
+    it->second.evictable = true;
   }
 }
 
-void Cache::evict() {
+void Cache::Shard::evict() {
   wing_assert(size_ >= capacity_);
   do {
-    wing_assert(lru_list_.empty(), "Cache capacity too small!");
-    auto it = lru_list_.begin();
-    const CacheKey &cache_key = *it;
-    wing_assert(lru_map_.erase(cache_key) == 1);
-    auto it2 = cache_.find(cache_key);
-    wing_assert(it2 != cache_.end());
-    size_t refcount = it2->second.refcount.load(std::memory_order_relaxed);
+    // All the blocks are referenced by iterators. Let the cache grow beyond
+    // the capacity until some of them are released.
+    auto victim = policy_->Evict();
+    if (!victim) {
+      break;
+    }
+    auto it = cache_.find(*victim);
+    wing_assert(it != cache_.end() && it->second.evictable);
+    size_t refcount = it->second.refcount.load(std::memory_order_relaxed);
     wing_assert_eq(refcount, (size_t)0);
-    size_ -= it2->second.block.size();
-    cache_.erase(it2);
-    lru_list_.erase(it);
+    size_ -= it->second.block.size();
+    cache_.erase(it);
   } while (size_ >= capacity_);
 }
 
-std::optional<Cache::Handle> Cache::get(
-    uint64_t sstable_id, BlockHandle block) {
-  CacheKey cache_key(sstable_id, block.offset_);
+std::optional<Cache::Handle> Cache::Shard::get(
+    CacheKey cache_key, CachePriority priority) {
   std::unique_lock<std::mutex> lock(mu_);
   auto it = cache_.find(cache_key);
   if (it == cache_.end()) {
     return std::nullopt;
   }
-  size_t ori_refcount =
-      it->second.refcount.fetch_add(1, std::memory_order_relaxed);
-  if (ori_refcount == 0) {
-    auto map_it = lru_map_.find(cache_key);
-    wing_assert(map_it != lru_map_.end());
-    lru_list_.erase(map_it->second);
-    lru_map_.erase(map_it);
+  auto &info = it->second;
+  // Increments are serialized by mu_, so that a pinned block is never evicted.
+  info.refcount.fetch_add(1, std::memory_order_relaxed);
+  policy_->Touch(cache_key, priority);
+  if (info.evictable) {
+    policy_->Pin(cache_key);
+    info.evictable = false;
   }
-  return Handle(*this, cache_key, it->second.block);
+  return Handle(this, cache_key, &info, info.block);
 }
 
-Cache::Handle Cache::insert(
-    uint64_t sstable_id, BlockHandle block, std::string &&content) {
-  CacheKey cache_key(sstable_id, block.offset_);
+Cache::Handle Cache::Shard::insert(
+    CacheKey cache_key, std::string &&content, CachePriority priority) {
   size_t size = content.size();
   std::unique_lock<std::mutex> lock(mu_);
   auto ret =
       cache_.emplace(std::piecewise_construct, std::forward_as_tuple(cache_key),
           std::forward_as_tuple(std::move(content), 1));
+  auto &info = ret.first->second;
   if (ret.second) {
     size_ += size;
+    policy_->Insert(cache_key, size, priority);
     if (size_ > capacity_) {
       evict();
     }
+  } else {
+    // Another reader has inserted the same block. Reuse it.
+    info.refcount.fetch_add(1, std::memory_order_relaxed);
+    policy_->Touch(cache_key, priority);
+    if (info.evictable) {
+      policy_->Pin(cache_key);
+      info.evictable = false;
+    }
   }
-  return Handle(*this, std::move(cache_key), ret.first->second.block);
+  return Handle(this, cache_key, &info, info.block);
 }
 
 }  // namespace lsm
@@ -2,12 +2,13 @@
 
 #include <atomic>
 #include <functional>
-#include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <unordered_map>
+#include <vector>
 
-#include "storage/lsm/format.hpp"
+#include "storage/lsm/cache_policy.hpp"
 
 namespace wing {
 
@@ -15,89 +16,145 @@ namespace lsm {
 
 struct CacheOptions {
   size_t capacity = 8 * 1024 * 1024;  // 8MiB
+  /* The policy that decides which block is evicted. */
+  CachePolicyType policy = CachePolicyType::kTinyLFU;
+  /**
+   * The cache is split into 2^num_shard_bits shards, each with its own lock.
+   * If it is negative, it is chosen so that each shard has at least
+   * kMinShardSize bytes, and there are at most 64 shards.
+   */
+  int num_shard_bits = -1;
+
+  static constexpr size_t kMinShardSize = 512 * 1024;
 };
 
-class CacheKey {
- public:
-  CacheKey(uint64_t sstable_id, offset_t offset)
-    : sst_id_(sstable_id), offset_(offset) {}
-
-  bool operator==(const CacheKey &rhs) const {
-    return sst_id_ == rhs.sst_id_ && offset_ == rhs.offset_;
-  }
-
-  struct Hash {
-    size_t operator()(const CacheKey &x) const {
-      return (x.sst_id_ << 32) | x.offset_;
-    }
-  };
-
- private:
-  uint64_t sst_id_;
-  offset_t offset_;
+/* How a reader fills the block cache with the blocks that are not cached. */
+enum class CacheFill : uint8_t {
+  /**
+   * They are read into the reader's private buffer and are not inserted. It
+   * is used by compactions, which read every block exactly once.
+   */
+  kNone = 0,
+  /* They are inserted with CachePriority::kLow. It is used by long scans. */
+  kLowPriority,
+  /* They are inserted with CachePriority::kHigh. */
+  kHighPriority,
 };
 
 class Cache {
+  class Shard;
+  struct BlockInfo;
+
  public:
   class Handle {
    public:
     Handle(const Handle &) = delete;
     Handle &operator=(const Handle &) = delete;
     Handle(Handle &&rhs)
-      : cache_(rhs.cache_), block_id_(rhs.block_id_), block_(rhs.block_) {
+      : shard_(rhs.shard_),
+        block_id_(rhs.block_id_),
+        info_(rhs.info_),
+        block_(rhs.block_) {
       rhs.block_ = std::string_view();
     }
     Handle &operator=(Handle &&rhs) {
       this->~Handle();
-      cache_ = rhs.cache_;
+      shard_ = rhs.shard_;
       block_id_ = rhs.block_id_;
+      info_ = rhs.info_;
       block_ = rhs.block_;
       rhs.block_ = std::string_view();
       return *this;
     }
-    ~Handle() {
-      if (block_.data() != nullptr)
-        cache_.get().unref_block(block_id_);
-    }
+    ~Handle();
 
     std::string_view block() const { return block_; }
 
    private:
-    Handle(Cache &cache, CacheKey block_id, std::string_view block)
-      : cache_(cache), block_id_(block_id), block_(block) {}
+    Handle(Shard *shard, CacheKey block_id, BlockInfo *info,
+        std::string_view block)
+      : shard_(shard), block_id_(block_id), info_(info), block_(block) {}
 
-    std::reference_wrapper<Cache> cache_;
+    Shard *shard_;
     CacheKey block_id_;
+    BlockInfo *info_;
     std::string_view block_;
 
     friend class Cache;
+    friend class Shard;
   };
 
-  Cache(const CacheOptions &options) : capacity_(options.capacity), size_(0) {}
+  Cache(const CacheOptions &options);
 
-  std::optional<Cache::Handle> get(uint64_t sstable_id, BlockHandle block);
-  Handle insert(uint64_t sstable_id, BlockHandle block, std::string &&content);
+  /* priority: see CachePriority. A low priority hit does not count. */
+  std::optional<Cache::Handle> get(uint64_t sstable_id, BlockHandle block,
+      CachePriority priority = CachePriority::kHigh);
+  Handle insert(uint64_t sstable_id, BlockHandle block, std::string &&content,
+      CachePriority priority = CachePriority::kHigh);
+
+  size_t shard_count() const { return shards_.size(); }
+
+  /**
+   * A new id for the blocks of an SSTable. The SSTable ids are only unique in
+   * one DBImpl, so the SSTables are cached under these ids instead, and many
+   * DBImpls can share a cache.
+   */
+  uint64_t NewId() { return next_id_.fetch_add(1, std::memory_order_relaxed); }
 
  private:
   struct BlockInfo {
     std::string block;
     std::atomic<size_t> refcount;
+    /**
+     * Whether it is unpinned in the policy of the shard. It is protected by
+     * the mutex of the shard. It may be false while refcount is 0, if the
+     * thread which released the last reference has not locked the shard yet.
+     */
+    bool evictable{false};
 
     BlockInfo(std::string &&b, size_t rc) : block(std::move(b)), refcount(rc) {}
   };
 
-  void unref_block(CacheKey block_id);
-  // REQUIRES: this->mu_ held
-  void evict();
+  /**
+   * A partition of the cache with its own mutex, policy and a share of the
+   * capacity. Blocks are assigned to shards by the hash of their keys.
+   */
+  class Shard {
+   public:
+    Shard(size_t capacity, CachePolicyType policy)
+      : capacity_(capacity),
+        size_(0),
+        policy_(CachePolicy::Create(policy, capacity)) {}
+
+    std::optional<Cache::Handle> get(
+        CacheKey cache_key, CachePriority priority);
+    Handle insert(
+        CacheKey cache_key, std::string &&content, CachePriority priority);
+    /**
+     * Release a reference of the block. Only the last reference locks the
+     * shard to unpin the block.
+     */
+    void unref_block(CacheKey block_id, BlockInfo *info);
+
+   private:
+    // REQUIRES: this->mu_ held
+    void evict();
+
+    const size_t capacity_;
+
+    std::mutex mu_;
+    std::unordered_map<CacheKey, BlockInfo, CacheKey::Hash> cache_;
+    size_t size_;
+    /* The blocks are pinned in it while they are referenced. */
+    std::unique_ptr<CachePolicy> policy_;
+  };
 
-  const size_t capacity_;
+  Shard &GetShard(const CacheKey &cache_key);
 
-  std::mutex mu_;
-  std::unordered_map<CacheKey, BlockInfo, CacheKey::Hash> cache_;
-  size_t size_;
-  std::unordered_map<CacheKey, std::list<CacheKey>::iterator, CacheKey::Hash>
-      lru_map_;
-  std::list<CacheKey> lru_list_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  /* There are 2^shard_bits_ shards. */
+  size_t shard_bits_;
+  std::atomic<uint64_t> next_id_{0};
 
   friend class Block;
 };
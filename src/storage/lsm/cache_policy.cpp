@@ -0,0 +1,245 @@
+#include "storage/lsm/cache_policy.hpp"
+
+#include <algorithm>
+
+namespace wing {
+
+namespace lsm {
+
+std::unique_ptr<CachePolicy> CachePolicy::Create(
+    CachePolicyType type, size_t capacity) {
+  switch (type) {
+    case CachePolicyType::kLRU:
+      return std::make_unique<LRUCachePolicy>();
+    case CachePolicyType::kTinyLFU:
+      return std::make_unique<TinyLFUCachePolicy>(capacity);
+  }
+  DB_ERR("Unknown cache policy type {}", static_cast<int>(type));
+}
+
+void LRUCachePolicy::Insert(
+    const CacheKey &key, size_t charge, CachePriority priority) {
+  nodes_.emplace(key, Node{priority == CachePriority::kLow, true, {}});
+}
+
+void LRUCachePolicy::Touch(const CacheKey &key, CachePriority priority) {
+  if (priority == CachePriority::kLow) {
+    return;
+  }
+  auto &node = nodes_.find(key)->second;
+  node.low_priority = false;
+  if (!node.pinned) {
+    lru_list_.splice(lru_list_.end(), lru_list_, node.lru_it);
+  }
+}
+
+void LRUCachePolicy::Pin(const CacheKey &key) {
+  auto &node = nodes_.find(key)->second;
+  wing_assert(!node.pinned);
+  lru_list_.erase(node.lru_it);
+  node.pinned = true;
+}
+
+void LRUCachePolicy::Unpin(const CacheKey &key) {
+  auto &node = nodes_.find(key)->second;
+  wing_assert(node.pinned);
+  node.lru_it = lru_list_.insert(
+      node.low_priority ? lru_list_.begin() : lru_list_.end(), key);
+  node.pinned = false;
+}
+
+std::optional<CacheKey> LRUCachePolicy::Evict() {
+  if (lru_list_.empty()) {
+    return std::nullopt;
+  }
+  CacheKey key = lru_list_.front();
+  lru_list_.pop_front();
+  nodes_.erase(key);
+  return key;
+}
+
+FrequencySketch::FrequencySketch(size_t width) : width_(1) {
+  while (width_ < width) {
+    width_ <<= 1;
+  }
+  table_.resize(kDepth * width_);
+  sample_size_ = 10 * width_;
+}
+
+size_t FrequencySketch::Index(size_t hash, size_t row) const {
+  static constexpr uint64_t kSeeds[kDepth] = {0xc3a5c85c97cb3127ULL,
+      0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+  uint64_t h = (hash + kSeeds[row]) * 0x9e3779b97f4a7c15ULL;
+  h ^= h >> 32;
+  return row * width_ + (h & (width_ - 1));
+}
+
+void FrequencySketch::Increment(size_t hash) {
+  for (size_t i = 0; i < kDepth; i++) {
+    auto &count = table_[Index(hash, i)];
+    if (count < kMaxCount) {
+      count += 1;
+    }
+  }
+  if (++additions_ == sample_size_) {
+    for (auto &count : table_) {
+      count >>= 1;
+    }
+    additions_ /= 2;
+  }
+}
+
+uint32_t FrequencySketch::Estimate(size_t hash) const {
+  uint32_t ret = kMaxCount;
+  for (size_t i = 0; i < kDepth; i++) {
+    ret = std::min<uint32_t>(ret, table_[Index(hash, i)]);
+  }
+  return ret;
+}
+
+// The window takes 1% of the capacity, and the protected segment takes 80% of
+// the main cache, as in the W-TinyLFU paper. The sketch has about one counter
+// per KiB of capacity.
+TinyLFUCachePolicy::TinyLFUCachePolicy(size_t capacity)
+  : window_capacity_(capacity / 100),
+    main_capacity_(capacity - window_capacity_),
+    protected_capacity_(main_capacity_ / 5 * 4),
+    sketch_(std::max<size_t>(capacity >> 10, 64)) {}
+
+void TinyLFUCachePolicy::Insert(
+    const CacheKey &key, size_t charge, CachePriority priority) {
+  sketch_.Increment(CacheKey::Hash()(key));
+  nodes_.emplace(key, Node{charge, Segment::kWindow,
+                          priority == CachePriority::kLow, true, {}});
+  window_size_ += charge;
+  ShrinkWindow();
+}
+
+void TinyLFUCachePolicy::Touch(const CacheKey &key, CachePriority priority) {
+  if (priority == CachePriority::kLow) {
+    return;
+  }
+  sketch_.Increment(CacheKey::Hash()(key));
+  auto &node = nodes_.find(key)->second;
+  node.low_priority = false;
+  if (node.segment == Segment::kWindow) {
+    Move(key, node, Segment::kWindow);
+    return;
+  }
+  Move(key, node, Segment::kProtected);
+  while (protected_size_ > protected_capacity_ && !protected_.empty()) {
+    CacheKey demoted = protected_.front();
+    Move(demoted, nodes_.find(demoted)->second, Segment::kProbation);
+  }
+}
+
+void TinyLFUCachePolicy::Pin(const CacheKey &key) {
+  auto &node = nodes_.find(key)->second;
+  wing_assert(!node.pinned);
+  Detach(node);
+  node.pinned = true;
+}
+
+void TinyLFUCachePolicy::Unpin(const CacheKey &key) {
+  auto &node = nodes_.find(key)->second;
+  wing_assert(node.pinned);
+  node.pinned = false;
+  Attach(key, node);
+  ShrinkWindow();
+}
+
+std::optional<CacheKey> TinyLFUCachePolicy::Evict() {
+  ShrinkWindow();
+  auto &victims = !probation_.empty() ? probation_ : protected_;
+  if (victims.empty()) {
+    return window_.empty() ? std::nullopt
+                           : std::optional<CacheKey>(Remove(window_.front()));
+  }
+  // The candidate is the block leaving the window if the main cache is full,
+  // or the block that entered the main cache last. The victim is evicted only
+  // if the candidate is more popular, so that the blocks of one scan replace
+  // each other instead of the hot blocks.
+  bool from_window = window_size_ > window_capacity_ && !window_.empty();
+  CacheKey victim = victims.front();
+  CacheKey candidate = from_window ? window_.front() : victims.back();
+  if (candidate == victim) {
+    return Remove(victim);
+  }
+  if (sketch_.Estimate(CacheKey::Hash()(candidate)) <=
+      sketch_.Estimate(CacheKey::Hash()(victim))) {
+    return Remove(candidate);
+  }
+  Remove(victim);
+  if (from_window) {
+    Move(candidate, nodes_.find(candidate)->second, Segment::kProbation);
+  }
+  return victim;
+}
+
+void TinyLFUCachePolicy::ShrinkWindow() {
+  while (window_size_ > window_capacity_ && !window_.empty()) {
+    CacheKey key = window_.front();
+    auto &node = nodes_.find(key)->second;
+    if (probation_size_ + protected_size_ + node.charge > main_capacity_) {
+      break;
+    }
+    Move(key, node, Segment::kProbation);
+  }
+}
+
+void TinyLFUCachePolicy::Attach(const CacheKey &key, Node &node) {
+  if (node.pinned) {
+    return;
+  }
+  auto &list = List(node.segment);
+  node.it = list.insert(node.low_priority ? list.begin() : list.end(), key);
+}
+
+void TinyLFUCachePolicy::Detach(Node &node) {
+  if (!node.pinned) {
+    List(node.segment).erase(node.it);
+  }
+}
+
+void TinyLFUCachePolicy::Move(
+    const CacheKey &key, Node &node, Segment segment) {
+  Detach(node);
+  Size(node.segment) -= node.charge;
+  node.segment = segment;
+  Size(node.segment) += node.charge;
+  Attach(key, node);
+}
+
+CacheKey TinyLFUCachePolicy::Remove(CacheKey key) {
+  auto it = nodes_.find(key);
+  Detach(it->second);
+  Size(it->second.segment) -= it->second.charge;
+  nodes_.erase(it);
+  return key;
+}
+
+std::list<CacheKey> &TinyLFUCachePolicy::List(Segment segment) {
+  switch (segment) {
+    case Segment::kWindow:
+      return window_;
+    case Segment::kProbation:
+      return probation_;
+    default:
+      return protected_;
+  }
+}
+
+size_t &TinyLFUCachePolicy::Size(Segment segment) {
+  switch (segment) {
+    case Segment::kWindow:
+      return window_size_;
+    case Segment::kProbation:
+      return probation_size_;
+    default:
+      return protected_size_;
+  }
+}
+
+}  // namespace lsm
+
+}  // namespace wing
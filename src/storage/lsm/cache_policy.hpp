@@ -0,0 +1,213 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+class CacheKey {
+ public:
+  CacheKey(uint64_t sstable_id, offset_t offset)
+    : sst_id_(sstable_id), offset_(offset) {}
+
+  bool operator==(const CacheKey &rhs) const {
+    return sst_id_ == rhs.sst_id_ && offset_ == rhs.offset_;
+  }
+
+  struct Hash {
+    size_t operator()(const CacheKey &x) const {
+      return (x.sst_id_ << 32) | x.offset_;
+    }
+  };
+
+ private:
+  uint64_t sst_id_;
+  offset_t offset_;
+};
+
+enum class CachePriority : uint8_t {
+  /* The block is read by a lookup, and is likely to be read again. */
+  kHigh = 0,
+  /**
+   * The block is read by a long scan, and is likely to be read only once. It
+   * is evicted before the high priority blocks.
+   */
+  kLow,
+};
+
+enum class CachePolicyType : uint8_t {
+  /* The least recently used block is evicted. */
+  kLRU = 0,
+  /**
+   * W-TinyLFU. New blocks enter a small LRU window. A block leaving the window
+   * enters the main cache only if it is accessed more frequently than the
+   * block it would evict, so that one scan does not flush the hot blocks.
+   */
+  kTinyLFU,
+};
+
+/**
+ * It decides which block is evicted from the block cache. A block is pinned
+ * while it is referenced, and a pinned block cannot be evicted.
+ * The methods are called with the cache mutex held, so they need no lock.
+ */
+class CachePolicy {
+ public:
+  virtual ~CachePolicy() = default;
+
+  /* A block of charge bytes is inserted. It is pinned. */
+  virtual void Insert(
+      const CacheKey &key, size_t charge, CachePriority priority) = 0;
+
+  /* A cached block is read. Hits of low priority are not recorded. */
+  virtual void Touch(const CacheKey &key, CachePriority priority) = 0;
+
+  /* The block is referenced again after it was unpinned. */
+  virtual void Pin(const CacheKey &key) = 0;
+
+  /* The last reference to the block is released. */
+  virtual void Unpin(const CacheKey &key) = 0;
+
+  /**
+   * Choose an unpinned block to evict and forget it. It returns std::nullopt
+   * if all the blocks are pinned.
+   */
+  virtual std::optional<CacheKey> Evict() = 0;
+
+  static std::unique_ptr<CachePolicy> Create(
+      CachePolicyType type, size_t capacity);
+};
+
+class LRUCachePolicy final : public CachePolicy {
+ public:
+  void Insert(
+      const CacheKey &key, size_t charge, CachePriority priority) override;
+
+  void Touch(const CacheKey &key, CachePriority priority) override;
+
+  void Pin(const CacheKey &key) override;
+
+  void Unpin(const CacheKey &key) override;
+
+  std::optional<CacheKey> Evict() override;
+
+ private:
+  struct Node {
+    /* A low priority block is put at the front of lru_list_ when unpinned. */
+    bool low_priority;
+    bool pinned;
+    /* The position in lru_list_. It is valid only if it is not pinned. */
+    std::list<CacheKey>::iterator lru_it;
+  };
+
+  std::unordered_map<CacheKey, Node, CacheKey::Hash> nodes_;
+  /* The unpinned blocks. The front is the least recently used one. */
+  std::list<CacheKey> lru_list_;
+};
+
+/**
+ * A count-min sketch of the access frequencies of blocks. The counters are
+ * halved periodically, so that the blocks that were hot long ago are
+ * forgotten.
+ */
+class FrequencySketch {
+ public:
+  /* width is rounded up to a power of 2. */
+  explicit FrequencySketch(size_t width);
+
+  void Increment(size_t hash);
+
+  /* It never underestimates the frequency, unless the counters are halved. */
+  uint32_t Estimate(size_t hash) const;
+
+ private:
+  static constexpr size_t kDepth = 4;
+  static constexpr uint8_t kMaxCount = 15;
+
+  size_t Index(size_t hash, size_t row) const;
+
+  /* kDepth rows of width_ counters */
+  std::vector<uint8_t> table_;
+  size_t width_;
+  /* The number of increments. The counters are halved at sample_size_. */
+  size_t additions_{0};
+  size_t sample_size_;
+};
+
+class TinyLFUCachePolicy final : public CachePolicy {
+ public:
+  explicit TinyLFUCachePolicy(size_t capacity);
+
+  void Insert(
+      const CacheKey &key, size_t charge, CachePriority priority) override;
+
+  void Touch(const CacheKey &key, CachePriority priority) override;
+
+  void Pin(const CacheKey &key) override;
+
+  void Unpin(const CacheKey &key) override;
+
+  std::optional<CacheKey> Evict() override;
+
+ private:
+  /**
+   * New blocks enter the window. The main cache is a segmented LRU: blocks
+   * admitted from the window enter the probation segment, and are promoted to
+   * the protected segment when they are read again.
+   */
+  enum class Segment : uint8_t { kWindow = 0, kProbation, kProtected };
+
+  struct Node {
+    size_t charge;
+    Segment segment;
+    bool low_priority;
+    bool pinned;
+    /* The position in the list of its segment. Valid if it is not pinned. */
+    std::list<CacheKey>::iterator it;
+  };
+
+  /* Move the blocks out of the window while the main cache is not full. */
+  void ShrinkWindow();
+
+  /* Put the node into the list of its segment if it is not pinned. */
+  void Attach(const CacheKey &key, Node &node);
+
+  /* Remove the node from the list of its segment if it is not pinned. */
+  void Detach(Node &node);
+
+  /* Move the node to another segment. */
+  void Move(const CacheKey &key, Node &node, Segment segment);
+
+  /* Forget the unpinned block and return its key. */
+  CacheKey Remove(CacheKey key);
+
+  std::list<CacheKey> &List(Segment segment);
+
+  size_t &Size(Segment segment);
+
+  const size_t window_capacity_;
+  const size_t main_capacity_;
+  const size_t protected_capacity_;
+
+  FrequencySketch sketch_;
+  std::unordered_map<CacheKey, Node, CacheKey::Hash> nodes_;
+  /* The unpinned blocks of each segment. The front is the least recent. */
+  std::list<CacheKey> window_;
+  std::list<CacheKey> probation_;
+  std::list<CacheKey> protected_;
+  /* The total charge of each segment, including the pinned blocks. */
+  size_t window_size_{0};
+  size_t probation_size_{0};
+  size_t protected_size_{0};
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <optional>
+
+#include "storage/lsm/range_del.hpp"
 #include "storage/lsm/sst.hpp"
 
 namespace wing {
@@ -9,52 +15,137 @@ namespace lsm {
 class CompactionJob {
  public:
   CompactionJob(FileNameGenerator* gen, size_t block_size, size_t sst_size,
-      size_t write_buffer_size, size_t bloom_bits_per_key, bool use_direct_io)
+      size_t write_buffer_size, size_t bloom_bits_per_key, bool use_direct_io,
+      size_t block_restart_interval = 16,
+      CompressionType compression = CompressionType::kNone,
+      FilterType filter_type = FilterType::kBlockedBloom,
+      bool bottommost = false, std::vector<seq_t> snapshots = {})
     : file_gen_(gen),
       block_size_(block_size),
       sst_size_(sst_size),
       write_buffer_size_(write_buffer_size),
       bloom_bits_per_key_(bloom_bits_per_key),
-      use_direct_io_(use_direct_io) {}
+      use_direct_io_(use_direct_io),
+      block_restart_interval_(block_restart_interval),
+      compression_(compression),
+      filter_type_(filter_type),
+      bottommost_(bottommost),
+      snapshots_(std::move(snapshots)) {
+    std::sort(snapshots_.begin(), snapshots_.end());
+  }
 
   /**
    * It receives an iterator and returns a list of SSTable
+   * If end is given, it stops at the first record whose user key >= end.
+   * range_dels: the range tombstones of the inputs, which are clipped to the
+   * key range of the job. The records deleted by them are dropped, and they
+   * are written to the SSTables whose key ranges contain them.
+   * If the job is bottommost, the deletion records and the range tombstones
+   * are dropped too, and the job may return no SSTable.
+   * A version of a key is kept if a snapshot reads it, and a tombstone is kept
+   * if a snapshot reads a record it deletes. See Stripe.
    */
   template <typename IterT>
-  std::vector<SSTInfo> Run(IterT&& it) {
+  std::vector<SSTInfo> Run(IterT&& it, std::optional<Slice> end = std::nullopt,
+      const std::vector<RangeTombstone>& range_dels = {}) {
     std::vector<SSTInfo> ssts;
-    while(it.Valid()){
+    auto valid = [&]() {
+      return it.Valid() && (!end || ParsedKey(it.key()).user_key_ < *end);
+    };
+    // A record is deleted by a tombstone only if no snapshot is between them,
+    // so each stripe checks the tombstones up to its snapshot.
+    std::vector<RangeDelAggregator> range_del_aggs;
+    if(!range_dels.empty()){
+      range_del_aggs.resize(snapshots_.size() + 1);
+      for(size_t i = 0; i < range_del_aggs.size(); i++){
+        range_del_aggs[i].Add(range_dels, i < snapshots_.size()
+            ? snapshots_[i] : std::numeric_limits<seq_t>::max());
+        range_del_aggs[i].Build();
+      }
+    }
+    // Nothing older than the inputs is left for a bottommost tombstone. It is
+    // dropped if no snapshot reads the records older than it.
+    auto drop_tombstone = [&](seq_t seq) {
+      return bottommost_ && Stripe(seq) == 0;
+    };
+    bool keep_range_dels = std::any_of(range_dels.begin(), range_dels.end(),
+        [&](const RangeTombstone& t) { return !drop_tombstone(t.seq_); });
+    /* The tombstones of the next SSTable start from lower. */
+    std::string lower;
+    while(valid() || (ssts.empty() && keep_range_dels)){
       auto file_info = file_gen_->Generate();
       std::string file_name = file_info.first;
       size_t file_id = file_info.second;
       auto builder = SSTableBuilder(std::make_unique<FileWriter>(
         std::make_unique<SeqWriteFile>(file_name, use_direct_io_), write_buffer_size_
-      ), block_size_, bloom_bits_per_key_);
-      while(it.Valid() && builder.size() <= sst_size_){
-        builder.Append(ParsedKey(it.key()), it.value());
-        std::string dup_key{InternalKey(it.key()).user_key()};
-        it.Next();
-        while(it.Valid()){
-          if(dup_key != InternalKey(it.key()).user_key()){
-            break;
+      ), block_size_, bloom_bits_per_key_, block_restart_interval_,
+      compression_, kLatestFormatVersion, filter_type_);
+      std::string last_key;
+      while(valid() && builder.size() <= sst_size_){
+        std::string dup_key{ParsedKey(it.key()).user_key_};
+        // The versions are visited from the newest one. Only the newest
+        // version of each stripe is read by a snapshot.
+        size_t last_stripe = std::numeric_limits<size_t>::max();
+        do {
+          auto key = ParsedKey(it.key());
+          size_t stripe = Stripe(key.seq_);
+          if(stripe != last_stripe){
+            last_stripe = stripe;
+            bool deleted = !range_del_aggs.empty() &&
+                           range_del_aggs[stripe].ShouldDelete(key);
+            if(!deleted && !(key.type_ == RecordType::Deletion &&
+                             drop_tombstone(key.seq_))){
+              builder.Append(key, it.value());
+              last_key = dup_key;
+            }
           }
           it.Next();
+        } while(it.Valid() && ParsedKey(it.key()).user_key_ == dup_key);
+      }
+      // The SSTable takes the tombstones up to its last key, unless it is the
+      // last one, so that the SSTables do not overlap.
+      std::optional<std::string> upper;
+      if(valid() && builder.count() > 0){
+        upper = last_key + '\0';
+      }
+      for(auto& tombstone : ClipRangeTombstones(range_dels, lower, upper)){
+        if(!drop_tombstone(tombstone.seq_)){
+          builder.AddRangeTombstone(tombstone);
         }
       }
+      if(upper){
+        lower = *upper;
+      }
       builder.Finish();
+      if(builder.count() == 0 && builder.tombstone_count() == 0){
+        // All the records are dropped.
+        std::filesystem::remove(file_name);
+        continue;
+      }
       ssts.emplace_back(SSTInfo{
         builder.size(),
         builder.count(),
         file_id,
         builder.GetIndexOffset(),
         builder.GetBloomFilterOffset(),
-        file_name
+        file_name,
+        builder.tombstone_count()
       });
     }
     return ssts;
   }
 
  private:
+  /**
+   * The index of the oldest snapshot that reads the records of seq, i.e.
+   * the first snapshot >= seq. It is snapshots_.size() if there is none.
+   * Only the newest version of a key in each stripe is read.
+   */
+  size_t Stripe(seq_t seq) const {
+    return std::lower_bound(snapshots_.begin(), snapshots_.end(), seq) -
+           snapshots_.begin();
+  }
+
   /* Generate new SSTable file name */
   FileNameGenerator* file_gen_;
   /* The target block size */
@@ -67,6 +158,16 @@ class CompactionJob {
   size_t bloom_bits_per_key_;
   /* Use O_DIRECT or not */
   bool use_direct_io_;
+  /* The number of records between two restart points in a data block */
+  size_t block_restart_interval_;
+  /* The compression type of data blocks */
+  CompressionType compression_;
+  /* The filter type of SSTables */
+  FilterType filter_type_;
+  /* No record older than the inputs exists out of the job. */
+  bool bottommost_;
+  /* The sequence numbers of the live snapshots, sorted. */
+  std::vector<seq_t> snapshots_;
 };
 
 }  // namespace lsm
@@ -4,6 +4,41 @@ namespace wing {
 
 namespace lsm {
 
+bool CompactionPicker::InCompaction(const Level& level) {
+  for(auto& run : level.GetRuns()){
+    if(run->GetCompactionInProcess()){
+      return true;
+    }
+    for(auto& sst : run->GetSSTs()){
+      if(sst->GetCompactionInProcess()){
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool CompactionPicker::IsTombstoneDense(const SSTable& sst) const {
+  auto& info = sst.GetSSTInfo();
+  return tombstone_ratio_ > 0 && !tombstone_compaction_paused_ &&
+         info.tombstone_count_ > 0 &&
+         info.tombstone_count_ >= tombstone_ratio_ * info.count_;
+}
+
+bool CompactionPicker::IsTombstoneDense(const Level& level) const {
+  if(tombstone_ratio_ <= 0 || tombstone_compaction_paused_){
+    return false;
+  }
+  for(auto& run : level.GetRuns()){
+    for(auto& sst : run->GetSSTs()){
+      if(IsTombstoneDense(*sst)){
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
   const std::vector<Level> &levels = version->GetLevels();
   if(levels.empty()){
@@ -16,30 +51,58 @@ std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
 
   for(size_t i = 1, size_limit = base_level_size_; i < levels.size(); ++i){
     size_limit *= ratio_;
+    if(levels[i].GetRuns().empty() || InCompaction(levels[i]) ||
+       (i + 1 < levels.size() && InCompaction(levels[i + 1]))){
+      continue;
+    }
     auto leveln_run = levels[i].GetRuns()[0];
-    if(levels[i].size() >= size_limit){
-      if(levels.size() == i + 1){
+    // If the level is not full, only the SSTables dense in tombstones are
+    // compacted, and only into the bottom level, where the tombstones are
+    // dropped.
+    bool full = levels[i].size() >= size_limit;
+    if(full || (i + 2 >= levels.size() && IsTombstoneDense(levels[i]))){
+      if(levels.size() == i + 1 && full){
         input_ssts.push_back(leveln_run->GetSSTs()[0]);
         is_trivial_move = true;
-      } 
+      }
+      else if(levels.size() == i + 1){
+        // Rewrite the SSTable in the bottom level, which drops the tombstones.
+        for(auto& sst : leveln_run->GetSSTs()){
+          if(IsTombstoneDense(*sst)){
+            input_ssts.push_back(sst);
+            break;
+          }
+        }
+        return std::make_unique<Compaction>(input_ssts,
+          input_runs, i, i, leveln_run, false);
+      }
       else {
-        auto levelnxt_run = levels[i+1].GetRuns()[0];
-        target_sorted_run = levelnxt_run;
-        auto targ_run_ssts = target_sorted_run->GetSSTs();
+        // The tombstone compactions may have emptied the next level. Then
+        // the SSTable is moved down trivially.
+        std::vector<std::shared_ptr<SSTable>> targ_run_ssts;
+        if(!levels[i+1].GetRuns().empty()){
+          target_sorted_run = levels[i+1].GetRuns()[0];
+          targ_run_ssts = target_sorted_run->GetSSTs();
+        }
         auto lp = targ_run_ssts.begin(), rp = targ_run_ssts.begin();
         size_t overlap_size = 0;
         auto best_l = lp, best_r = rp;
         std::shared_ptr<SSTable> best_sst = nullptr;
         size_t min_overlap_size = __SIZE_MAX__;
         for(auto it : leveln_run->GetSSTs()){
-          if(it->GetCompactionInProcess() || it->GetRemoveTag()){
+          if(it->GetCompactionInProcess() || it->GetRemoveTag() ||
+             (!full && !IsTombstoneDense(*it))){
             continue;
           }
-          while(rp != targ_run_ssts.end() && (*rp)->GetSmallestKey() <= it->GetLargestKey()){
+          // The user keys are compared, since the versions of a user key can
+          // be at the boundaries of SSTables in different levels.
+          while(rp != targ_run_ssts.end() &&
+                (*rp)->GetSmallestKey().user_key_ <= it->GetLargestKey().user_key_){
             overlap_size += (*rp)->GetSSTInfo().size_;
             ++rp;
           }
-          while(lp != targ_run_ssts.end() && (*lp)->GetLargestKey() < it->GetSmallestKey()){
+          while(lp != targ_run_ssts.end() &&
+                (*lp)->GetLargestKey().user_key_ < it->GetSmallestKey().user_key_){
             overlap_size -= (*lp)->GetSSTInfo().size_;
             ++lp;
           }
@@ -66,9 +129,10 @@ std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
         input_runs, i, i + 1, target_sorted_run, is_trivial_move);
     }
   }
-  if(levels[0].GetRuns().size() >= level0_compaction_trigger_){
+  if(levels[0].GetRuns().size() >= level0_compaction_trigger_ &&
+     !InCompaction(levels[0]) && (levels.size() == 1 || !InCompaction(levels[1]))){
     input_runs = std::move(levels[0].GetRuns());
-    if(levels.size() > 1){
+    if(levels.size() > 1 && !levels[1].GetRuns().empty()){
       input_runs.emplace_back(levels[1].GetRuns()[0]);
     }
     return std::make_unique<Compaction>(input_ssts, 
@@ -85,13 +149,25 @@ std::unique_ptr<Compaction> TieredCompactionPicker::Get(Version* version) {
   size_t size_limit = base_level_size_;
   for(size_t i = 1; i < levels.size(); ++i){
     size_limit *= ratio_;
-    if(levels[i].GetRuns().size() >= ratio_ || levels[i].size() >= size_limit){
+    if(InCompaction(levels[i]) ||
+       (i + 1 < levels.size() && InCompaction(levels[i + 1]))){
+      continue;
+    }
+    if(levels[i].GetRuns().size() >= ratio_ || levels[i].size() >= size_limit ||
+       (i + 2 == levels.size() && IsTombstoneDense(levels[i]))){
       std::vector<std::shared_ptr<SSTable>> input_ssts;
       return std::make_unique<Compaction>(input_ssts, 
         levels[i].GetRuns(), i, i + 1, nullptr, false);
     }
+    // Rewrite the last level, which drops the tombstones.
+    if(i + 1 == levels.size() && IsTombstoneDense(levels[i])){
+      std::vector<std::shared_ptr<SSTable>> input_ssts;
+      return std::make_unique<Compaction>(input_ssts,
+        levels[i].GetRuns(), i, i, nullptr, false);
+    }
   }
-  if(levels[0].GetRuns().size() >= level0_compaction_trigger_){
+  if(levels[0].GetRuns().size() >= level0_compaction_trigger_ &&
+     !InCompaction(levels[0]) && (levels.size() == 1 || !InCompaction(levels[1]))){
     std::vector<std::shared_ptr<SSTable>> input_ssts;
     std::vector<std::shared_ptr<SortedRun>> input_runs;
     /*
@@ -117,7 +193,11 @@ std::unique_ptr<Compaction> LazyLevelingCompactionPicker::Get(
     auto size_limit = base_level_size_;
     for(size_t i = 1; i < L; ++i){
       size_limit *= ratio_;
-      if(levels[i].GetRuns().size() >= ratio_ || levels[i].size() >= size_limit){
+      if(InCompaction(levels[i]) || InCompaction(levels[i + 1])){
+        continue;
+      }
+      if(levels[i].GetRuns().size() >= ratio_ || levels[i].size() >= size_limit ||
+         (i == L - 1 && IsTombstoneDense(levels[i]))){
         std::vector<std::shared_ptr<SSTable>> input_ssts;
         if(i == L - 1){
           // Merge into Level L consisting of one SortedRun only.
@@ -132,14 +212,21 @@ std::unique_ptr<Compaction> LazyLevelingCompactionPicker::Get(
     }
     // Handle Level L.
     size_limit *= ratio_;
-    if(levels[L].size() >= size_limit){
+    if(levels[L].size() >= size_limit && !InCompaction(levels[L])){
       std::vector<std::shared_ptr<SortedRun>> input_runs;
       return std::make_unique<Compaction>(levels[L].GetRuns()[0]->GetSSTs(), 
           input_runs, L, L + 1, nullptr, true);
     }
+    // Rewrite Level L, which drops the tombstones.
+    if(IsTombstoneDense(levels[L]) && !InCompaction(levels[L])){
+      std::vector<std::shared_ptr<SSTable>> input_ssts;
+      return std::make_unique<Compaction>(input_ssts,
+          levels[L].GetRuns(), L, L, nullptr, false);
+    }
   }
   // Handle Level 0.
-  if(levels[0].GetRuns().size() >= level0_compaction_trigger_){
+  if(levels[0].GetRuns().size() >= level0_compaction_trigger_ &&
+     !InCompaction(levels[0]) && (levels.size() == 1 || !InCompaction(levels[1]))){
     std::vector<std::shared_ptr<SSTable>> input_ssts;
     std::vector<std::shared_ptr<SortedRun>> input_runs;
     /*
@@ -251,7 +338,11 @@ std::unique_ptr<Compaction> FluidCompactionPicker::Get(Version* version) {
     size_t size_limit = base_level_size_;
     for(size_t i = 1; i < L; ++i){
       size_limit *= K_;
-      if(levels[i].GetRuns().size() >= K_ || levels[i].size() >= size_limit){
+      if(InCompaction(levels[i]) || InCompaction(levels[i + 1])){
+        continue;
+      }
+      if(levels[i].GetRuns().size() >= K_ || levels[i].size() >= size_limit ||
+         (i == L - 1 && IsTombstoneDense(levels[i]))){
         std::vector<std::shared_ptr<SSTable>> input_ssts;
         std::vector<std::shared_ptr<SortedRun>> input_runs = levels[i].GetRuns();
         if(i == L - 1){
@@ -266,14 +357,21 @@ std::unique_ptr<Compaction> FluidCompactionPicker::Get(Version* version) {
     }
     // Handle Level L.
     size_limit *= C_;
-    if(levels[L].size() >= size_limit){
+    if(levels[L].size() >= size_limit && !InCompaction(levels[L])){
       std::vector<std::shared_ptr<SortedRun>> input_runs;
       return std::make_unique<Compaction>(levels[L].GetRuns()[0]->GetSSTs(), 
           input_runs, L, L + 1, nullptr, true);
     }
+    // Rewrite Level L, which drops the tombstones.
+    if(IsTombstoneDense(levels[L]) && !InCompaction(levels[L])){
+      std::vector<std::shared_ptr<SSTable>> input_ssts;
+      return std::make_unique<Compaction>(input_ssts,
+          levels[L].GetRuns(), L, L, nullptr, false);
+    }
   }
   // Handle Level 0.
-  if(levels[0].GetRuns().size() >= level0_compaction_trigger_){
+  if(levels[0].GetRuns().size() >= level0_compaction_trigger_ &&
+     !InCompaction(levels[0]) && (levels.size() == 1 || !InCompaction(levels[1]))){
     std::vector<std::shared_ptr<SSTable>> input_ssts;
     std::vector<std::shared_ptr<SortedRun>> input_runs;
    input_runs = levels[0].GetRuns();
@@ -13,13 +13,52 @@ class CompactionPicker {
   virtual std::unique_ptr<Compaction> Get(Version* version) = 0;
 
   virtual ~CompactionPicker() = default;
+
+  /**
+   * Pause the compactions of tombstone-dense SSTables, e.g. while snapshots
+   * are alive. The tombstones that a snapshot needs are kept, so the SSTables
+   * would be picked again and again. Require: DB Mutex held.
+   */
+  void SetTombstoneCompactionPaused(bool paused) {
+    tombstone_compaction_paused_ = paused;
+  }
+
+ protected:
+  /* tombstone_ratio: see Options::tombstone_compaction_ratio. */
+  explicit CompactionPicker(double tombstone_ratio)
+    : tombstone_ratio_(tombstone_ratio) {}
+
+  /**
+   * Whether a running compaction reads or writes the level, i.e., one of its
+   * sorted runs or SSTables is in process. Such a level can be neither the
+   * source nor the target of another compaction, so that the compactions
+   * running at the same time never touch the same sorted run.
+   */
+  static bool InCompaction(const Level& level);
+
+  /**
+   * Whether the tombstones of the SSTable reach tombstone_ratio_ of its
+   * records. Such an SSTable is compacted into the bottom level, where the
+   * tombstones are dropped, even if its level is not full. Moving it to a
+   * middle level would keep the tombstones and empty the upper levels, so the
+   * tombstones above are carried down by the size-triggered compactions.
+   */
+  bool IsTombstoneDense(const SSTable& sst) const;
+
+  /* Whether one of the SSTables of the level is dense in tombstones. */
+  bool IsTombstoneDense(const Level& level) const;
+
+  /* The ratio of tombstones that triggers a compaction. 0 disables it. */
+  double tombstone_ratio_{0};
+  bool tombstone_compaction_paused_{false};
 };
 
 class LeveledCompactionPicker final : public CompactionPicker {
  public:
-  LeveledCompactionPicker(
-      size_t ratio, size_t base_level_size, size_t level0_compaction_trigger)
-    : ratio_(ratio),
+  LeveledCompactionPicker(size_t ratio, size_t base_level_size,
+      size_t level0_compaction_trigger, double tombstone_ratio = 0)
+    : CompactionPicker(tombstone_ratio),
+      ratio_(ratio),
       base_level_size_(base_level_size),
       level0_compaction_trigger_(level0_compaction_trigger) {}
 
@@ -36,9 +75,10 @@ class LeveledCompactionPicker final : public CompactionPicker {
 
 class TieredCompactionPicker final : public CompactionPicker {
  public:
-  TieredCompactionPicker(
-      size_t ratio, size_t base_level_size, size_t level0_compaction_trigger)
-    : ratio_(ratio),
+  TieredCompactionPicker(size_t ratio, size_t base_level_size,
+      size_t level0_compaction_trigger, double tombstone_ratio = 0)
+    : CompactionPicker(tombstone_ratio),
+      ratio_(ratio),
       base_level_size_(base_level_size),
       level0_compaction_trigger_(level0_compaction_trigger) {}
 
@@ -55,9 +95,10 @@ class TieredCompactionPicker final : public CompactionPicker {
 
 class LazyLevelingCompactionPicker final : public CompactionPicker {
  public:
-  LazyLevelingCompactionPicker(
-      size_t ratio, size_t base_level_size, size_t level0_compaction_trigger)
-    : ratio_(ratio),
+  LazyLevelingCompactionPicker(size_t ratio, size_t base_level_size,
+      size_t level0_compaction_trigger, double tombstone_ratio = 0)
+    : CompactionPicker(tombstone_ratio),
+      ratio_(ratio),
       base_level_size_(base_level_size),
       level0_compaction_trigger_(level0_compaction_trigger) {}
 
@@ -75,8 +116,10 @@ class LazyLevelingCompactionPicker final : public CompactionPicker {
 class FluidCompactionPicker final : public CompactionPicker {
  public:
   FluidCompactionPicker(double alpha, double scan_length,
-      size_t base_level_size, size_t level0_compaction_trigger)
-    : alpha_(alpha),
+      size_t base_level_size, size_t level0_compaction_trigger,
+      double tombstone_ratio = 0)
+    : CompactionPicker(tombstone_ratio),
+      alpha_(alpha),
       scan_length_(scan_length),
       base_level_size_(base_level_size),
       level0_compaction_trigger_(level0_compaction_trigger){}
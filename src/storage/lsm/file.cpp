@@ -2,6 +2,10 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "common/exception.hpp"
 #include "storage/lsm/stats.hpp"
@@ -10,7 +14,8 @@ namespace wing {
 
 namespace lsm {
 
-ReadFile::ReadFile(const std::string& filename, bool use_direct_io)
+ReadFile::ReadFile(
+    const std::string& filename, bool use_direct_io, bool use_mmap)
   : filename_(filename), use_direct_io_(use_direct_io) {
   auto flag = O_RDONLY;
 #if defined(__linux__)
@@ -24,11 +29,34 @@ ReadFile::ReadFile(const std::string& filename, bool use_direct_io)
   if (fd_ < 0) {
     throw DBException("::open file {} error! Error: {}", filename, errno);
   }
+#if defined(__linux__)
+  struct stat st;
+  if (use_mmap && !use_direct_io && ::fstat(fd_, &st) == 0 && st.st_size > 0) {
+    void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED) {
+      throw DBException("::mmap file {} error! Error: {}", filename, errno);
+    }
+    mapped_ = static_cast<char*>(addr);
+    mapped_size_ = st.st_size;
+  }
+#endif
 }
 
-ReadFile::~ReadFile() { ::close(fd_); }
+ReadFile::~ReadFile() {
+#if defined(__linux__)
+  if (mapped_ != nullptr) {
+    ::munmap(mapped_, mapped_size_);
+  }
+#endif
+  ::close(fd_);
+}
 
 ssize_t ReadFile::Read(char* data, size_t n, offset_t offset) {
+  if (mapped_ != nullptr) {
+    size_t len = offset < mapped_size_ ? std::min(n, mapped_size_ - offset) : 0;
+    memcpy(data, ReadInPlace(len, offset), len);
+    return len;
+  }
 #if defined(__linux__)
   ssize_t ret = ::pread(fd_, data, n, offset);
 #elif defined(__MINGW64__)
@@ -42,6 +70,28 @@ ssize_t ReadFile::Read(char* data, size_t n, offset_t offset) {
   return ret;
 }
 
+const char* ReadFile::ReadInPlace(size_t n, offset_t offset) {
+  // The bytes are counted like pread, though they may be in the page cache.
+  GetStatsContext()->total_read_bytes.fetch_add(n, std::memory_order_relaxed);
+  return mapped_ + offset;
+}
+
+void ReadFile::Advise(offset_t offset, size_t n, ReadAdvice advice) {
+#if defined(__linux__)
+  // The address must be aligned to pages.
+  size_t page_size = ::sysconf(_SC_PAGESIZE);
+  size_t begin = offset / page_size * page_size;
+  size_t end = std::min<size_t>(offset + n, mapped_size_);
+  if (begin >= end) {
+    return;
+  }
+  int flag = advice == ReadAdvice::kRandom     ? MADV_RANDOM
+             : advice == ReadAdvice::kWillNeed ? MADV_WILLNEED
+                                               : MADV_NORMAL;
+  ::madvise(mapped_ + begin, end - begin, flag);
+#endif
+}
+
 SeqWriteFile::SeqWriteFile(const std::string& filename, bool use_direct_io)
   : filename_(filename), use_direct_io_(use_direct_io) {
   auto flag = O_WRONLY | O_CREAT | O_TRUNC;
@@ -11,9 +11,23 @@ namespace wing {
 
 namespace lsm {
 
+/* The access pattern of a range of a memory-mapped file. See madvise(2). */
+enum class ReadAdvice : uint8_t {
+  kNormal = 0,
+  /* Point lookups. The kernel does not read ahead. */
+  kRandom,
+  /* The range will be read soon. The kernel reads it ahead. */
+  kWillNeed,
+};
+
 class ReadFile {
  public:
-  ReadFile(const std::string& filename, bool use_direct_io);
+  /**
+   * If use_mmap is true and use_direct_io is false, the file is mapped into
+   * memory, and ReadInPlace can be used. Otherwise, it falls back to pread.
+   */
+  ReadFile(const std::string& filename, bool use_direct_io,
+      bool use_mmap = false);
 
   ReadFile(const ReadFile&) = delete;
   ReadFile(ReadFile&&) = delete;
@@ -23,12 +37,29 @@ class ReadFile {
   ~ReadFile();
 
   ssize_t Read(char* data, size_t n, offset_t offset);
+
+  /**
+   * Return the pointer to the n bytes at offset in the mapping, which is valid
+   * until the file is closed. It requires use_mmap().
+   */
+  const char* ReadInPlace(size_t n, offset_t offset);
+
+  /* Give advice on the range [offset, offset + n). It requires use_mmap(). */
+  void Advise(offset_t offset, size_t n, ReadAdvice advice);
+
   bool use_direct_io() const { return use_direct_io_; }
+  bool use_mmap() const { return mapped_ != nullptr; }
+
+  /* The beginning of the mapping. Reading it is not counted in StatsContext. */
+  const char* mapped_data() const { return mapped_; }
 
  private:
   int fd_;
   std::string filename_;
   bool use_direct_io_;
+  /* The mapping of the whole file, or null if it is not mapped. */
+  char* mapped_{nullptr};
+  size_t mapped_size_{0};
 };
 
 class SeqWriteFile {
@@ -0,0 +1,99 @@
+#include "storage/lsm/file_purger.hpp"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "common/logging.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+FilePurger::FilePurger(size_t rate_bytes_per_sec)
+  : rate_bytes_per_sec_(rate_bytes_per_sec) {
+  thread_ = std::thread([this]() { Run(); });
+}
+
+FilePurger::~FilePurger() {
+  {
+    std::unique_lock lck(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void FilePurger::Schedule(std::string filename, size_t size) {
+  {
+    std::unique_lock lck(mutex_);
+    files_.emplace_back(std::move(filename), size);
+  }
+  cv_.notify_all();
+}
+
+void FilePurger::Drain() {
+  std::unique_lock lck(mutex_);
+  draining_ += 1;
+  cv_.notify_all();
+  done_cv_.wait(lck, [&]() { return files_.empty() && deleting_ == 0; });
+  draining_ -= 1;
+}
+
+size_t FilePurger::pending() const {
+  std::unique_lock lck(mutex_);
+  return files_.size() + deleting_;
+}
+
+void FilePurger::Run() {
+  std::unique_lock lck(mutex_);
+  while (true) {
+    cv_.wait(lck, [&]() { return stop_ || !files_.empty(); });
+    if (files_.empty()) {
+      return;
+    }
+    auto batch = std::move(files_);
+    files_.clear();
+    deleting_ = batch.size();
+    for (auto& [filename, size] : batch) {
+      if (rate_bytes_per_sec_ > 0) {
+        cv_.wait_until(lck, next_delete_time_,
+            [&]() { return stop_ || draining_ > 0; });
+      }
+      lck.unlock();
+      std::error_code ec;
+      std::filesystem::remove(filename, ec);
+      if (ec) {
+        DB_INFO("Cannot remove {}: {}", filename, ec.message());
+      }
+      lck.lock();
+      if (rate_bytes_per_sec_ > 0) {
+        auto now = std::chrono::steady_clock::now();
+        next_delete_time_ = std::max(next_delete_time_, now) +
+                            std::chrono::microseconds(
+                                size * 1000000 / rate_bytes_per_sec_);
+      }
+      deleting_ -= 1;
+    }
+    done_cv_.notify_all();
+  }
+}
+
+bool ParseSSTFileName(const std::string& filename, uint64_t* sst_id) {
+  auto name = std::filesystem::path(filename).filename().string();
+  if (name.size() <= 4 || name.substr(name.size() - 4) != ".sst") {
+    return false;
+  }
+  uint64_t ret = 0;
+  for (size_t i = 0; i + 4 < name.size(); i++) {
+    if (name[i] < '0' || name[i] > '9') {
+      return false;
+    }
+    ret = ret * 10 + (name[i] - '0');
+  }
+  *sst_id = ret;
+  return true;
+}
+
+}  // namespace lsm
+
+}  // namespace wing
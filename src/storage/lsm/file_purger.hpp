@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * It deletes the files of obsolete SSTables in a background thread. An
+ * SSTable is obsolete once the last reference to it is released, which may be
+ * a reader, so the reader does not wait for the unlink. The thread takes all
+ * the scheduled files as a batch, and deletes at most rate_bytes_per_sec bytes
+ * per second, so that removing the inputs of a large compaction does not stall
+ * the other I/O of the device.
+ *
+ * A file must not be scheduled while a file of the same name may be created,
+ * so that the new file is not deleted. The names of the SSTables of a DBImpl
+ * are not reused, and a DBImpl drains the purger before it is destroyed.
+ */
+class FilePurger {
+ public:
+  /* rate_bytes_per_sec: 0 means that the deletions are not rate limited. */
+  explicit FilePurger(size_t rate_bytes_per_sec);
+
+  /* The remaining files are deleted without the rate limit. */
+  ~FilePurger();
+
+  FilePurger(const FilePurger&) = delete;
+  FilePurger& operator=(const FilePurger&) = delete;
+
+  /* Delete the file of size bytes later. */
+  void Schedule(std::string filename, size_t size);
+
+  /**
+   * Wait until the files scheduled before are deleted. The rate limit is
+   * ignored while waiting.
+   */
+  void Drain();
+
+  /* The number of files that are scheduled but not deleted. */
+  size_t pending() const;
+
+ private:
+  void Run();
+
+  const size_t rate_bytes_per_sec_;
+  mutable std::mutex mutex_;
+  /* It is notified when files are scheduled, or the limit is lifted. */
+  std::condition_variable cv_;
+  /* It is notified when a batch is deleted. */
+  std::condition_variable done_cv_;
+  std::vector<std::pair<std::string, size_t>> files_;
+  /* The number of files in the batch being deleted. */
+  size_t deleting_{0};
+  /* The number of threads in Drain. */
+  size_t draining_{0};
+  bool stop_{false};
+  /* The next file is not deleted before this time. */
+  std::chrono::steady_clock::time_point next_delete_time_;
+  std::thread thread_;
+};
+
+/* Return false if filename is not the name of an SSTable. */
+bool ParseSSTFileName(const std::string& filename, uint64_t* sst_id);
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -16,6 +16,13 @@ using PinnableSlice = std::string;
 enum class RecordType : uint8_t {
   Deletion = 0,
   Value,
+  /**
+   * A range tombstone, see lsm/range_del.hpp. Its key is the first user key
+   * it deletes and its value is the user key after the last one. It is only
+   * stored in the write-ahead log. MemTables and SSTables keep the range
+   * tombstones apart from the records.
+   */
+  RangeDeletion,
 };
 
 class ParsedKey;
@@ -101,10 +108,67 @@ struct ParsedKey {
 inline InternalKey::InternalKey(ParsedKey key)
   : InternalKey(key.user_key_, key.seq_, key.type_) {}
 
+/**
+ * The format versions of SSTables.
+ * kLegacyFormatVersion: every record stores its full key and has an offset at
+ * the end of the block. The SSTable has no footer.
+ * kPrefixFormatVersion: the keys are prefix-compressed. Every
+ * block_restart_interval records there is a restart point, which stores its
+ * full key. The version is stored in the footer of the SSTable.
+ * kChecksumFormatVersion: the blocks are the same as kPrefixFormatVersion,
+ * but each of them can be compressed and is followed by a trailer:
+ * the compression type (1B) and the checksum of the block and the type (4B).
+ * kPartitionedIndexFormatVersion: the index is partitioned. The index
+ * partitions are blocks in kChecksumFormatVersion, which map the largest key of
+ * each data block to its BlockHandle. The index region at index_offset_ is the
+ * top-level index, which maps the largest key of each partition to it.
+ * kBlockedBloomFormatVersion: the bloom filter is a utils::BlockedBloomFilter,
+ * whose probes of a key hit one cache line.
+ * kFilterTypeFormatVersion: the filter region starts with its FilterType, so
+ * the SSTables in a tree can use different filters.
+ * kRangeDelFormatVersion: the range tombstones of the SSTable are stored
+ * between the largest key and the footer, so the footer is read from the end
+ * of the file. An SSTable can have range tombstones and no records.
+ */
+constexpr uint32_t kLegacyFormatVersion = 0;
+constexpr uint32_t kPrefixFormatVersion = 1;
+constexpr uint32_t kChecksumFormatVersion = 2;
+constexpr uint32_t kPartitionedIndexFormatVersion = 3;
+constexpr uint32_t kBlockedBloomFormatVersion = 4;
+constexpr uint32_t kFilterTypeFormatVersion = 5;
+constexpr uint32_t kRangeDelFormatVersion = 6;
+constexpr uint32_t kLatestFormatVersion = kRangeDelFormatVersion;
+/* It is written after the format version in the footer. */
+constexpr uint64_t kSSTableMagic = 0x57494e474c534d31ULL;
+
+/* The size of the trailer of a block in kChecksumFormatVersion. */
+constexpr size_t kBlockTrailerSize = sizeof(uint8_t) + sizeof(uint32_t);
+
+enum class CompressionType : uint8_t {
+  kNone = 0,
+  /**
+   * The block is compressed by utils::LZCompress. It is stored as the size
+   * of the uncompressed block (offset_t) and the compressed data.
+   */
+  kLZ,
+};
+
+enum class FilterType : uint8_t {
+  /* utils::BloomFilter. It is used before kBlockedBloomFormatVersion. */
+  kBloom = 0,
+  /* utils::BlockedBloomFilter. */
+  kBlockedBloom,
+  /**
+   * utils::XorFilter. It ignores bloom_bits_per_key and takes about 9.84 bits
+   * per key, with a false positive rate of about 0.4%.
+   */
+  kXor,
+};
+
 struct BlockHandle {
   /* The offset of the block. */
   offset_t offset_;
-  /* The size of the block. */
+  /* The size of the block in the file, including the trailer. */
   offset_t size_;
   /* The number of entries in the block. */
   offset_t count_;
@@ -124,12 +188,18 @@ struct SSTInfo {
   size_t count_;
   /* The ID of the SSTable */
   size_t sst_id_;
-  /* The offset of the index block */
+  /* The offset of the index block (the top-level index if it is partitioned) */
   size_t index_offset_;
   /* The offset of the bloom filter */
   size_t bloom_filter_offset_;
   /* The path of the SSTable */
   std::string filename_;
+  /**
+   * The number of deletion records and range tombstones in the SSTable. The
+   * compaction pickers compact the SSTables with many tombstones, see
+   * Options::tombstone_compaction_ratio.
+   */
+  size_t tombstone_count_{0};
 };
 
 }  // namespace lsm
@@ -4,27 +4,53 @@ namespace wing {
 
 namespace lsm {
 
-GetResult SortedRun::Get(Slice key, uint64_t seq, std::string* value) {
-  ParsedKey pkey(key, seq, RecordType::Value);
-  if(pkey > GetLargestKey()){
+GetResult SortedRun::Get(
+    Slice key, uint64_t seq, std::string* value, int level) {
+  auto id = FindSST(ParsedKey(key, seq, RecordType::Value), 0, ssts_.size());
+  if(id == ssts_.size()){
     return GetResult::kNotFound;
   }
-  size_t lr = 0, rr = ssts_.size() - 1, mid;
+  return ssts_[id]->Get(key, seq, value, level);
+}
+
+size_t SortedRun::FindSST(ParsedKey key, size_t lr, size_t rr) const {
   while(lr < rr){
-    mid = (lr + rr) >> 1;
-    if(ssts_[mid]->GetLargestKey() >= pkey) {
+    size_t mid = (lr + rr) >> 1;
+    if(ssts_[mid]->GetLargestKey() >= key) {
       rr = mid;
     }
     else{
       lr = mid + 1;
     }
   }
-  return ssts_[lr]->Get(key, seq, value);
+  return lr;
+}
+
+void SortedRun::MultiGet(
+    std::span<MultiGetEntry* const> entries, uint64_t seq, int level) {
+  // Both the keys and the SSTables are sorted, so they are merged.
+  size_t begin = 0;
+  for (auto& sst : ssts_) {
+    auto largest = sst->GetLargestKey();
+    size_t end = begin;
+    while (end < entries.size() &&
+           ParsedKey(entries[end]->key_, seq, RecordType::Value) <= largest) {
+      end += 1;
+    }
+    if (end > begin) {
+      sst->MultiGet(entries.subspan(begin, end - begin), seq, level);
+    }
+    begin = end;
+    if (begin == entries.size()) {
+      break;
+    }
+  }
 }
 
-SortedRunIterator SortedRun::Seek(Slice key, uint64_t seq) {
+SortedRunIterator SortedRun::Seek(
+    Slice key, uint64_t seq, CacheFill fill_cache) {
   if(ssts_.empty()){
-    return Begin();
+    return Begin(fill_cache);
   }
   ParsedKey pkey(key, seq, RecordType::Value);
   size_t lr = 0, rr = ssts_.size() - 1, mid;
@@ -37,12 +63,17 @@ SortedRunIterator SortedRun::Seek(Slice key, uint64_t seq) {
       lr = mid + 1;
     }
   }
-  return SortedRunIterator(this, ssts_[lr]->Seek(key, seq), lr);
+  SortedRunIterator it(
+      this, ssts_[lr]->Seek(key, seq, fill_cache), lr, fill_cache);
+  it.SkipEmptySSTs();
+  return it;
 }
 
-SortedRunIterator SortedRun::Begin() {
+SortedRunIterator SortedRun::Begin(CacheFill fill_cache) {
   if(ssts_.size()){
-    return SortedRunIterator(this, ssts_[0]->Begin(), 0u);
+    SortedRunIterator it(this, ssts_[0]->Begin(fill_cache), 0u, fill_cache);
+    it.SkipEmptySSTs();
+    return it;
   }
   return SortedRunIterator();
 }
@@ -58,7 +89,18 @@ SortedRun::~SortedRun() {
 void SortedRunIterator::SeekToFirst() {
   sst_id_ = 0u;
   if(run_){
-    sst_it_ = run_->ssts_[sst_id_]->Begin();
+    sst_it_ = run_->ssts_[sst_id_]->Begin(fill_cache_);
+    SkipEmptySSTs();
+  }
+}
+
+void SortedRunIterator::SkipEmptySSTs() {
+  while(!sst_it_.Valid() && sst_id_ + 1 < run_->ssts_.size()){
+    ++sst_id_;
+    sst_it_ = run_->ssts_[sst_id_]->Begin(fill_cache_);
+  }
+  if(!sst_it_.Valid()){
+    sst_id_ = run_->ssts_.size();
   }
 }
 
@@ -80,18 +122,13 @@ Slice SortedRunIterator::value() const {
 void SortedRunIterator::Next() {
   if(Valid()){
     sst_it_.Next();
-    if(!sst_it_.Valid()){
-      ++sst_id_;
-      if(sst_id_ != run_->ssts_.size()){
-        sst_it_ = run_->ssts_[sst_id_]->Begin();
-      }
-    }
+    SkipEmptySSTs();
   }
 }
 
 GetResult Level::Get(Slice key, uint64_t seq, std::string* value) {
   for (int i = runs_.size() - 1; i >= 0; --i) {
-    auto res = runs_[i]->Get(key, seq, value);
+    auto res = runs_[i]->Get(key, seq, value, level_id_);
     if (res != GetResult::kNotFound) {
       return res;
     }
@@ -99,6 +136,16 @@ GetResult Level::Get(Slice key, uint64_t seq, std::string* value) {
   return GetResult::kNotFound;
 }
 
+void Level::MultiGet(std::span<MultiGetEntry* const> entries, uint64_t seq) {
+  std::vector<MultiGetEntry*> pending(entries.begin(), entries.end());
+  for (int i = runs_.size() - 1; i >= 0 && !pending.empty(); --i) {
+    runs_[i]->MultiGet(pending, seq, level_id_);
+    std::erase_if(pending, [](MultiGetEntry* entry) {
+      return entry->result_ != GetResult::kNotFound;
+    });
+  }
+}
+
 void Level::Append(std::vector<std::shared_ptr<SortedRun>> runs) {
   for (auto& run : runs) {
     size_ += run->size();
@@ -10,13 +10,14 @@ class SortedRunIterator;
 
 class SortedRun {
  public:
-  SortedRun(
-      const std::vector<SSTInfo>& ssts, size_t block_size, bool use_direct_io)
+  SortedRun(const std::vector<SSTInfo>& ssts, size_t block_size,
+      bool use_direct_io, Cache* cache = nullptr, bool use_mmap = false,
+      FilePurger* purger = nullptr)
     : block_size_(block_size), use_direct_io_(use_direct_io) {
     size_ = 0;
     for (auto& sst : ssts) {
-      ssts_.push_back(
-          std::make_shared<SSTable>(sst, block_size_, use_direct_io_));
+      ssts_.push_back(std::make_shared<SSTable>(
+          sst, block_size_, use_direct_io_, cache, use_mmap, purger));
       size_ += sst.size_;
     }
   }
@@ -40,14 +41,35 @@ class SortedRun {
    * If the record has type RecordType::Deletion, then it does nothing to the
    * value, and returns GetResult::kDelete If there is no such record, it
    * returns GetResult::kNotFound.
+   * level: the level of the sorted run, see SSTable::Get.
    * */
-  GetResult Get(Slice key, uint64_t seq, std::string* value);
+  GetResult Get(Slice key, uint64_t seq, std::string* value, int level = -1);
+
+  /**
+   * Return the index of the first SSTable whose largest key >= key. It must
+   * be in [lr, rr], and rr = SSTCount() means that there may be none.
+   */
+  size_t FindSST(ParsedKey key, size_t lr, size_t rr) const;
 
-  /* Return an iterator positioned at the first record >= (key, seq). */
-  SortedRunIterator Seek(Slice key, uint64_t seq);
+  /**
+   * Look up the entries, which are sorted by key, and set their results.
+   * The entries are grouped by SSTables. See SSTable::MultiGet.
+   */
+  void MultiGet(std::span<MultiGetEntry* const> entries, uint64_t seq,
+      int level = -1);
+
+  /**
+   * Return an iterator positioned at the first record >= (key, seq).
+   * fill_cache: see SSTable::Begin.
+   */
+  SortedRunIterator Seek(Slice key, uint64_t seq,
+      CacheFill fill_cache = CacheFill::kHighPriority);
 
-  /* Return an iterator positioned at the beginning of the SSTable */
-  SortedRunIterator Begin();
+  /**
+   * Return an iterator positioned at the beginning of the sorted run.
+   * fill_cache: see SSTable::Begin.
+   */
+  SortedRunIterator Begin(CacheFill fill_cache = CacheFill::kHighPriority);
 
   /* Get the number of SSTables. */
   size_t SSTCount() const { return ssts_.size(); }
@@ -96,8 +118,12 @@ class SortedRunIterator final : public Iterator {
  public:
   SortedRunIterator() = default;
 
-  SortedRunIterator(SortedRun* run, SSTableIterator sst_it, int sst_id)
-    : run_(run), sst_it_(std::move(sst_it)), sst_id_(sst_id) {}
+  SortedRunIterator(SortedRun* run, SSTableIterator sst_it, int sst_id,
+      CacheFill fill_cache = CacheFill::kHighPriority)
+    : run_(run),
+      sst_it_(std::move(sst_it)),
+      sst_id_(sst_id),
+      fill_cache_(fill_cache) {}
 
   void SeekToFirst();
 
@@ -110,12 +136,23 @@ class SortedRunIterator final : public Iterator {
   void Next() override;
 
  private:
+  /**
+   * Move to the next SSTable until the iterator is valid. The iterator of an
+   * SSTable can be empty at first, e.g. if it only has range tombstones, or
+   * the key sought is covered by its range tombstones only.
+   */
+  void SkipEmptySSTs();
+
   /* The referenced sorted run */
   SortedRun* run_;
   /* The SSTable iterator of the current SSTable */
   SSTableIterator sst_it_;
   /* The index of the current SSTable */
   size_t sst_id_{0};
+  /* Whether the blocks read from the file are inserted into the cache */
+  CacheFill fill_cache_{CacheFill::kHighPriority};
+
+  friend class SortedRun;
 };
 
 class Level {
@@ -136,6 +173,12 @@ class Level {
 
   GetResult Get(Slice key, uint64_t seq, std::string* value);
 
+  /**
+   * Look up the entries, which are sorted by key, from the newest sorted run
+   * to the oldest, and set their results.
+   */
+  void MultiGet(std::span<MultiGetEntry* const> entries, uint64_t seq);
+
   /* Get the level id */
   int GetID() const { return level_id_; }
 
@@ -1,8 +1,11 @@
 #include "storage/lsm/lsm.hpp"
 
 #include <fstream>
+#include <future>
+#include <iterator>
 
 #include "common/stopwatch.hpp"
+#include "storage/lsm/bulk_load.hpp"
 #include "storage/lsm/compaction_job.hpp"
 #include "storage/lsm/stats.hpp"
 
@@ -11,14 +14,38 @@ namespace wing {
 namespace lsm {
 
 DBImpl::DBImpl(const Options& options)
-  : options_(options), cache_(options_.cache) {
+  : options_(options),
+    cache_(options_.block_cache),
+    scheduler_(options_.scheduler),
+    file_purger_(options_.file_purger),
+    write_buffer_manager_(options_.write_buffer_manager) {
+  if (!cache_) {
+    cache_ = std::make_shared<Cache>(options_.cache);
+  }
+  if (!scheduler_) {
+    scheduler_ = std::make_shared<BackgroundScheduler>(
+        options_.max_background_flushes, options_.max_background_compactions);
+  }
+  if (!file_purger_) {
+    file_purger_ =
+        std::make_shared<FilePurger>(options_.delete_rate_bytes_per_sec);
+  }
   if (options_.create_new) {
     seq_ = 0;
-    sv_ = std::make_shared<SuperVersion>(std::make_shared<MemTable>(),
+    sv_ = std::make_shared<SuperVersion>(
+        std::make_shared<MemTable>(options_.memtable_type),
         std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
         std::make_shared<Version>());
-    filename_gen_ =
-        std::make_unique<FileNameGenerator>(options_.db_path.string() + "/", 0);
+    /**
+     * The logs and the SSTables in the directory belong to the old database.
+     * The new SSTables do not reuse the names of the old ones, which may be
+     * deleted later.
+     */
+    RemoveObsoleteLogs(std::numeric_limits<uint64_t>::max());
+    filename_gen_ = std::make_unique<FileNameGenerator>(
+        options_.db_path.string() + "/", RemoveOrphanFiles({}));
+    sv_->GetMt()->SetLogNumber(CreateLog());
+    SaveMetadata();
   } else {
     LoadMetadata();
   }
@@ -26,52 +53,131 @@ DBImpl::DBImpl(const Options& options)
     compaction_picker_ = std::make_unique<LeveledCompactionPicker>(
         options_.compaction_size_ratio,
         options_.level0_compaction_trigger * options_.sst_file_size,
-        options_.level0_compaction_trigger);
+        options_.level0_compaction_trigger,
+        options_.tombstone_compaction_ratio);
   } else if (options_.compaction_strategy_name == "tiered") {
     compaction_picker_ =
         std::make_unique<TieredCompactionPicker>(options_.compaction_size_ratio,
             options_.level0_compaction_trigger * options_.sst_file_size,
-            options_.level0_compaction_trigger);
+            options_.level0_compaction_trigger,
+            options_.tombstone_compaction_ratio);
   } else if (options_.compaction_strategy_name == "lazyleveling") {
     compaction_picker_ = std::make_unique<LazyLevelingCompactionPicker>(
         options_.compaction_size_ratio,
         options_.level0_compaction_trigger * options_.sst_file_size,
-        options_.level0_compaction_trigger);
+        options_.level0_compaction_trigger,
+        options_.tombstone_compaction_ratio);
   } else if (options_.compaction_strategy_name == "fluid") {
     compaction_picker_ = std::make_unique<FluidCompactionPicker>(
         options_.target_alpha_part3, options_.target_scan_length_part3,
         options_.level0_compaction_trigger * options_.sst_file_size,
-        options_.level0_compaction_trigger);
+        options_.level0_compaction_trigger,
+        options_.tombstone_compaction_ratio);
+  }
+
+  if (options_.max_subcompactions > 1) {
+    // The compaction thread runs one of the subcompactions itself.
+    subcompaction_pool_ =
+        std::make_unique<ThreadPool>(options_.max_subcompactions - 1);
   }
 
-  threads_.emplace_back([&]() { FlushThread(); });
-  threads_.emplace_back([&]() { CompactionThread(); });
+  if (write_buffer_manager_) {
+    write_buffer_manager_->ReserveMem(sv_->GetMt()->size());
+    write_buffer_manager_->Register(this);
+  }
+  {
+    std::unique_lock lck(db_mutex_);
+    MaybeScheduleCompaction();
+  }
+  /* The MemTable may be too large after replaying the logs. */
+  if (sv_->GetMt()->size() > options_.sst_file_size) {
+    SwitchMemtable();
+  }
 }
 
 DBImpl::~DBImpl() {
-  FlushAll();
-  stop_signal_ = true;
-  flush_cv_.notify_all();
-  compact_cv_.notify_all();
-  for (auto& thread : threads_) {
-    thread.join();
+  if (write_buffer_manager_) {
+    write_buffer_manager_->Unregister(this);
+  }
+  if (!crashed_) {
+    FlushAll();
+  }
+  {
+    std::unique_lock lck(db_mutex_);
+    stop_signal_ = true;
+    /* The scheduled jobs refer to this DBImpl. They return once they run. */
+    bg_cv_.wait(lck, [&]() {
+      return !flush_scheduled_ && scheduled_compactions_ == 0;
+    });
   }
-  Save();
+  if (!crashed_) {
+    Save();
+  } else if (write_buffer_manager_) {
+    /* The MemTables are lost, and their memory is returned to the budget. */
+    write_buffer_manager_->ScheduleFreeMem(sv_->GetMt()->size());
+    write_buffer_manager_->FreeMem(sv_->GetMt()->size());
+    for (auto& imm : *sv_->GetImms()) {
+      write_buffer_manager_->FreeMem(imm->size());
+    }
+  }
+  /* The SSTables of this DBImpl must be deleted before it is opened again. */
+  sv_.reset();
+  file_purger_->Drain();
+}
+
+void DBImpl::SimulateCrash(std::unique_ptr<DBImpl> db) {
+  db->crashed_ = true;
 }
 
-void DBImpl::StopWrite() {
-  db_mutex_.unlock();
-  std::this_thread::sleep_for(std::chrono::milliseconds(100));
-  db_mutex_.lock();
+void DBImpl::StopWrite(std::unique_lock<std::mutex>& lck) {
+  bg_cv_.wait(lck);
+}
+
+bool DBImpl::NeedSlowdown() {
+  auto sv = GetSV();
+  auto& levels = sv->GetVersion()->GetLevels();
+  if (options_.max_immutable_count > 1 &&
+      sv->GetImms()->size() + 1 >= options_.max_immutable_count) {
+    return true;
+  }
+  return !levels.empty() && levels[0].GetRuns().size() >=
+                                options_.level0_slowdown_writes_trigger;
+}
+
+void DBImpl::DelayWrite(std::unique_lock<std::mutex>& lck, size_t bytes) {
+  if (!NeedSlowdown()) {
+    return;
+  }
+  /* A token bucket without bursts: each byte costs 1 / delayed_write_rate. */
+  auto now = std::chrono::steady_clock::now();
+  auto delay = std::chrono::microseconds(
+      bytes * 1000000 / std::max<size_t>(options_.delayed_write_rate, 1));
+  next_write_time_ = std::max(next_write_time_, now) + delay;
+  auto wake_time = next_write_time_;
+  lck.unlock();
+  std::this_thread::sleep_until(wake_time);
+  lck.lock();
+  GetStatsContext()->write_slowdown_micros.fetch_add(
+      std::chrono::duration_cast<std::chrono::microseconds>(wake_time - now)
+          .count(),
+      std::memory_order_relaxed);
 }
 
 void DBImpl::SwitchMemtable(bool force) {
   std::unique_lock db_lck(db_mutex_);
   auto old_sv = GetSV();
-  while (old_sv->GetImms()->size() >= options_.max_immutable_count) {
-    old_sv.reset();
-    StopWrite();
-    old_sv = GetSV();
+  if (old_sv->GetImms()->size() >= options_.max_immutable_count) {
+    auto start = std::chrono::steady_clock::now();
+    while (old_sv->GetImms()->size() >= options_.max_immutable_count) {
+      old_sv.reset();
+      StopWrite(db_lck);
+      old_sv = GetSV();
+    }
+    GetStatsContext()->write_stop_micros.fetch_add(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count(),
+        std::memory_order_relaxed);
   }
   if ((force && old_sv->GetMt()->size() > 0) ||
       old_sv->GetMt()->size() > options_.sst_file_size) {
@@ -81,381 +187,856 @@ void DBImpl::SwitchMemtable(bool force) {
     new_imm->push_back(mt);
     new_imm->insert(
         new_imm->end(), old_sv->GetImms()->begin(), old_sv->GetImms()->end());
-    auto new_mt = std::make_shared<MemTable>();
+    auto new_mt = std::make_shared<MemTable>(options_.memtable_type);
+    new_mt->SetLogNumber(CreateLog());
     auto new_sv = std::make_shared<SuperVersion>(new_mt, new_imm, version);
     InstallSV(new_sv);
     DB_INFO("{}", new_sv->ToString());
-    flush_cv_.notify_one();
+    if (write_buffer_manager_) {
+      write_buffer_manager_->ScheduleFreeMem(mt->size());
+    }
+    MaybeScheduleFlush();
   }
 }
 
 void DBImpl::Put(Slice key, Slice value) {
+  Write(key, value, RecordType::Value);
+}
+
+void DBImpl::Del(Slice key) { Write(key, Slice(), RecordType::Deletion); }
+
+void DBImpl::DeleteRange(Slice begin, Slice end) {
+  if (begin < end) {
+    Write(begin, end, RecordType::RangeDeletion);
+  }
+}
+
+void DBImpl::Write(Slice key, Slice value, RecordType type) {
+  Writer w(key, value, type);
   std::unique_lock lck(write_mutex_);
-  auto seq = ++seq_;
-  auto sv = GetSV();
-  sv->GetMt()->Put(key, seq, value);
-  if (sv->GetMt()->size() > options_.sst_file_size) {
+  writers_.push_back(&w);
+  w.cv_.wait(lck, [&]() { return w.done_ || writers_.front() == &w; });
+  if (w.done_) {
+    return;
+  }
+  /**
+   * w is the leader. The first group_size writers are committed together.
+   * They stay at the front of writers_ until the group is done.
+   */
+  size_t group_size = 0;
+  for (auto writer : writers_) {
+    if (writer->exclusive_ ||
+        (group_size > 0 &&
+            options_.wal_sync_mode == WalSyncMode::kEveryWrite)) {
+      break;
+    }
+    group_size += 1;
+  }
+  {
+    size_t bytes = 0;
+    for (size_t i = 0; i < group_size; i++) {
+      bytes += writers_[i]->key_.size() + writers_[i]->value_.size();
+    }
+    DelayWrite(lck, bytes);
+  }
+  if (log_) {
+    auto seq = seq_;
+    for (size_t i = 0; i < group_size; i++) {
+      auto writer = writers_[i];
+      log_->AddRecord(
+          ParsedKey(writer->key_, ++seq, writer->type_), writer->value_);
+    }
+    /* New writers can join the queue while the leader is writing the log. */
+    lck.unlock();
+    log_->Flush();
+    if (options_.wal_sync_mode != WalSyncMode::kNone) {
+      log_->Sync();
+    }
+    lck.lock();
+  }
+  {
+    auto sv = GetSV();
+    auto mt_size = sv->GetMt()->size();
+    for (size_t i = 0; i < group_size; i++) {
+      auto writer = writers_[i];
+      auto seq = ++seq_;
+      if (writer->type_ == RecordType::Value) {
+        sv->GetMt()->Put(writer->key_, seq, writer->value_);
+      } else if (writer->type_ == RecordType::RangeDeletion) {
+        sv->GetMt()->DelRange(writer->key_, writer->value_, seq);
+      } else {
+        sv->GetMt()->Del(writer->key_, seq);
+      }
+    }
+    if (write_buffer_manager_) {
+      write_buffer_manager_->ReserveMem(sv->GetMt()->size() - mt_size);
+    }
+  }
+  if (GetSV()->GetMt()->size() > options_.sst_file_size) {
     SwitchMemtable();
   }
+  for (size_t i = 0; i < group_size; i++) {
+    auto writer = writers_.front();
+    writers_.pop_front();
+    if (writer != &w) {
+      writer->done_ = true;
+      writer->cv_.notify_one();
+    }
+  }
+  if (!writers_.empty()) {
+    writers_.front()->cv_.notify_one();
+  }
+  if (write_buffer_manager_) {
+    /* It may switch the MemTables of the other DBImpls. */
+    lck.unlock();
+    write_buffer_manager_->MaybeFlush();
+  }
 }
 
-void DBImpl::Del(Slice key) {
+void DBImpl::ExclusiveWrite(const std::function<void()>& func) {
+  Writer w(Slice(), Slice(), RecordType::Value, true);
   std::unique_lock lck(write_mutex_);
-  auto seq = ++seq_;
-  auto sv = GetSV();
-  sv->GetMt()->Del(key, seq);
-  if (sv->GetMt()->size() > options_.sst_file_size) {
-    SwitchMemtable();
+  writers_.push_back(&w);
+  w.cv_.wait(lck, [&]() { return writers_.front() == &w; });
+  func();
+  writers_.pop_front();
+  if (!writers_.empty()) {
+    writers_.front()->cv_.notify_one();
+  }
+}
+
+uint64_t DBImpl::CreateLog() {
+  auto log_number = next_log_number_++;
+  if (options_.enable_wal) {
+    log_.reset();
+    log_ = std::make_unique<LogWriter>(
+        LogFileName(options_.db_path.string(), log_number));
+  }
+  return log_number;
+}
+
+uint64_t DBImpl::MinLogNumber(const SuperVersion& sv) const {
+  uint64_t ret = sv.GetMt()->GetLogNumber();
+  for (auto& imm : *sv.GetImms()) {
+    if (!imm->GetFlushComplete()) {
+      ret = std::min(ret, imm->GetLogNumber());
+    }
+  }
+  return ret;
+}
+
+void DBImpl::RemoveObsoleteLogs(uint64_t min_log_number) {
+  for (auto& entry : std::filesystem::directory_iterator(options_.db_path)) {
+    uint64_t log_number;
+    if (ParseLogFileName(entry.path().string(), &log_number) &&
+        log_number < min_log_number) {
+      std::filesystem::remove(entry.path());
+    }
+  }
+}
+
+uint64_t DBImpl::RemoveOrphanFiles(const std::set<uint64_t>& live_files) {
+  uint64_t next_id = 0;
+  size_t count = 0;
+  for (auto& entry : std::filesystem::directory_iterator(options_.db_path)) {
+    uint64_t sst_id;
+    if (!ParseSSTFileName(entry.path().string(), &sst_id)) {
+      continue;
+    }
+    next_id = std::max(next_id, sst_id + 1);
+    if (!live_files.count(sst_id)) {
+      file_purger_->Schedule(entry.path().string(), entry.file_size());
+      count += 1;
+    }
+  }
+  if (count > 0) {
+    DB_INFO("Remove {} orphan SSTables in {}", count,
+        options_.db_path.string());
+  }
+  return next_id;
+}
+
+void DBImpl::RecoverLogs(uint64_t min_log_number) {
+  std::vector<uint64_t> log_numbers;
+  for (auto& entry : std::filesystem::directory_iterator(options_.db_path)) {
+    uint64_t log_number;
+    if (ParseLogFileName(entry.path().string(), &log_number) &&
+        log_number >= min_log_number) {
+      log_numbers.push_back(log_number);
+    }
+  }
+  std::sort(log_numbers.begin(), log_numbers.end());
+  next_log_number_ = min_log_number;
+  auto mt = sv_->GetMt();
+  size_t count = 0;
+  for (auto log_number : log_numbers) {
+    LogReader reader(LogFileName(options_.db_path.string(), log_number));
+    ParsedKey key;
+    Slice value;
+    while (reader.ReadRecord(&key, &value)) {
+      if (key.type_ == RecordType::Value) {
+        mt->Put(key.user_key_, key.seq_, value);
+      } else if (key.type_ == RecordType::RangeDeletion) {
+        mt->DelRange(key.user_key_, value, key.seq_);
+      } else {
+        mt->Del(key.user_key_, key.seq_);
+      }
+      seq_ = std::max<size_t>(seq_, key.seq_);
+      count += 1;
+    }
+    next_log_number_ = log_number + 1;
+  }
+  /* The records of the MemTable are in the old logs and the new log. */
+  auto log_number = CreateLog();
+  mt->SetLogNumber(log_numbers.empty() ? log_number : log_numbers.front());
+  if (count > 0) {
+    DB_INFO("Recover {} records from {} logs", count, log_numbers.size());
   }
 }
 
 void DBImpl::DropAll() {
   WaitForFlushAndCompaction();
-  std::unique_lock db_lck(db_mutex_);
-  auto sv = GetSV();
-  auto new_sv = std::make_shared<SuperVersion>(std::make_shared<MemTable>(),
-      std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
-      std::make_shared<Version>());
-  auto version = sv->GetVersion();
-  for (auto& level : version->GetLevels()) {
-    for (auto& sr : level.GetRuns()) {
-      sr->SetRemoveTag(true);
+  ExclusiveWrite([&]() {
+    std::unique_lock db_lck(db_mutex_);
+    auto sv = GetSV();
+    auto new_mt = std::make_shared<MemTable>(options_.memtable_type);
+    new_mt->SetLogNumber(CreateLog());
+    auto new_sv = std::make_shared<SuperVersion>(new_mt,
+        std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
+        std::make_shared<Version>());
+    auto version = sv->GetVersion();
+    for (auto& level : version->GetLevels()) {
+      for (auto& sr : level.GetRuns()) {
+        sr->SetRemoveTag(true);
+      }
     }
-  }
-  InstallSV(new_sv);
+    if (write_buffer_manager_) {
+      write_buffer_manager_->ScheduleFreeMem(sv->GetMt()->size());
+      write_buffer_manager_->FreeMem(sv->GetMt()->size());
+      for (auto& imm : *sv->GetImms()) {
+        write_buffer_manager_->FreeMem(imm->size());
+      }
+    }
+    InstallSV(new_sv);
+    RemoveObsoleteLogs(new_mt->GetLogNumber());
+  });
 }
 
-bool DBImpl::Get(Slice key, std::string* value) {
+bool DBImpl::Get(
+    Slice key, std::string* value, std::optional<seq_t> snapshot) {
   auto sv = GetSV();
-  auto seq = seq_;
+  auto seq = snapshot.value_or(seq_);
   return sv->Get(key, seq, value);
 }
 
-void DBImpl::SaveMetadata() {
-  auto metadata_file = options_.db_path.string() + "/metadata";
-  FileWriter writer(
-      std::make_unique<SeqWriteFile>(metadata_file, options_.use_direct_io),
-      1 << 20);
+std::vector<bool> DBImpl::MultiGet(std::span<const Slice> keys,
+    std::vector<std::string>* values, std::optional<seq_t> snapshot) {
   auto sv = GetSV();
-  auto version = sv->GetVersion();
-  writer.AppendValue<uint64_t>(seq_)
-      .AppendValue<uint64_t>(filename_gen_->GetID())
-      .AppendValue<uint64_t>(version->GetLevels().size());
-  for (auto& level : version->GetLevels()) {
-    writer.AppendValue<uint64_t>(level.GetID())
-        .AppendValue<uint64_t>(level.GetRuns().size());
-    for (auto& run : level.GetRuns()) {
-      writer.AppendValue<uint64_t>(run->GetSSTs().size());
-      for (auto& sst : run->GetSSTs()) {
-        auto& info = sst->GetSSTInfo();
-        writer.AppendValue<uint64_t>(info.count_)
-            .AppendValue<uint64_t>(info.size_)
-            .AppendValue<uint64_t>(info.sst_id_)
-            .AppendValue<uint64_t>(info.index_offset_)
-            .AppendValue<uint64_t>(info.bloom_filter_offset_)
-            .AppendValue<uint64_t>(info.filename_.size())
-            .AppendString(info.filename_);
-      }
+  auto seq = snapshot.value_or(seq_);
+  return sv->MultiGet(keys, seq, values);
+}
+
+seq_t DBImpl::GetSnapshot() {
+  // The records up to seq_ are in the MemTable once write_mutex_ is released.
+  std::unique_lock lck(write_mutex_);
+  std::unique_lock snapshot_lck(snapshot_mutex_);
+  snapshots_.insert(seq_);
+  return seq_;
+}
+
+void DBImpl::ReleaseSnapshot(seq_t snapshot) {
+  {
+    std::unique_lock lck(snapshot_mutex_);
+    auto it = snapshots_.find(snapshot);
+    if (it == snapshots_.end()) {
+      DB_ERR("Snapshot {} is not alive", snapshot);
     }
+    snapshots_.erase(it);
   }
-  writer.Flush();
+  // The versions kept for the snapshot can be dropped by compactions now.
+  std::unique_lock lck(db_mutex_);
+  compaction_pending_ = true;
+  MaybeScheduleCompaction();
+}
+
+std::vector<seq_t> DBImpl::GetSnapshots() {
+  std::unique_lock lck(snapshot_mutex_);
+  std::vector<seq_t> ret;
+  std::unique_copy(snapshots_.begin(), snapshots_.end(), std::back_inserter(ret));
+  return ret;
+}
+
+void DBImpl::SaveMetadata() {
+  auto sv = GetSV();
+  auto snapshot = VersionEdit::Diff(Version(), *sv->GetVersion());
+  snapshot.last_seq_ = seq_;
+  snapshot.next_file_id_ = filename_gen_->GetID();
+  snapshot.min_log_number_ = MinLogNumber(*sv);
+  /* The old MANIFEST is replaced after the new one is written. */
+  manifest_ = std::make_unique<ManifestWriter>(
+      options_.db_path.string(), snapshot);
 }
 
 void DBImpl::LoadMetadata() {
-  auto metadata_filename = options_.db_path.string() + "/metadata";
-  auto file =
-      std::make_unique<ReadFile>(metadata_filename, options_.use_direct_io);
-  FileReader reader(file.get(), 1 << 20, 0);
-  seq_ = reader.ReadValue<uint64_t>();
-  auto latest_file_id = reader.ReadValue<uint64_t>();
-  auto num_levels = reader.ReadValue<uint64_t>();
+  VersionBuilder builder;
+  if (!ReadManifest(options_.db_path.string(), &builder) &&
+      !ReadLegacyMetadata(options_.db_path.string(), &builder)) {
+    DB_ERR("Cannot find the MANIFEST in {}", options_.db_path.string());
+  }
+  seq_ = builder.last_seq_;
   std::vector<Level> levels;
-  for (uint64_t i = 0; i < num_levels; i++) {
-    auto id = reader.ReadValue<uint64_t>();
-    auto num_run = reader.ReadValue<uint64_t>();
+  for (size_t i = 0; i < builder.levels_.size(); i++) {
     std::vector<std::shared_ptr<SortedRun>> runs;
-    for (uint64_t j = 0; j < num_run; j++) {
-      auto num_sst = reader.ReadValue<uint64_t>();
+    for (auto& run : builder.levels_[i]) {
       std::vector<SSTInfo> ssts;
-      for (uint64_t k = 0; k < num_sst; k++) {
-        SSTInfo info;
-        info.count_ = reader.ReadValue<uint64_t>();
-        info.size_ = reader.ReadValue<uint64_t>();
-        info.sst_id_ = reader.ReadValue<uint64_t>();
-        info.index_offset_ = reader.ReadValue<uint64_t>();
-        info.bloom_filter_offset_ = reader.ReadValue<uint64_t>();
-        auto len = reader.ReadValue<uint64_t>();
-        info.filename_ = reader.ReadString(len);
-        ssts.push_back(info);
+      for (auto id : run) {
+        ssts.push_back(builder.files_.at(id));
       }
-      runs.push_back(std::make_shared<SortedRun>(
-          ssts, options_.block_size, options_.use_direct_io));
+      runs.push_back(std::make_shared<SortedRun>(ssts, options_.block_size,
+          options_.use_direct_io, cache_.get(), options_.use_mmap_reads,
+          file_purger_.get()));
     }
-    levels.emplace_back(id, std::move(runs));
+    levels.emplace_back(i, std::move(runs));
   }
   auto version = std::make_shared<Version>(std::move(levels));
-  sv_ = std::make_shared<SuperVersion>(std::make_shared<MemTable>(),
+  sv_ = std::make_shared<SuperVersion>(
+      std::make_shared<MemTable>(options_.memtable_type),
       std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
       std::move(version));
-  DB_INFO("SuperVersion: {}", sv_->ToString());
+  /**
+   * A compaction interrupted by a crash may leave SSTables with ids not smaller
+   * than next_file_id_. They are deleted later, so their ids are not reused.
+   */
+  std::set<uint64_t> live_files;
+  for (auto& [id, info] : builder.files_) {
+    live_files.insert(id);
+  }
   filename_gen_ = std::make_unique<FileNameGenerator>(
-      options_.db_path.string() + "/", latest_file_id);
+      options_.db_path.string() + "/",
+      std::max<uint64_t>(builder.next_file_id_, RemoveOrphanFiles(live_files)));
+  RecoverLogs(builder.min_log_number_);
+  /* The edits (and a torn record) are replaced by a snapshot. */
+  SaveMetadata();
+  std::filesystem::remove(options_.db_path / "metadata");
+  DB_INFO("SuperVersion: {}", sv_->ToString());
 }
 
-void DBImpl::Save() { SaveMetadata(); }
+void DBImpl::Save() {
+  std::unique_lock db_lck(db_mutex_);
+  SaveMetadata();
+}
 
 void DBImpl::FlushAll() {
-  SwitchMemtable(true);
-  while (true) {
-    {
-      auto sv = GetSV();
-      if (sv->GetMt()->size() == 0 && sv->GetImms()->size() == 0) {
-        break;
-      }
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-  }
+  ExclusiveWrite([&]() { SwitchMemtable(true); });
+  std::unique_lock lck(db_mutex_);
+  bg_cv_.wait(lck, [&]() {
+    auto sv = GetSV();
+    return sv->GetMt()->size() == 0 && sv->GetImms()->size() == 0;
+  });
 }
 
 void DBImpl::WaitForFlushAndCompaction() {
-  while (true) {
-    db_mutex_.lock();
-    if (!flush_flag_ && !compact_flag_) {
-      db_mutex_.unlock();
-      return;
-    }
-    db_mutex_.unlock();
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  {
+    std::unique_lock lck(db_mutex_);
+    bg_cv_.wait(lck, [&]() {
+      return !flush_scheduled_ && GetSV()->GetImms()->empty() &&
+             !compaction_pending_ && scheduled_compactions_ == 0;
+    });
   }
+  file_purger_->Drain();
 }
 
-void DBImpl::FlushThread() {
-  while (!stop_signal_) {
-    /* Wait for the signal from SwitchMemtable */
-    std::unique_lock lck(db_mutex_);
-    if (stop_signal_) {
-      flush_flag_ = false;
-      return;
-    }
-    /* Pick the memtables that require flushing */
-    std::vector<std::shared_ptr<MemTable>> imms;
+void DBImpl::Ingest(Iterator* it) {
+  if (!it->Valid()) {
+    return;
+  }
+  ExclusiveWrite([&]() {
+    auto seq = seq_ + 1;
+    CompactionJob worker(filename_gen_.get(), options_.block_size,
+        options_.sst_file_size, options_.write_buffer_size,
+        options_.bloom_bits_per_key, options_.use_direct_io,
+        options_.block_restart_interval, options_.compression,
+        options_.filter_type);
+    auto run = std::make_shared<SortedRun>(
+        worker.Run(IngestIterator(it, seq)), options_.block_size,
+        options_.use_direct_io, cache_.get(), options_.use_mmap_reads,
+        file_purger_.get());
+    GetStatsContext()->total_input_bytes.fetch_add(
+        run->size(), std::memory_order_relaxed);
+    auto smallest = run->GetSmallestKey().user_key_;
+    auto largest = run->GetLargestKey().user_key_;
+    auto overlaps = [&](MemTable& mt) {
+      auto mt_it = mt.Seek(smallest, std::numeric_limits<seq_t>::max());
+      if (mt_it.Valid() && ParsedKey(mt_it.key()).user_key_ <= largest) {
+        return true;
+      }
+      for (auto& tombstone : mt.GetRangeTombstones()) {
+        if (tombstone.begin_ <= largest && smallest < tombstone.end_) {
+          return true;
+        }
+      }
+      return false;
+    };
+    // The MemTables are searched before the SSTables, so they are flushed if
+    // they have the keys, whose records are older.
+    bool flush = false;
     {
-      auto old_sv = GetSV();
-      while (old_sv->GetVersion()->GetLevels().size() > 0 &&
-             old_sv->GetVersion()->GetLevels()[0].GetRuns().size() >=
-                 options_.level0_stop_writes_trigger) {
-        old_sv.reset();
-        StopWrite();
-        old_sv = GetSV();
+      auto sv = GetSV();
+      flush = overlaps(*sv->GetMt());
+      for (auto& imm : *sv->GetImms()) {
+        flush = flush || overlaps(*imm);
       }
-      imms = PickMemTables();
-      if (imms.empty()) {
-        old_sv.reset();
-        flush_flag_ = false;
-        flush_cv_.wait(lck);
-        continue;
+    }
+    if (flush) {
+      SwitchMemtable(true);
+    }
+    std::unique_lock lck(db_mutex_);
+    // No compaction can change the levels while the SSTables are installed.
+    bg_cv_.wait(lck, [&]() {
+      return running_compactions_ == 0 &&
+             (!flush || GetSV()->GetImms()->empty());
+    });
+    seq_ = seq;
+    auto old_sv = GetSV();
+    auto& levels = old_sv->GetVersion()->GetLevels();
+    auto level_overlaps = [&](const Level& level) {
+      for (auto& level_run : level.GetRuns()) {
+        for (auto& sst : level_run->GetSSTs()) {
+          if (sst->GetSmallestKey().user_key_ <= largest &&
+              smallest <= sst->GetLargestKey().user_key_) {
+            return true;
+          }
+        }
       }
-
-      for (auto& imm : imms) {
-        imm->SetFlushInProgress(true);
+      return false;
+    };
+    // Level 0 is skipped if possible, so that the SSTables are not merged
+    // into Level 1 again.
+    size_t target = 0;
+    for (size_t i = 0; i < std::max<size_t>(levels.size(), 2); i++) {
+      if (i < levels.size() && level_overlaps(levels[i])) {
+        break;
       }
-      flush_flag_ = true;
+      target = i;
     }
-    /* Flush the memtables */
-    std::vector<std::shared_ptr<SortedRun>> runs;
-    {
-      db_mutex_.unlock();
-      for (auto& imm : imms) {
-        CompactionJob worker(filename_gen_.get(), options_.block_size,
-            options_.sst_file_size, options_.write_buffer_size,
-            options_.bloom_bits_per_key, options_.use_direct_io);
-        auto ssts = worker.Run(imm->Begin());
-        if (ssts.empty()) {
+    // A level other than Level 0 with one sorted run keeps one sorted run.
+    bool merged = false;
+    auto new_version = std::make_shared<Version>();
+    for (auto& level : levels) {
+      for (auto& level_run : level.GetRuns()) {
+        if (level.GetID() != static_cast<int>(target) || target == 0 ||
+            level.GetRuns().size() != 1) {
+          new_version->Append(level.GetID(), level_run);
           continue;
         }
-        runs.push_back(std::make_shared<SortedRun>(
+        std::vector<std::shared_ptr<SSTable>> ssts;
+        std::merge(level_run->GetSSTs().begin(), level_run->GetSSTs().end(),
+            run->GetSSTs().begin(), run->GetSSTs().end(),
+            std::back_inserter(ssts), [](const auto& a, const auto& b) {
+              return a->GetSmallestKey() < b->GetSmallestKey();
+            });
+        new_version->Append(target, std::make_shared<SortedRun>(
             ssts, options_.block_size, options_.use_direct_io));
-        GetStatsContext()->total_input_bytes.fetch_add(
-            runs.back()->size(), std::memory_order_relaxed);
+        merged = true;
       }
-      db_mutex_.lock();
     }
-    /* Install the new SuperVersion */
-    {
-      for (auto& imm : imms) {
-        imm->SetFlushComplete(true);
-      }
-      auto old_sv = GetSV();
-      auto mt = old_sv->GetMt();
-      auto new_imm = std::make_shared<std::vector<std::shared_ptr<MemTable>>>();
-      auto new_version = std::make_shared<Version>(*old_sv->GetVersion());
-      /* Filter out all completed Memtables */
-      for (auto imm : *old_sv->GetImms()) {
-        if (!imm->GetFlushComplete()) {
-          new_imm->push_back(imm);
-        }
-      }
-      /* Append the sorted runs to the first level (L0) of the LSM tree. */
-      new_version->Append(0, std::move(runs));
-      auto new_sv =
-          std::make_shared<SuperVersion>(std::move(mt), new_imm, new_version);
-      DB_INFO("{}", new_sv->ToString());
-      InstallSV(std::move(new_sv));
-      compact_cv_.notify_one();
+    if (!merged) {
+      new_version->Append(target, run);
     }
+    auto new_sv = std::make_shared<SuperVersion>(
+        old_sv->GetMt(), old_sv->GetImms(), new_version);
+    DB_INFO("Ingest {} SSTables into Level {}", run->SSTCount(), target);
+    InstallSV(std::move(new_sv));
+    compaction_pending_ = true;
+    MaybeScheduleCompaction();
+    bg_cv_.notify_all();
+  });
+}
+
+void DBImpl::MaybeScheduleFlush() {
+  if (stop_signal_ || flush_scheduled_ || GetSV()->GetImms()->empty()) {
+    return;
   }
+  flush_scheduled_ = true;
+  scheduler_->ScheduleFlush([this]() { BackgroundFlush(); });
 }
 
-void DBImpl::CompactionThread() {
-  while (!stop_signal_) {
-    std::unique_lock lck(db_mutex_);
-    // Check if it has to stop. 
-    // It has to stop when the LSM-tree shutdowns.
-    if (stop_signal_) {
-      compact_flag_ = false;
-      return;
+void DBImpl::MaybeScheduleCompaction() {
+  while (!stop_signal_ && compaction_pending_ &&
+         scheduled_compactions_ <
+             std::max<size_t>(options_.max_background_compactions, 1)) {
+    scheduled_compactions_ += 1;
+    scheduler_->ScheduleCompaction([this]() { BackgroundCompaction(); });
+  }
+}
+
+void DBImpl::BackgroundFlush() {
+  std::unique_lock lck(db_mutex_);
+  /* Pick the memtables that require flushing */
+  std::vector<std::shared_ptr<MemTable>> imms;
+  {
+    auto old_sv = GetSV();
+    auto& levels = old_sv->GetVersion()->GetLevels();
+    if (!stop_signal_ &&
+        (levels.empty() ||
+            levels[0].GetRuns().size() < options_.level0_stop_writes_trigger)) {
+      imms = PickMemTables();
     }
-    std::unique_ptr<Compaction> compaction;
-    {
-      auto old_sv = GetSV();
-      compaction = compaction_picker_->Get(old_sv->GetVersion().get());
-      if (!compaction) {
-        old_sv.reset();
-        compact_flag_ = false;
-        compact_cv_.wait(lck);
+  }
+  if (imms.empty()) {
+    flush_scheduled_ = false;
+    bg_cv_.notify_all();
+    return;
+  }
+  for (auto& imm : imms) {
+    imm->SetFlushInProgress(true);
+  }
+  /* Flush the memtables */
+  std::vector<std::shared_ptr<SortedRun>> runs;
+  {
+    size_t bloom_bits_per_key = GetBloomBitsPerKey(0, imms.back()->size());
+    auto snapshots = GetSnapshots();
+    db_mutex_.unlock();
+    for (auto& imm : imms) {
+      CompactionJob worker(filename_gen_.get(), options_.block_size,
+          options_.sst_file_size, options_.write_buffer_size,
+          bloom_bits_per_key, options_.use_direct_io,
+          options_.block_restart_interval, options_.compression,
+          options_.filter_type, false, snapshots);
+      auto ssts =
+          worker.Run(imm->Begin(), std::nullopt, imm->GetRangeTombstones());
+      if (ssts.empty()) {
         continue;
       }
-      for(auto it : compaction->input_ssts()){
-        it->SetCompactionInProcess(true);
-      }
-      for(auto it : compaction->input_runs()){
-        it->SetCompactionInProcess(true);
-      }
-      if(compaction->target_sorted_run()){
-        compaction->target_sorted_run()->SetCompactionInProcess(true);
-      }
-      compact_flag_ = true;
+      runs.push_back(std::make_shared<SortedRun>(ssts, options_.block_size,
+          options_.use_direct_io, cache_.get(), options_.use_mmap_reads,
+          file_purger_.get()));
+      GetStatsContext()->total_input_bytes.fetch_add(
+          runs.back()->size(), std::memory_order_relaxed);
     }
-    std::vector<std::shared_ptr<SSTable>> compact_ssts;
-    {
-      // Do compaction
-      // If trivial...
-      if(compaction->is_trivial_move()){
-        compact_ssts = compaction->input_ssts();
+    db_mutex_.lock();
+  }
+  /* Install the new SuperVersion */
+  {
+    for (auto& imm : imms) {
+      imm->SetFlushComplete(true);
+      if (write_buffer_manager_) {
+        write_buffer_manager_->FreeMem(imm->size());
       }
-      else{
-        db_mutex_.unlock();
-        // Else, Merge with IteratorHeap
-        std::vector<SSTableIterator> sst_its;
-        for(auto it : compaction->input_ssts()){
-          sst_its.push_back(it->Begin());
-        }
-        std::vector<SortedRunIterator> run_its;
-        for(auto it : compaction->input_runs()){
-          run_its.push_back(it->Begin());
-        }
-        IteratorHeap<Iterator> it_heap;
-        for(size_t i = 0; i < sst_its.size(); ++i){
-          it_heap.Push(&sst_its[i]);
-        }
-        for(size_t i = 0; i < run_its.size(); ++i){
-          it_heap.Push(&run_its[i]);
-        }
-        it_heap.Build();
-        CompactionJob worker(filename_gen_.get(), options_.block_size,
-              options_.sst_file_size, options_.write_buffer_size,
-              options_.bloom_bits_per_key, options_.use_direct_io);
-        auto ssts = worker.Run(it_heap);
-        if(ssts.empty()){
-          continue;
-        }
-        for(auto it : ssts){
-          compact_ssts.emplace_back(std::make_shared<SSTable>(
-            it, options_.block_size, options_.use_direct_io));
-        }
-        db_mutex_.lock();
+    }
+    auto old_sv = GetSV();
+    auto mt = old_sv->GetMt();
+    auto new_imm = std::make_shared<std::vector<std::shared_ptr<MemTable>>>();
+    auto new_version = std::make_shared<Version>(*old_sv->GetVersion());
+    /* Filter out all completed Memtables */
+    for (auto imm : *old_sv->GetImms()) {
+      if (!imm->GetFlushComplete()) {
+        new_imm->push_back(imm);
       }
     }
-    {
-      for(auto &it : compaction->input_ssts()){
-        it->SetCompactionInProcess(false);
-        it->SetRemoveTag(true);
+    /* Append the sorted runs to the first level (L0) of the LSM tree. */
+    new_version->Append(0, std::move(runs));
+    auto new_sv =
+        std::make_shared<SuperVersion>(std::move(mt), new_imm, new_version);
+    DB_INFO("{}", new_sv->ToString());
+    auto min_log_number = MinLogNumber(*new_sv);
+    /* The flushed records are persisted. Their logs can be removed. */
+    InstallSV(std::move(new_sv));
+    RemoveObsoleteLogs(min_log_number);
+  }
+  flush_scheduled_ = false;
+  compaction_pending_ = true;
+  /* The MemTables switched during the flush are flushed by the next job. */
+  MaybeScheduleFlush();
+  MaybeScheduleCompaction();
+  bg_cv_.notify_all();
+}
+
+void DBImpl::BackgroundCompaction() {
+  std::unique_lock lck(db_mutex_);
+  if (stop_signal_) {
+    scheduled_compactions_ -= 1;
+    bg_cv_.notify_all();
+    return;
+  }
+  std::unique_ptr<Compaction> compaction;
+  bool bottommost = false;
+  std::vector<seq_t> snapshots;
+  {
+    auto old_sv = GetSV();
+    snapshots = GetSnapshots();
+    compaction_picker_->SetTombstoneCompactionPaused(!snapshots.empty());
+    compaction = compaction_picker_->Get(old_sv->GetVersion().get());
+    if (!compaction) {
+      compaction_pending_ = false;
+      scheduled_compactions_ -= 1;
+      bg_cv_.notify_all();
+      return;
+    }
+    for(auto it : compaction->input_ssts()){
+      it->SetCompactionInProcess(true);
+    }
+    for(auto it : compaction->input_runs()){
+      it->SetCompactionInProcess(true);
+    }
+    if(compaction->target_sorted_run()){
+      compaction->target_sorted_run()->SetCompactionInProcess(true);
+    }
+    bottommost = IsBottommost(*compaction, *old_sv->GetVersion());
+    running_compactions_ += 1;
+  }
+  std::vector<std::shared_ptr<SSTable>> compact_ssts;
+  {
+    // Do compaction
+    // If trivial...
+    if(compaction->is_trivial_move()){
+      compact_ssts = compaction->input_ssts();
+    }
+    else{
+      size_t input_size = 0;
+      for(auto& it : compaction->input_ssts()){
+        input_size += it->GetSSTInfo().size_;
       }
-      for(auto &it : compaction->input_runs()){
-        it->SetCompactionInProcess(false);
-        it->SetRemoveTag(true);
+      for(auto& it : compaction->input_runs()){
+        input_size += it->size();
       }
-      if(compaction->target_sorted_run()){
-        compaction->target_sorted_run()->SetCompactionInProcess(false);
+      size_t bloom_bits_per_key =
+          GetBloomBitsPerKey(compaction->target_level(), input_size);
+      db_mutex_.unlock();
+      // Else, Merge with IteratorHeap
+      auto ssts = RunCompaction(
+          *compaction, bloom_bits_per_key, bottommost, snapshots);
+      for(auto it : ssts){
+        compact_ssts.emplace_back(std::make_shared<SSTable>(it,
+          options_.block_size, options_.use_direct_io, cache_.get(),
+          options_.use_mmap_reads, file_purger_.get()));
       }
-      // Create a new superversion and install it
-      auto old_sv = GetSV();
-      auto mt = old_sv->GetMt();
-      auto imm = old_sv->GetImms();
-      auto new_version = std::make_shared<Version>();
-      std::shared_ptr<SortedRun> new_run;
-      if(!compaction->target_sorted_run()){
+      db_mutex_.lock();
+    }
+  }
+  {
+    for(auto &it : compaction->input_ssts()){
+      it->SetCompactionInProcess(false);
+      it->SetRemoveTag(true);
+    }
+    for(auto &it : compaction->input_runs()){
+      it->SetCompactionInProcess(false);
+      it->SetRemoveTag(true);
+    }
+    if(compaction->target_sorted_run()){
+      compaction->target_sorted_run()->SetCompactionInProcess(false);
+    }
+    // Create a new superversion and install it
+    auto old_sv = GetSV();
+    auto mt = old_sv->GetMt();
+    auto imm = old_sv->GetImms();
+    auto new_version = std::make_shared<Version>();
+    std::shared_ptr<SortedRun> new_run;
+    if(!compaction->target_sorted_run()){
+      if(!compact_ssts.empty()){
         new_run = std::make_shared<SortedRun>(
                 compact_ssts, options_.block_size, options_.use_direct_io);
       }
-      else{
-        auto old_run = compaction->target_sorted_run();
-        auto old_ssts = old_run->GetSSTs();
-        std::vector<std::shared_ptr<SSTable>> merge_ssts;
-        auto old_sst = old_ssts.begin();
-        while(old_sst != old_ssts.end() && 
-          (*old_sst)->GetLargestKey() < compact_ssts[0]->GetSmallestKey()){
-          if(!(*old_sst)->GetRemoveTag()){
-            merge_ssts.push_back(*old_sst);
-          }
-          ++old_sst;
-        }
-        for(auto& it : compact_ssts){
-          merge_ssts.push_back(it);
+    }
+    else{
+      auto old_run = compaction->target_sorted_run();
+      auto old_ssts = old_run->GetSSTs();
+      std::vector<std::shared_ptr<SSTable>> merge_ssts;
+      auto old_sst = old_ssts.begin();
+      while(old_sst != old_ssts.end() && (compact_ssts.empty() ||
+        (*old_sst)->GetLargestKey() < compact_ssts[0]->GetSmallestKey())){
+        if(!(*old_sst)->GetRemoveTag()){
+          merge_ssts.push_back(*old_sst);
         }
-        while(old_sst != old_ssts.end()){
-          if(!(*old_sst)->GetRemoveTag()){
-            merge_ssts.push_back(*old_sst);
-          }
-          ++old_sst;
+        ++old_sst;
+      }
+      for(auto& it : compact_ssts){
+        merge_ssts.push_back(it);
+      }
+      while(old_sst != old_ssts.end()){
+        if(!(*old_sst)->GetRemoveTag()){
+          merge_ssts.push_back(*old_sst);
         }
+        ++old_sst;
+      }
+      if(!merge_ssts.empty()){
         new_run = std::make_shared<SortedRun>(
                 merge_ssts, options_.block_size, options_.use_direct_io);
       }
-      for (auto level : old_sv->GetVersion()->GetLevels()){
-        for(auto run : level.GetRuns()){
-          if(run->GetRemoveTag() || run == compaction->target_sorted_run()){
-            continue;
-          }
-          if(run->GetCompactionInProcess()){
-            new_version->Append(level.GetID(), run);
+    }
+    for (auto& level : old_sv->GetVersion()->GetLevels()){
+      for(auto& run : level.GetRuns()){
+        if(run->GetRemoveTag() || run == compaction->target_sorted_run()){
+          continue;
+        }
+        if(run->GetCompactionInProcess()){
+          new_version->Append(level.GetID(), run);
+          continue;
+        }
+        std::vector<std::shared_ptr<SSTable>> ssts;
+        for(auto& sst : run->GetSSTs()){
+          if(sst->GetRemoveTag()){
             continue;
           }
-          std::vector<std::shared_ptr<SSTable>> ssts;
-          for(auto& sst : run->GetSSTs()){
-            if(sst->GetRemoveTag()){
-              continue;
-            }
-            ssts.emplace_back(sst);
-          }
-          if(!ssts.empty()){
-            new_version->Append(level.GetID(), std::make_shared<SortedRun>(
-                ssts, options_.block_size, options_.use_direct_io));
-          }
+          ssts.emplace_back(sst);
         }
-      }
-      if(compaction->is_trivial_move()){
-        for(auto it : compaction->input_ssts()){
-          it->SetRemoveTag(false);
+        if(!ssts.empty()){
+          new_version->Append(level.GetID(), std::make_shared<SortedRun>(
+              ssts, options_.block_size, options_.use_direct_io));
         }
       }
+    }
+    if(compaction->is_trivial_move()){
+      for(auto it : compaction->input_ssts()){
+        it->SetRemoveTag(false);
+      }
+    }
+    if(new_run){
       new_version->Append(compaction->target_level(), new_run);
-      auto new_sv = std::make_shared<SuperVersion>(
-        std::move(mt), imm, new_version);
-      //DB_INFO("{}", new_sv->ToString());
-      InstallSV(std::move(new_sv));
+    }
+    auto new_sv = std::make_shared<SuperVersion>(
+      std::move(mt), imm, new_version);
+    //DB_INFO("{}", new_sv->ToString());
+    InstallSV(std::move(new_sv));
+    running_compactions_ -= 1;
+    scheduled_compactions_ -= 1;
+    compaction_pending_ = true;
+    /* The levels of the compaction can be picked by the other jobs. */
+    MaybeScheduleCompaction();
+    /* The flush may be waiting for the compaction of Level 0. */
+    MaybeScheduleFlush();
+    bg_cv_.notify_all();
+  }
+}
+
+size_t DBImpl::GetBloomBitsPerKey(size_t level, size_t new_size) {
+  if (!options_.monkey_filter_allocation) {
+    return options_.bloom_bits_per_key;
+  }
+  return GetSV()->GetVersion()->GetFilterBitsPerKey(
+      level, new_size, options_.bloom_bits_per_key);
+}
+
+bool DBImpl::IsBottommost(
+    const Compaction& compaction, const Version& version) const {
+  auto& levels = version.GetLevels();
+  auto& input_runs = compaction.input_runs();
+  for (size_t i = compaction.target_level(); i < levels.size(); i++) {
+    for (auto& run : levels[i].GetRuns()) {
+      if (run != compaction.target_sorted_run() &&
+          std::find(input_runs.begin(), input_runs.end(), run) ==
+              input_runs.end()) {
+        return false;
+      }
     }
   }
+  return true;
+}
+
+std::vector<SSTInfo> DBImpl::RunCompaction(const Compaction& compaction,
+    size_t bloom_bits_per_key, bool bottommost,
+    const std::vector<seq_t>& snapshots) {
+  auto bounds = GetSubcompactionBoundaries(compaction);
+  std::vector<RangeTombstone> range_dels;
+  auto add_range_dels = [&](const std::shared_ptr<SSTable>& sst) {
+    auto& tombstones = sst->GetRangeTombstones();
+    range_dels.insert(range_dels.end(), tombstones.begin(), tombstones.end());
+  };
+  for (auto& sst : compaction.input_ssts()) {
+    add_range_dels(sst);
+  }
+  for (auto& run : compaction.input_runs()) {
+    for (auto& sst : run->GetSSTs()) {
+      add_range_dels(sst);
+    }
+  }
+  auto run = [&](size_t id) {
+    // The inputs are read once, so they should not pollute the cache.
+    constexpr auto kMaxSeq = std::numeric_limits<seq_t>::max();
+    std::vector<SSTableIterator> sst_its;
+    for (auto& sst : compaction.input_ssts()) {
+      sst_its.push_back(id == 0
+              ? sst->Begin(CacheFill::kNone)
+              : sst->Seek(bounds[id - 1], kMaxSeq, CacheFill::kNone));
+    }
+    std::vector<SortedRunIterator> run_its;
+    for (auto& run : compaction.input_runs()) {
+      run_its.push_back(id == 0
+              ? run->Begin(CacheFill::kNone)
+              : run->Seek(bounds[id - 1], kMaxSeq, CacheFill::kNone));
+    }
+    IteratorHeap<Iterator> it_heap;
+    for (auto& it : sst_its) {
+      it_heap.Push(&it);
+    }
+    for (auto& it : run_its) {
+      it_heap.Push(&it);
+    }
+    it_heap.Build();
+    CompactionJob worker(filename_gen_.get(), options_.block_size,
+        options_.sst_file_size, options_.write_buffer_size,
+        bloom_bits_per_key, options_.use_direct_io,
+        options_.block_restart_interval, options_.compression,
+        options_.filter_type, bottommost, snapshots);
+    auto end =
+        id < bounds.size() ? std::optional<Slice>(bounds[id]) : std::nullopt;
+    return worker.Run(it_heap, end,
+        ClipRangeTombstones(
+            range_dels, id == 0 ? Slice() : bounds[id - 1], end));
+  };
+  std::vector<std::future<std::vector<SSTInfo>>> futures;
+  for (size_t i = 1; i <= bounds.size(); i++) {
+    auto task = std::make_shared<std::packaged_task<std::vector<SSTInfo>()>>(
+        [&, i]() { return run(i); });
+    futures.push_back(task->get_future());
+    subcompaction_pool_->Push([task]() { (*task)(); });
+  }
+  auto ssts = run(0);
+  // The key ranges are disjoint and increasing, so the outputs are sorted.
+  for (auto& future : futures) {
+    auto sub_ssts = future.get();
+    ssts.insert(ssts.end(), sub_ssts.begin(), sub_ssts.end());
+  }
+  return ssts;
+}
+
+std::vector<Slice> DBImpl::GetSubcompactionBoundaries(
+    const Compaction& compaction) const {
+  std::vector<Slice> ret;
+  if (options_.max_subcompactions <= 1) {
+    return ret;
+  }
+  // (The smallest user key, the size) of the input SSTables.
+  std::vector<std::pair<Slice, size_t>> ssts;
+  auto add_sst = [&](const std::shared_ptr<SSTable>& sst) {
+    ssts.emplace_back(
+        sst->GetSmallestKey().user_key_, sst->GetSSTInfo().size_);
+  };
+  for (auto& sst : compaction.input_ssts()) {
+    add_sst(sst);
+  }
+  for (auto& run : compaction.input_runs()) {
+    for (auto& sst : run->GetSSTs()) {
+      add_sst(sst);
+    }
+  }
+  std::sort(ssts.begin(), ssts.end());
+  size_t total_size = 0;
+  for (auto& sst : ssts) {
+    total_size += sst.second;
+  }
+  size_t n = std::min(options_.max_subcompactions, ssts.size());
+  size_t prefix_size = 0;
+  for (size_t i = 0; i + 1 < ssts.size() && ret.size() + 1 < n; i++) {
+    prefix_size += ssts[i].second;
+    // Cut before SSTable i + 1 once the prefix reaches its share.
+    auto key = ssts[i + 1].first;
+    if (prefix_size * n >= total_size * (ret.size() + 1) &&
+        key > (ret.empty() ? ssts[0].first : ret.back())) {
+      ret.push_back(key);
+    }
+  }
+  return ret;
 }
 
 std::vector<std::shared_ptr<MemTable>> DBImpl::PickMemTables() {
@@ -475,28 +1056,81 @@ std::shared_ptr<SuperVersion> DBImpl::GetSV() {
 }
 
 void DBImpl::InstallSV(std::shared_ptr<SuperVersion> sv) {
-  std::unique_lock lck(sv_mutex_);
-  sv_ = std::move(sv);
+  auto old_sv = GetSV();
+  bool new_version = sv->GetVersion() != old_sv->GetVersion();
+  if (manifest_ && new_version) {
+    auto edit = VersionEdit::Diff(*old_sv->GetVersion(), *sv->GetVersion());
+    edit.last_seq_ = seq_;
+    edit.next_file_id_ = filename_gen_->GetID();
+    edit.min_log_number_ = MinLogNumber(*sv);
+    manifest_->AddEdit(edit);
+  }
+  old_sv.reset();
+  {
+    std::unique_lock lck(sv_mutex_);
+    sv_ = std::move(sv);
+  }
+  if (manifest_ && new_version &&
+      manifest_->size() > std::max<size_t>(options_.max_manifest_file_size,
+                              2 * manifest_->snapshot_size())) {
+    SaveMetadata();
+  }
 }
 
-DBIterator DBImpl::Begin() {
-  DBIterator it(GetSV(), seq_);
+DBIterator DBImpl::Begin(std::optional<seq_t> snapshot, CacheFill fill_cache) {
+  DBIterator it(GetSV(), snapshot.value_or(seq_), fill_cache);
   it.SeekToFirst();
   return it;
 }
 
-DBIterator DBImpl::Seek(Slice key) {
-  DBIterator it(GetSV(), seq_);
+DBIterator DBImpl::Seek(
+    Slice key, std::optional<seq_t> snapshot, CacheFill fill_cache) {
+  DBIterator it(GetSV(), snapshot.value_or(seq_), fill_cache);
   it.Seek(key);
   return it;
 }
 
+DBIterator::DBIterator(
+    std::shared_ptr<SuperVersion> sv, seq_t seq, CacheFill fill_cache)
+  : sv_(std::move(sv)), it_(sv_.get(), fill_cache), seq_(seq) {
+  range_del_agg_.Add(sv_->GetMt()->GetRangeTombstones(), seq_);
+  for (auto& imm : *sv_->GetImms()) {
+    range_del_agg_.Add(imm->GetRangeTombstones(), seq_);
+  }
+  auto& version_agg = sv_->GetVersion()->GetRangeDelAggregator();
+  if (version_agg.max_seq() <= seq_) {
+    if (!version_agg.empty()) {
+      version_range_del_agg_ = &version_agg;
+    }
+  } else {
+    // The shared fragments only keep the newest tombstones, some of which
+    // the snapshot does not see, so the visible ones are collected here.
+    for (auto& level : sv_->GetVersion()->GetLevels()) {
+      for (auto& run : level.GetRuns()) {
+        for (auto& sst : run->GetSSTs()) {
+          range_del_agg_.Add(sst->GetRangeTombstones(), seq_);
+        }
+      }
+    }
+  }
+  range_del_agg_.Build();
+}
+
+bool DBIterator::IsHidden() const {
+  if (current_key_.record_type() == RecordType::Deletion ||
+      current_key_.seq() > seq_) {
+    return true;
+  }
+  ParsedKey key(current_key_);
+  return range_del_agg_.ShouldDelete(key) ||
+         (version_range_del_agg_ && version_range_del_agg_->ShouldDelete(key));
+}
+
 void DBIterator::SeekToFirst() {
   it_.SeekToFirst();
   if (it_.Valid()) {
     current_key_ = ParsedKey(it_.key());
-    if (current_key_.record_type() == RecordType::Deletion ||
-        current_key_.seq() > seq_) {
+    if (IsHidden()) {
       Next();
     }
   }
@@ -506,8 +1140,7 @@ void DBIterator::Seek(Slice key) {
   it_.Seek(key, seq_);
   if (it_.Valid()) {
     current_key_ = ParsedKey(it_.key());
-    if (current_key_.record_type() == RecordType::Deletion ||
-        current_key_.seq() > seq_) {
+    if (IsHidden()) {
       Next();
     }
   }
@@ -530,7 +1163,7 @@ void DBIterator::Next() {
     }
     if (it_.Valid()) {
       current_key_ = ParsedKey(it_.key());
-      if (current_key_.record_type() == RecordType::Deletion) {
+      if (IsHidden()) {
         it_.Next();
         continue;
       }
@@ -6,22 +6,31 @@
 #include <limits>
 #include <map>
 #include <mutex>
+#include <optional>
 #include <set>
 #include <shared_mutex>
+#include <span>
 #include <thread>
 #include <utility>
 #include <variant>
 
+#include "common/threadpool.hpp"
 #include "storage/lsm/cache.hpp"
 #include "storage/lsm/compaction_pick.hpp"
+#include "storage/lsm/file_purger.hpp"
+#include "storage/lsm/manifest.hpp"
 #include "storage/lsm/memtable.hpp"
 #include "storage/lsm/options.hpp"
+#include "storage/lsm/scheduler.hpp"
 #include "storage/lsm/version.hpp"
+#include "storage/lsm/wal.hpp"
+#include "storage/lsm/write_buffer_manager.hpp"
 
 namespace wing {
 
 namespace lsm {
 
+class BulkLoader;
 class DBIterator;
 
 class DBImpl {
@@ -33,57 +42,244 @@ class DBImpl {
     return std::make_unique<DBImpl>(options);
   }
 
+  /**
+   * For tests. Destroy db as if the process crashed: the MemTables are not
+   * flushed and the metadata is not saved, so that they are recovered from
+   * the logs and the MANIFEST. The background jobs are stopped, and the files
+   * are closed.
+   */
+  static void SimulateCrash(std::unique_ptr<DBImpl> db);
+
   void Put(Slice key, Slice value);
   void Del(Slice key);
-  // Return true if kFound, false if not
-  bool Get(Slice key, std::string *value);
+  /**
+   * Delete the keys in [begin, end) with one range tombstone, whatever the
+   * number of keys is. It does nothing if begin >= end.
+   */
+  void DeleteRange(Slice begin, Slice end);
+  /**
+   * Return true if kFound, false if not.
+   * The reads take an optional snapshot returned by GetSnapshot, and see the
+   * tree as it was then. Otherwise they see the latest records.
+   */
+  bool Get(Slice key, std::string *value,
+      std::optional<seq_t> snapshot = std::nullopt);
+  /**
+   * Get the values of keys in a batch, which share one SuperVersion. The keys
+   * are sorted, and the data blocks are read in parallel, each of them once.
+   * found[i] is true if keys[i] is found, and then (*values)[i] is its value.
+   */
+  std::vector<bool> MultiGet(std::span<const Slice> keys,
+      std::vector<std::string> *values,
+      std::optional<seq_t> snapshot = std::nullopt);
+  /**
+   * Pin the current sequence number. The reads at it see the same records
+   * until it is released, because the compactions keep the versions that it
+   * reads. Every snapshot must be released by ReleaseSnapshot.
+   */
+  seq_t GetSnapshot();
+  void ReleaseSnapshot(seq_t snapshot);
+  /**
+   * Install the records of it as new SSTables, so that they skip the
+   * MemTable and the write-ahead log. The records must be sorted by user keys.
+   * If a user key appears many times, the first record is kept. They share a
+   * new sequence number, so they overwrite the old records of their keys.
+   * The SSTables are put in the lowest level such that no record of the
+   * MemTables or the levels above it is in their key range. The writes are
+   * blocked while the SSTables are written. See BulkLoader.
+   */
+  void Ingest(Iterator *it);
   void Save();
   void FlushAll();
+  /**
+   * Wait until the background jobs finish, and the obsolete SSTables are
+   * deleted.
+   */
   void WaitForFlushAndCompaction();
   size_t CurrentSeq() const { return seq_; }
   /* Delete all things */
   void DropAll();
 
-  DBIterator Begin();
-  DBIterator Seek(Slice key);
+  /**
+   * fill_cache: how the blocks read by the iterator fill the block cache. Long
+   * scans should use CacheFill::kLowPriority, so that they do not evict the
+   * blocks of point lookups.
+   */
+  DBIterator Begin(std::optional<seq_t> snapshot = std::nullopt,
+      CacheFill fill_cache = CacheFill::kHighPriority);
+  DBIterator Seek(Slice key, std::optional<seq_t> snapshot = std::nullopt,
+      CacheFill fill_cache = CacheFill::kHighPriority);
   std::shared_ptr<SuperVersion> GetSV();
   const Options &GetOptions() const { return options_; }
 
  private:
+  /* A pending write in the writer queue. */
+  struct Writer {
+    Writer(Slice key, Slice value, RecordType type, bool exclusive = false)
+      : key_(key), value_(value), type_(type), exclusive_(exclusive) {}
+
+    Slice key_;
+    Slice value_;
+    RecordType type_;
+    /* It carries no record and must be the only writer, e.g. FlushAll. */
+    bool exclusive_;
+    /* Whether the record has been committed by another writer. */
+    bool done_{false};
+    std::condition_variable cv_;
+  };
+
+  /**
+   * Commit a record. The writer at the head of the queue commits the records
+   * of all the writers behind it, so that they share one log write (and sync).
+   */
+  void Write(Slice key, Slice value, RecordType type);
+  /**
+   * Delay the writes of bytes if the flushes or the compactions fall behind,
+   * so that the writes are slowed down gradually before they are stopped.
+   * Require: lck holds write_mutex_, which is released while sleeping.
+   */
+  void DelayWrite(std::unique_lock<std::mutex> &lck, size_t bytes);
+  /* Whether the writes should be slowed down. */
+  bool NeedSlowdown();
+  /* Run func while no other writer is running. */
+  void ExclusiveWrite(const std::function<void()> &func);
+  /**
+   * Create a new write-ahead log and return its number.
+   * Require: no other writer is running.
+   */
+  uint64_t CreateLog();
+  /* The smallest log number whose records are not in the SSTables of sv. */
+  uint64_t MinLogNumber(const SuperVersion &sv) const;
+  /* Remove the logs whose numbers are smaller than min_log_number. */
+  void RemoveObsoleteLogs(uint64_t min_log_number);
+  /**
+   * Remove the SSTables in the directory that are not in the tree, e.g., the
+   * outputs of a compaction interrupted by a crash. Return the largest id of
+   * the SSTables in the directory plus one.
+   */
+  uint64_t RemoveOrphanFiles(const std::set<uint64_t>& live_files);
+  /* Replay the logs whose numbers >= min_log_number into the MemTable. */
+  void RecoverLogs(uint64_t min_log_number);
   void SwitchMemtable(bool force = false);
-  void FlushThread();
-  void CompactionThread();
+  /**
+   * Schedule a flush job if there are immutable MemTables and no flush job is
+   * scheduled. Require: DB Mutex held.
+   */
+  void MaybeScheduleFlush();
+  /**
+   * Schedule compaction jobs while the tree may need a compaction and less
+   * than max_background_compactions jobs are scheduled. Require: DB Mutex held.
+   */
+  void MaybeScheduleCompaction();
+  /**
+   * Flush the immutable MemTables, unless Level 0 has too many sorted runs.
+   * Then the flush is scheduled again when a compaction finishes.
+   */
+  void BackgroundFlush();
+  /* Pick a compaction and run it. */
+  void BackgroundCompaction();
+  /**
+   * Merge the inputs of a non-trivial compaction and return the new SSTables.
+   * It is split into subcompactions by GetSubcompactionBoundaries.
+   * bloom_bits_per_key: see GetBloomBitsPerKey.
+   * bottommost: see IsBottommost. The tombstones are dropped if it is true.
+   * snapshots: the live snapshots when the compaction is picked.
+   */
+  std::vector<SSTInfo> RunCompaction(const Compaction &compaction,
+      size_t bloom_bits_per_key, bool bottommost,
+      const std::vector<seq_t> &snapshots);
+  /**
+   * Whether no record older than the inputs of the compaction is left in the
+   * tree, i.e. the target level and the levels below it have no sorted run
+   * other than the inputs and the target sorted run. Require: DB Mutex held.
+   */
+  bool IsBottommost(const Compaction &compaction, const Version &version) const;
+  /**
+   * The bits per key of the bloom filters of a new sorted run of new_size
+   * bytes in the level. It is options_.bloom_bits_per_key unless
+   * options_.monkey_filter_allocation is set. Require: DB Mutex held.
+   */
+  size_t GetBloomBitsPerKey(size_t level, size_t new_size);
+  /**
+   * Split the key range of the compaction at the smallest keys of the input
+   * SSTables, so that the sizes of the subcompactions are close.
+   * Subcompaction i merges the user keys in [ret[i - 1], ret[i]).
+   */
+  std::vector<Slice> GetSubcompactionBoundaries(
+      const Compaction &compaction) const;
+  /* The sequence numbers of the live snapshots, sorted and distinct. */
+  std::vector<seq_t> GetSnapshots();
   std::vector<std::shared_ptr<MemTable>> PickMemTables();
+  /**
+   * Install sv. If its version is new, the edit from the current version is
+   * appended to the MANIFEST and synced first, so that the files dropped from
+   * the tree are never referenced by the MANIFEST after they are removed.
+   * Require: DB Mutex held.
+   */
   void InstallSV(std::shared_ptr<SuperVersion> sv);
+  /* Write a new MANIFEST starting with a snapshot of the tree. */
   void SaveMetadata();
+  /* Rebuild the tree from the MANIFEST and recover the MemTable. */
   void LoadMetadata();
 
-  // Require: DB Mutex held
-  void StopWrite();
+  // Require: DB Mutex held by lck
+  void StopWrite(std::unique_lock<std::mutex> &lck);
 
   Options options_;
-  Cache cache_;
+  /* They are shared with the other DBImpls, or owned by this one. */
+  std::shared_ptr<Cache> cache_;
+  std::shared_ptr<BackgroundScheduler> scheduler_;
+  std::shared_ptr<FilePurger> file_purger_;
+  /* It can be null. */
+  std::shared_ptr<WriteBufferManager> write_buffer_manager_;
   size_t seq_;
 
-  std::vector<std::thread> threads_;
-  std::condition_variable flush_cv_;
-  std::condition_variable compact_cv_;
+  /* It is notified when a background job finishes. It uses db_mutex_. */
+  std::condition_variable bg_cv_;
+  /* No more background job is scheduled after it is set. */
   bool stop_signal_{false};
-  bool compact_flag_{false};
-  bool flush_flag_{false};
+  /* The destructor does not flush or save anything. See SimulateCrash. */
+  bool crashed_{false};
+  /* Whether a flush job is scheduled or running. */
+  bool flush_scheduled_{false};
+  /* The number of compaction jobs that are scheduled or running. */
+  size_t scheduled_compactions_{0};
+  /* The number of compactions that are running. */
+  size_t running_compactions_{0};
+  /* The tree has changed since the last time a compaction was not picked. */
+  bool compaction_pending_{true};
 
   std::mutex write_mutex_;
+  /* The writers waiting for write_mutex_. The head is committing. */
+  std::deque<Writer *> writers_;
+  /* The write-ahead log of the current MemTable. */
+  std::unique_ptr<LogWriter> log_;
+  /* The number of the next write-ahead log. */
+  uint64_t next_log_number_{0};
+  /* The time when the next delayed write can be committed. */
+  std::chrono::steady_clock::time_point next_write_time_;
   std::mutex db_mutex_;
+  /* It protects snapshots_. No other mutex is acquired while holding it. */
+  std::mutex snapshot_mutex_;
+  /* The live snapshots. A sequence number is pinned by many snapshots. */
+  std::multiset<seq_t> snapshots_;
   std::shared_mutex sv_mutex_;
   std::shared_ptr<SuperVersion> sv_;
   std::unique_ptr<FileNameGenerator> filename_gen_;
+  std::unique_ptr<ManifestWriter> manifest_;
   std::unique_ptr<CompactionPicker> compaction_picker_;
+  /* Run the subcompactions. It is null if max_subcompactions <= 1. */
+  std::unique_ptr<ThreadPool> subcompaction_pool_;
+
+  friend class BulkLoader;
+  friend class WriteBufferManager;
 };
 
 class DBIterator final : public Iterator {
  public:
-  DBIterator(std::shared_ptr<SuperVersion> sv, seq_t seq)
-    : sv_(std::move(sv)), it_(sv_.get()), seq_(seq) {}
+  /* It collects the range tombstones of sv that are visible at seq. */
+  DBIterator(std::shared_ptr<SuperVersion> sv, seq_t seq,
+      CacheFill fill_cache = CacheFill::kHighPriority);
 
   void SeekToFirst();
 
@@ -98,10 +294,20 @@ class DBIterator final : public Iterator {
   void Next() override;
 
  private:
+  /**
+   * Whether current_key_ is skipped, i.e. it is a deletion, it is newer than
+   * seq_, or it is deleted by a range tombstone.
+   */
+  bool IsHidden() const;
+
   std::shared_ptr<SuperVersion> sv_;
   SuperVersionIterator it_;
   seq_t seq_;
   InternalKey current_key_;
+  /* The range tombstones of the MemTables, or all of them for old snapshots. */
+  RangeDelAggregator range_del_agg_;
+  /* The range tombstones of the SSTables, which the Version shares. */
+  const RangeDelAggregator *version_range_del_agg_{nullptr};
 };
 
 }  // namespace lsm
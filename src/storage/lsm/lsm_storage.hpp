@@ -1,5 +1,6 @@
 #pragma once
 
+#include "storage/lsm/bulk_load.hpp"
 #include "storage/lsm/lsm.hpp"
 #include "storage/storage.hpp"
 
@@ -27,7 +28,7 @@ class LSMStorage : public Storage {
     db->schema_ = std::get<0>(db_schema_result);
     for (uint32_t i = 0; i < db->schema_.GetTables().size(); i++) {
       auto name = db->schema_.GetTables()[i].GetName();
-      lsm::Options options0 = options;
+      lsm::Options options0 = db->options_;
       options0.create_new = false;
       options0.db_path = fmt::format("{}/tables/t'{}'", path.string(), name);
       auto lsm = std::make_unique<lsm::DBImpl>(options0);
@@ -88,6 +89,45 @@ class LSMStorage : public Storage {
       table_.lsm_->Put(key, new_value);
       return true;
     }
+    bool BulkInsert(
+        std::span<const std::pair<std::string_view, std::string_view>> rows)
+        override {
+      size_t size = 0;
+      for (auto [key, value] : rows) {
+        size += key.size() + value.size();
+      }
+      auto min_size = table_.lsm_->GetOptions().bulk_load_min_size;
+      if (min_size == 0 || size < min_size) {
+        for (auto [key, value] : rows) {
+          if (!Insert(key, value)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      // Like Insert, the keys must be new. They are checked before loading.
+      std::vector<std::string_view> keys;
+      keys.reserve(rows.size());
+      for (auto [key, _] : rows) {
+        keys.push_back(key);
+      }
+      std::sort(keys.begin(), keys.end());
+      if (std::adjacent_find(keys.begin(), keys.end()) != keys.end()) {
+        return false;
+      }
+      std::vector<std::string> values;
+      auto found = table_.lsm_->MultiGet(keys, &values);
+      if (std::find(found.begin(), found.end(), true) != found.end()) {
+        return false;
+      }
+      lsm::BulkLoader loader(table_.lsm_.get());
+      for (auto [key, value] : rows) {
+        loader.Add(key, value);
+      }
+      loader.Finish();
+      table_.tick_ += rows.size();
+      return true;
+    }
 
    private:
     Table& table_;
@@ -104,17 +144,32 @@ class LSMStorage : public Storage {
       }
       return reinterpret_cast<const uint8_t*>(value_.data());
     }
+    std::vector<const uint8_t*> MultiSearch(
+        std::span<const std::string_view> keys) override {
+      auto found = lsm_->MultiGet(keys, &values_);
+      std::vector<const uint8_t*> ret(keys.size(), nullptr);
+      for (size_t i = 0; i < keys.size(); i++) {
+        if (found[i]) {
+          ret[i] = reinterpret_cast<const uint8_t*>(values_[i].data());
+        }
+      }
+      return ret;
+    }
 
    private:
     lsm::DBImpl* lsm_;
     std::string value_;
+    /* The results of the last MultiSearch. */
+    std::vector<std::string> values_;
   };
 
   class LSMIterator : public wing::Iterator<const uint8_t*> {
    public:
     LSMIterator(lsm::DBImpl* lsm, std::tuple<std::string_view, bool, bool> L,
         std::tuple<std::string_view, bool, bool> R)
-      : it_(std::get<1>(L) ? lsm->Begin() : lsm->Seek(std::get<0>(L))) {
+      : it_(std::get<1>(L) ? lsm->Begin(std::nullopt, FillCache(L, R))
+                           : lsm->Seek(std::get<0>(L), std::nullopt,
+                                 FillCache(L, R))) {
       if (!std::get<1>(L) && !std::get<2>(L) && it_.Valid() &&
           it_.key() == std::get<0>(L)) {
         it_.Next();
@@ -140,6 +195,17 @@ class LSMStorage : public Storage {
     }
 
    private:
+    /**
+     * A full table scan reads every block once, so it caches the blocks with
+     * low priority to keep the blocks of point lookups in the cache.
+     */
+    static lsm::CacheFill FillCache(
+        const std::tuple<std::string_view, bool, bool>& L,
+        const std::tuple<std::string_view, bool, bool>& R) {
+      return std::get<1>(L) && std::get<1>(R) ? lsm::CacheFill::kLowPriority
+                                              : lsm::CacheFill::kHighPriority;
+    }
+
     bool first_flag_{true};
     lsm::DBIterator it_;
     std::tuple<std::string, bool, bool> R_;
@@ -202,6 +268,26 @@ class LSMStorage : public Storage {
   LSMStorage(const std::filesystem::path& path, const lsm::Options& options) {
     db_path_ = path.string();
     options_ = options;
+    // The tables share the block cache, the budget of MemTables, the
+    // background threads and the file purger, so that they are bounded per
+    // process rather than per table.
+    if (!options_.block_cache) {
+      options_.block_cache = std::make_shared<lsm::Cache>(options_.cache);
+    }
+    if (!options_.scheduler) {
+      options_.scheduler = std::make_shared<lsm::BackgroundScheduler>(
+          options_.max_background_flushes,
+          options_.max_background_compactions);
+    }
+    if (!options_.file_purger) {
+      options_.file_purger = std::make_shared<lsm::FilePurger>(
+          options_.delete_rate_bytes_per_sec);
+    }
+    if (!options_.write_buffer_manager && options_.db_write_buffer_size > 0) {
+      options_.write_buffer_manager =
+          std::make_shared<lsm::WriteBufferManager>(
+              options_.db_write_buffer_size);
+    }
   }
   Table& GetTable(std::string_view table_name) {
     auto it = tables_.find(table_name);
@@ -0,0 +1,317 @@
+#include "storage/lsm/manifest.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <unordered_set>
+
+#include "common/exception.hpp"
+#include "common/logging.hpp"
+#include "common/murmurhash.hpp"
+#include "common/serializer.hpp"
+#include "storage/lsm/version.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+static constexpr size_t kManifestChecksumSeed = 0x202410171508;
+
+static constexpr size_t kManifestHeaderSize =
+    sizeof(uint64_t) + sizeof(offset_t);
+
+namespace {
+
+template <typename T>
+void PutValue(std::string* dst, T value) {
+  dst->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+LevelLayout GetLayout(const Level& level) {
+  LevelLayout ret;
+  for (auto& run : level.GetRuns()) {
+    auto& ids = ret.emplace_back();
+    for (auto& sst : run->GetSSTs()) {
+      ids.push_back(sst->GetSSTInfo().sst_id_);
+    }
+  }
+  return ret;
+}
+
+void SyncFd(int fd) {
+#if defined(__linux__)
+  int ret = ::fdatasync(fd);
+#elif defined(__MINGW64__)
+  int ret = ::_commit(fd);
+#else
+  int ret = ::fsync(fd);
+#endif
+  if (ret < 0) {
+    throw DBException("::fdatasync Error! Error: {}", errno);
+  }
+}
+
+}  // namespace
+
+VersionEdit VersionEdit::Diff(
+    const Version& old_version, const Version& new_version) {
+  VersionEdit edit;
+  std::unordered_set<uint64_t> old_files;
+  for (auto& level : old_version.GetLevels()) {
+    for (auto& run : level.GetRuns()) {
+      for (auto& sst : run->GetSSTs()) {
+        old_files.insert(sst->GetSSTInfo().sst_id_);
+      }
+    }
+  }
+  auto& old_levels = old_version.GetLevels();
+  auto& new_levels = new_version.GetLevels();
+  edit.num_levels_ = new_levels.size();
+  for (size_t i = 0; i < new_levels.size(); i++) {
+    for (auto& run : new_levels[i].GetRuns()) {
+      for (auto& sst : run->GetSSTs()) {
+        // The SSTables moved to another level are not new.
+        if (!old_files.erase(sst->GetSSTInfo().sst_id_)) {
+          edit.new_files_.push_back(sst->GetSSTInfo());
+        }
+      }
+    }
+    auto layout = GetLayout(new_levels[i]);
+    if (i >= old_levels.size() || layout != GetLayout(old_levels[i])) {
+      edit.levels_.emplace_back(i, std::move(layout));
+    }
+  }
+  edit.deleted_files_.assign(old_files.begin(), old_files.end());
+  return edit;
+}
+
+std::string VersionEdit::Encode() const {
+  std::string ret;
+  PutValue<uint64_t>(&ret, last_seq_);
+  PutValue<uint64_t>(&ret, next_file_id_);
+  PutValue<uint64_t>(&ret, min_log_number_);
+  PutValue<uint64_t>(&ret, num_levels_);
+  PutValue<uint64_t>(&ret, new_files_.size());
+  for (auto& info : new_files_) {
+    PutValue<uint64_t>(&ret, info.count_);
+    PutValue<uint64_t>(&ret, info.size_);
+    PutValue<uint64_t>(&ret, info.sst_id_);
+    PutValue<uint64_t>(&ret, info.index_offset_);
+    PutValue<uint64_t>(&ret, info.bloom_filter_offset_);
+    PutValue<uint64_t>(&ret, info.filename_.size());
+    ret.append(info.filename_);
+    PutValue<uint64_t>(&ret, info.tombstone_count_);
+  }
+  PutValue<uint64_t>(&ret, deleted_files_.size());
+  for (auto id : deleted_files_) {
+    PutValue<uint64_t>(&ret, id);
+  }
+  PutValue<uint64_t>(&ret, levels_.size());
+  for (auto& [level, layout] : levels_) {
+    PutValue<uint64_t>(&ret, level);
+    PutValue<uint64_t>(&ret, layout.size());
+    for (auto& run : layout) {
+      PutValue<uint64_t>(&ret, run.size());
+      for (auto id : run) {
+        PutValue<uint64_t>(&ret, id);
+      }
+    }
+  }
+  return ret;
+}
+
+VersionEdit VersionEdit::Decode(Slice payload) {
+  VersionEdit edit;
+  utils::Deserializer d(payload.data());
+  edit.last_seq_ = d.Read<uint64_t>();
+  edit.next_file_id_ = d.Read<uint64_t>();
+  edit.min_log_number_ = d.Read<uint64_t>();
+  edit.num_levels_ = d.Read<uint64_t>();
+  edit.new_files_.resize(d.Read<uint64_t>());
+  for (auto& info : edit.new_files_) {
+    info.count_ = d.Read<uint64_t>();
+    info.size_ = d.Read<uint64_t>();
+    info.sst_id_ = d.Read<uint64_t>();
+    info.index_offset_ = d.Read<uint64_t>();
+    info.bloom_filter_offset_ = d.Read<uint64_t>();
+    auto len = d.Read<uint64_t>();
+    info.filename_ = d.ReadString(len);
+    info.tombstone_count_ = d.Read<uint64_t>();
+  }
+  edit.deleted_files_.resize(d.Read<uint64_t>());
+  for (auto& id : edit.deleted_files_) {
+    id = d.Read<uint64_t>();
+  }
+  edit.levels_.resize(d.Read<uint64_t>());
+  for (auto& [level, layout] : edit.levels_) {
+    level = d.Read<uint64_t>();
+    layout.resize(d.Read<uint64_t>());
+    for (auto& run : layout) {
+      run.resize(d.Read<uint64_t>());
+      for (auto& id : run) {
+        id = d.Read<uint64_t>();
+      }
+    }
+  }
+  if (d.data() != payload.data() + payload.size()) {
+    DB_ERR("The version edit has {} bytes, but {} bytes are read",
+        payload.size(), d.data() - payload.data());
+  }
+  return edit;
+}
+
+void VersionBuilder::Apply(const VersionEdit& edit) {
+  last_seq_ = edit.last_seq_;
+  next_file_id_ = edit.next_file_id_;
+  min_log_number_ = edit.min_log_number_;
+  for (auto& info : edit.new_files_) {
+    files_[info.sst_id_] = info;
+  }
+  for (auto id : edit.deleted_files_) {
+    files_.erase(id);
+  }
+  levels_.resize(edit.num_levels_);
+  for (auto& [level, layout] : edit.levels_) {
+    for (auto& run : layout) {
+      for (auto id : run) {
+        if (!files_.count(id)) {
+          DB_ERR("SSTable {} in level {} is not in the MANIFEST", id, level);
+        }
+      }
+    }
+    levels_[level] = layout;
+  }
+}
+
+ManifestWriter::ManifestWriter(
+    const std::string& db_path, const VersionEdit& snapshot)
+  : filename_(ManifestFileName(db_path)) {
+  auto tmp_file = filename_ + ".tmp";
+  auto flag = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(__MINGW64__)
+  flag |= O_BINARY;
+#endif
+  fd_ = ::open(tmp_file.c_str(), flag, 0644);
+  if (fd_ < 0) {
+    throw DBException("::open file {} error! Error: {}", tmp_file, errno);
+  }
+  AddRecord(snapshot.Encode());
+  snapshot_size_ = size_;
+  // The edits are appended to the file descriptor after it is renamed.
+  std::filesystem::rename(tmp_file, filename_);
+#if !defined(__MINGW64__)
+  // Make the rename durable.
+  int dir_fd = ::open(db_path.c_str(), O_RDONLY);
+  if (dir_fd >= 0) {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+#endif
+}
+
+ManifestWriter::~ManifestWriter() { ::close(fd_); }
+
+void ManifestWriter::AddEdit(const VersionEdit& edit) {
+  AddRecord(edit.Encode());
+}
+
+void ManifestWriter::AddRecord(const std::string& payload) {
+  std::string record;
+  PutValue<uint64_t>(&record,
+      utils::Hash(payload.data(), payload.size(), kManifestChecksumSeed));
+  PutValue<offset_t>(&record, payload.size());
+  record.append(payload);
+  size_t written = 0;
+  while (written < record.size()) {
+    ssize_t ret =
+        ::write(fd_, record.data() + written, record.size() - written);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw DBException("::write Error! Error: {}", errno);
+    }
+    written += ret;
+  }
+  SyncFd(fd_);
+  size_ += record.size();
+}
+
+bool ReadManifest(const std::string& db_path, VersionBuilder* builder) {
+  auto filename = ManifestFileName(db_path);
+  if (!std::filesystem::exists(filename)) {
+    return false;
+  }
+  std::string data(std::filesystem::file_size(filename), 0);
+  if (!data.empty()) {
+    ReadFile(filename, false).Read(data.data(), data.size(), 0);
+  }
+  size_t offset = 0;
+  size_t count = 0;
+  while (offset + kManifestHeaderSize <= data.size()) {
+    auto header = utils::Deserializer(data.data() + offset);
+    auto checksum = header.Read<uint64_t>();
+    auto payload_size = header.Read<offset_t>();
+    if (offset + kManifestHeaderSize + payload_size > data.size() ||
+        utils::Hash(header.data(), payload_size, kManifestChecksumSeed) !=
+            checksum) {
+      break;
+    }
+    builder->Apply(VersionEdit::Decode(Slice(header.data(), payload_size)));
+    offset += kManifestHeaderSize + payload_size;
+    count += 1;
+  }
+  if (count == 0) {
+    DB_ERR("The snapshot in {} is corrupted", filename);
+  }
+  if (offset < data.size()) {
+    DB_INFO("Ignore the torn record at offset {} of {}", offset, filename);
+  }
+  return true;
+}
+
+bool ReadLegacyMetadata(const std::string& db_path, VersionBuilder* builder) {
+  auto filename = db_path + "/metadata";
+  if (!std::filesystem::exists(filename)) {
+    return false;
+  }
+  auto file = std::make_unique<ReadFile>(filename, false);
+  FileReader reader(file.get(), 1 << 20, 0);
+  VersionEdit snapshot;
+  snapshot.last_seq_ = reader.ReadValue<uint64_t>();
+  snapshot.next_file_id_ = reader.ReadValue<uint64_t>();
+  snapshot.min_log_number_ = reader.ReadValue<uint64_t>();
+  snapshot.num_levels_ = reader.ReadValue<uint64_t>();
+  for (uint64_t i = 0; i < snapshot.num_levels_; i++) {
+    auto& [level, layout] = snapshot.levels_.emplace_back();
+    level = reader.ReadValue<uint64_t>();
+    layout.resize(reader.ReadValue<uint64_t>());
+    for (auto& run : layout) {
+      run.resize(reader.ReadValue<uint64_t>());
+      for (auto& id : run) {
+        SSTInfo info;
+        info.count_ = reader.ReadValue<uint64_t>();
+        info.size_ = reader.ReadValue<uint64_t>();
+        info.sst_id_ = reader.ReadValue<uint64_t>();
+        info.index_offset_ = reader.ReadValue<uint64_t>();
+        info.bloom_filter_offset_ = reader.ReadValue<uint64_t>();
+        auto len = reader.ReadValue<uint64_t>();
+        info.filename_ = reader.ReadString(len);
+        info.tombstone_count_ = reader.ReadValue<uint64_t>();
+        id = info.sst_id_;
+        snapshot.new_files_.push_back(std::move(info));
+      }
+    }
+  }
+  builder->Apply(snapshot);
+  return true;
+}
+
+std::string ManifestFileName(const std::string& db_path) {
+  return fmt::format("{}/MANIFEST", db_path);
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+class Version;
+
+/* The sorted runs of a level, each of which is the ids of its SSTables. */
+using LevelLayout = std::vector<std::vector<uint64_t>>;
+
+/**
+ * The change from one version of the tree to the next one. A snapshot is the
+ * edit from the empty tree. The levels which are not changed are not in it,
+ * so that the edit of a flush or a compaction is small.
+ */
+struct VersionEdit {
+  /* The latest sequence number when the edit is made. */
+  uint64_t last_seq_{0};
+  /* The id of the next SSTable. */
+  uint64_t next_file_id_{0};
+  /* The smallest number of the logs whose records are not in the SSTables. */
+  uint64_t min_log_number_{0};
+  /* The number of levels of the new version. */
+  uint64_t num_levels_{0};
+  /* The SSTables that are not in the old version. */
+  std::vector<SSTInfo> new_files_;
+  /* The ids of the SSTables that are not in the new version. */
+  std::vector<uint64_t> deleted_files_;
+  /* The new sorted runs of the levels that are changed or added. */
+  std::vector<std::pair<uint64_t, LevelLayout>> levels_;
+
+  /* The levels and the SSTables of the edit from old_version to new_version. */
+  static VersionEdit Diff(
+      const Version& old_version, const Version& new_version);
+
+  std::string Encode() const;
+
+  static VersionEdit Decode(Slice payload);
+};
+
+/* The tree rebuilt by applying the edits in a MANIFEST in order. */
+struct VersionBuilder {
+  uint64_t last_seq_{0};
+  uint64_t next_file_id_{0};
+  uint64_t min_log_number_{0};
+  /* The live SSTables indexed by their ids. */
+  std::map<uint64_t, SSTInfo> files_;
+  std::vector<LevelLayout> levels_;
+
+  void Apply(const VersionEdit& edit);
+};
+
+/**
+ * The MANIFEST of a DBImpl, which is an append-only log of VersionEdits.
+ * Each record is stored as the records of the write-ahead log:
+ * | checksum (8B) | payload length (4B) | payload |
+ * The first record is a snapshot of the tree, and each of the others is the
+ * edit of a version installed after it. Every record is synced before the
+ * files it removes from the tree are deleted. A torn record at the end of the
+ * file is ignored, so that the tree is recovered as of the last whole edit.
+ *
+ * A new MANIFEST is written to a temporary file, and then replaces the old
+ * one by rename, so that a crash leaves one of them.
+ */
+class ManifestWriter {
+ public:
+  /* Write a new MANIFEST in db_path which starts with the snapshot. */
+  ManifestWriter(const std::string& db_path, const VersionEdit& snapshot);
+
+  ~ManifestWriter();
+
+  ManifestWriter(const ManifestWriter&) = delete;
+  ManifestWriter& operator=(const ManifestWriter&) = delete;
+
+  /* Append an edit and sync it. */
+  void AddEdit(const VersionEdit& edit);
+
+  /* The size of the MANIFEST. */
+  size_t size() const { return size_; }
+
+  /* The size of the snapshot at the beginning of the MANIFEST. */
+  size_t snapshot_size() const { return snapshot_size_; }
+
+ private:
+  void AddRecord(const std::string& payload);
+
+  int fd_;
+  std::string filename_;
+  size_t size_{0};
+  size_t snapshot_size_{0};
+};
+
+/**
+ * Apply the edits of the MANIFEST in db_path to builder.
+ * Return false if there is no MANIFEST.
+ */
+bool ReadManifest(const std::string& db_path, VersionBuilder* builder);
+
+/**
+ * Apply the metadata file in db_path, which is a snapshot of the tree written
+ * by the versions without the MANIFEST. Return false if there is no such file.
+ */
+bool ReadLegacyMetadata(const std::string& db_path, VersionBuilder* builder);
+
+std::string ManifestFileName(const std::string& db_path);
+
+}  // namespace lsm
+
+}  // namespace wing
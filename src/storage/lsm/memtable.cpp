@@ -8,13 +8,18 @@ namespace wing {
 namespace lsm {
 
 void MemTable::Add(ParsedKey key, Slice value) {
+  size_.fetch_add(key.size() + value.size() + sizeof(offset_t) * 2,
+      std::memory_order_relaxed);
+  if (type_ == MemTableType::kSkipList) {
+    list_.Insert(key, value);
+    return;
+  }
   auto ptr = (char *)alloc_.Allocate(key.size() + value.size());
   utils::Serializer(ptr)
       .WriteString(key.user_key_)
       .Write(key.seq_)
       .Write(key.type_)
       .WriteString(value);
-  size_ += key.size() + value.size() + sizeof(offset_t) * 2;
   auto parsed_key =
       ParsedKey(Slice(ptr, key.user_key_.size()), key.seq_, key.type_);
   auto copied_value = Slice(ptr + key.size(), value.size());
@@ -31,24 +36,68 @@ void MemTable::Del(Slice user_key, seq_t seq) {
   Add(ParsedKey(user_key, seq, RecordType::Deletion), Slice());
 }
 
+void MemTable::DelRange(Slice begin, Slice end, seq_t seq) {
+  std::unique_lock<std::shared_mutex> lck(mu_);
+  size_.fetch_add(begin.size() + end.size() + sizeof(seq_t),
+      std::memory_order_relaxed);
+  range_dels_.push_back(
+      RangeTombstone{std::string(begin), std::string(end), seq});
+  range_del_count_.store(range_dels_.size(), std::memory_order_release);
+}
+
+std::vector<RangeTombstone> MemTable::GetRangeTombstones() {
+  if (range_del_count_.load(std::memory_order_acquire) == 0) {
+    return {};
+  }
+  std::shared_lock<std::shared_mutex> lck(mu_);
+  return range_dels_;
+}
+
 void MemTable::Clear() {
   std::unique_lock<std::shared_mutex> lck(mu_);
   table_.clear();
+  list_.Clear();
+  range_dels_.clear();
+  range_del_count_.store(0, std::memory_order_release);
 }
 
 GetResult MemTable::Get(Slice user_key, seq_t seq, std::string *value) {
-  std::shared_lock<std::shared_mutex> lock(mu_);
-  auto it = table_.lower_bound(ParsedKey(user_key, seq, RecordType::Value));
-  if (it == table_.end() || it->first.user_key_ != user_key) {
-    return GetResult::kNotFound;
+  seq_t del_seq = 0;
+  if (range_del_count_.load(std::memory_order_acquire) > 0) {
+    std::shared_lock<std::shared_mutex> lock(mu_);
+    del_seq = MaxCoveringSeq(range_dels_, user_key, seq);
+  }
+  auto not_found = del_seq > 0 ? GetResult::kDelete : GetResult::kNotFound;
+  ParsedKey pkey(user_key, seq, RecordType::Value);
+  const ParsedKey *key;
+  Slice found_value;
+  if (type_ == MemTableType::kSkipList) {
+    auto node = list_.FindGreaterOrEqual(pkey);
+    if (node == nullptr) {
+      return not_found;
+    }
+    key = &node->key_;
+    found_value = node->value_;
   } else {
-    switch (it->first.type_) {
-      case RecordType::Deletion:
-        return GetResult::kDelete;
-      case RecordType::Value:
-        *value = it->second;
-        return GetResult::kFound;
+    std::shared_lock<std::shared_mutex> lock(mu_);
+    auto it = table_.lower_bound(pkey);
+    if (it == table_.end()) {
+      return not_found;
     }
+    key = &it->first;
+    found_value = it->second;
+  }
+  if (key->user_key_ != user_key || key->seq_ < del_seq) {
+    return not_found;
+  }
+  switch (key->type_) {
+    case RecordType::Deletion:
+      return GetResult::kDelete;
+    case RecordType::Value:
+      *value = found_value;
+      return GetResult::kFound;
+    default:
+      break;
   }
   DB_ERR("Incorrect key value!");
 }
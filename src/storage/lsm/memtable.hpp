@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <shared_mutex>
 #include <string>
@@ -9,6 +10,8 @@
 #include "storage/lsm/format.hpp"
 #include "storage/lsm/iterator.hpp"
 #include "storage/lsm/options.hpp"
+#include "storage/lsm/range_del.hpp"
+#include "storage/lsm/skiplist.hpp"
 
 namespace wing {
 
@@ -18,17 +21,31 @@ class MemTableIterator;
 
 class MemTable {
  public:
-  MemTable() : size_(0) {}
+  MemTable(MemTableType type = MemTableType::kSkipList)
+    : type_(type), size_(0), list_(&alloc_) {}
 
   void Put(Slice user_key, seq_t seq, Slice value);
 
   void Del(Slice user_key, seq_t seq);
 
-  /* Find a record with the same key and the largest sequence number <= seq */
+  /* Delete the user keys in [begin, end). See RangeTombstone. */
+  void DelRange(Slice begin, Slice end, seq_t seq);
+
+  /**
+   * Find a record with the same key and the largest sequence number <= seq.
+   * It returns GetResult::kDelete if the key is deleted by a range tombstone
+   * newer than the record.
+   */
   GetResult Get(Slice user_key, seq_t seq, std::string* value);
 
-  size_t size() const { return size_; }
+  /* The range tombstones, which are not returned by the iterators. */
+  std::vector<RangeTombstone> GetRangeTombstones();
+
+  size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+  MemTableType GetType() const { return type_; }
 
+  /* It is only used if the type is MemTableType::kMap */
   std::map<ParsedKey, Slice>& GetTable() { return table_; }
 
   MemTableIterator Seek(Slice user_key, seq_t seq);
@@ -43,17 +60,33 @@ class MemTable {
 
   bool GetFlushComplete() const { return flush_complete_; }
 
+  /* The number of the write-ahead log that stores the records */
+  void SetLogNumber(uint64_t log_number) { log_number_ = log_number; }
+
+  uint64_t GetLogNumber() const { return log_number_; }
+
   void Clear();
 
  private:
   void Add(ParsedKey key, Slice value);
 
+  MemTableType type_;
+  /**
+   * If the type is kMap, it protects table_.
+   * Otherwise, only writers take it.
+   */
   std::shared_mutex mu_;
   std::map<ParsedKey, Slice> table_;
-  uint64_t size_;
+  std::atomic<uint64_t> size_;
   ArenaAllocator alloc_;
+  SkipList list_;
+  /* The range tombstones in the order of writes. They are protected by mu_. */
+  std::vector<RangeTombstone> range_dels_;
+  /* The size of range_dels_, so that Get skips mu_ if there is none. */
+  std::atomic<size_t> range_del_count_{0};
   bool flush_in_progress_{false};
   bool flush_complete_{false};
+  uint64_t log_number_{0};
 
   friend class MemTableIterator;
 };
@@ -63,24 +96,49 @@ class MemTableIterator final : public Iterator {
   MemTableIterator(MemTable* table) : table_(table) {}
 
   void Seek(Slice key, seq_t seq) {
-    it_ = table_->table_.lower_bound(ParsedKey(key, seq, RecordType::Value));
+    ParsedKey pkey(key, seq, RecordType::Value);
+    if (IsSkipList()) {
+      node_ = table_->list_.FindGreaterOrEqual(pkey);
+    } else {
+      it_ = table_->table_.lower_bound(pkey);
+    }
   }
 
-  void SeekToFirst() { it_ = table_->table_.begin(); }
+  void SeekToFirst() {
+    if (IsSkipList()) {
+      node_ = table_->list_.First();
+    } else {
+      it_ = table_->table_.begin();
+    }
+  }
 
-  bool Valid() override { return it_ != table_->table_.end(); }
+  bool Valid() override {
+    return IsSkipList() ? node_ != nullptr : it_ != table_->table_.end();
+  }
 
   Slice key() const override {
-    return Slice(it_->first.user_key_.data(), it_->first.size());
+    const ParsedKey& key = IsSkipList() ? node_->key_ : it_->first;
+    return Slice(key.user_key_.data(), key.size());
   }
 
-  Slice value() const override { return it_->second; }
+  Slice value() const override {
+    return IsSkipList() ? node_->value_ : it_->second;
+  }
 
-  void Next() override { it_++; }
+  void Next() override {
+    if (IsSkipList()) {
+      node_ = node_->Next(0);
+    } else {
+      it_++;
+    }
+  }
 
  private:
+  bool IsSkipList() const { return table_->type_ == MemTableType::kSkipList; }
+
   MemTable* table_;
   std::map<ParsedKey, Slice>::iterator it_;
+  SkipList::Node* node_{nullptr};
 };
 
 }  // namespace lsm
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
 
 #include "storage/lsm/cache.hpp"
 
@@ -8,6 +9,26 @@ namespace wing {
 
 namespace lsm {
 
+class BackgroundScheduler;
+class FilePurger;
+class WriteBufferManager;
+
+enum class WalSyncMode : uint8_t {
+  /* Records are written to the OS, but never synced. */
+  kNone = 0,
+  /* Concurrent writers are grouped and share one sync. */
+  kBatch,
+  /* Every write is synced on its own. */
+  kEveryWrite,
+};
+
+enum class MemTableType : uint8_t {
+  /* A std::map protected by a reader-writer lock. */
+  kMap = 0,
+  /* A skiplist in the arena. Writers are serialized, readers take no lock. */
+  kSkipList,
+};
+
 struct Options {
   /* The directory path of the database */
   std::filesystem::path db_path;
@@ -15,14 +36,34 @@ struct Options {
   uint64_t sst_file_size = 64 * 1024 * 1024;
   /* The target size of data block in SSTable */
   size_t block_size = 4 * 1024;
+  /* The number of records between two restart points in a data block */
+  size_t block_restart_interval = 16;
+  /* The compression type of data blocks */
+  CompressionType compression = CompressionType::kNone;
   /* The size of write buffer */
   size_t write_buffer_size = 1024 * 1024;
   /* Use O_DIRECT or not */
   bool use_direct_io = false;
+  /**
+   * Read SSTables through mmap instead of pread. Uncompressed blocks are read
+   * in place and bypass the block cache. It is ignored if use_direct_io is set.
+   */
+  bool use_mmap_reads = false;
   /* Use bloom filter or not*/
   bool enable_bloom_filter = true;
+  /**
+   * The filter of new SSTables. The type is recorded in each SSTable, so it
+   * can be changed when the database is reopened.
+   */
+  FilterType filter_type = FilterType::kBlockedBloom;
   /* Whether we create a new database in the directory */
   bool create_new = true;
+  /* The data structure of MemTables */
+  MemTableType memtable_type = MemTableType::kSkipList;
+  /* Log writes to the write-ahead log before they enter the MemTable */
+  bool enable_wal = true;
+  /* When the write-ahead log is synced to disk */
+  WalSyncMode wal_sync_mode = WalSyncMode::kNone;
   /* The maximum number of immutable MemTables. */
   size_t max_immutable_count = 4;
   /* The name of compaction strategy. */
@@ -34,15 +75,95 @@ struct Options {
    * It stops writes when the number of sorted runs reaches this limit.
    */
   size_t level0_stop_writes_trigger = 20;
+  /**
+   * It slows down writes when the number of sorted runs in Level 0 reaches
+   * this limit, or there is at most one free slot for immutable MemTables.
+   */
+  size_t level0_slowdown_writes_trigger = 12;
+  /* The rate of writes in bytes per second when writes are slowed down. */
+  size_t delayed_write_rate = 64 << 20;
+  /**
+   * The maximum number of key ranges a compaction is split into. The ranges
+   * are merged in parallel. 1 disables subcompactions.
+   */
+  size_t max_subcompactions = 1;
+  /**
+   * The number of compaction threads. Compactions on disjoint levels, e.g.,
+   * L0 -> L1 and L3 -> L4, run at the same time, so that a long compaction
+   * in the bottom levels does not block the compactions of Level 0.
+   */
+  size_t max_background_compactions = 1;
+  /* The number of flush threads of a scheduler created for the options. */
+  size_t max_background_flushes = 1;
   /* The default size ratio used in tiering/leveling compaction strategy. */
   size_t compaction_size_ratio = 10;
+  /**
+   * The level above the bottom level (or the bottom level itself) is
+   * compacted even if it is not full, if the number of deletion records and
+   * range tombstones of one of its SSTables reaches this ratio of its
+   * records, so that the tombstones are dropped at the bottom level.
+   * 0 disables it.
+   */
+  double tombstone_compaction_ratio = 0.5;
+  /**
+   * An insert batch of LSMStorage of at least this many bytes is written to
+   * SSTables directly by BulkLoader. 0 disables it.
+   */
+  size_t bulk_load_min_size = 4 * 1024 * 1024;
   /* The number of bits per key in bloom filter, by default */
   size_t bloom_bits_per_key = 10;
+  /**
+   * Give the bloom filters of each level a different number of bits per key,
+   * so that zero-result lookups read fewer blocks. The filters of all levels
+   * take about bloom_bits_per_key bits per key in total. See MonkeyBitsPerKey
+   * in lsm/version.hpp.
+   */
+  bool monkey_filter_allocation = false;
   /* The target scan length in part3 */
   double target_scan_length_part3 = 0;
   /* The target alpha in part3 */
   double target_alpha_part3 = 0;
+  /**
+   * The MANIFEST is rewritten with a snapshot of the tree when it is larger
+   * than this and twice the snapshot, so that it is read fast on restart.
+   */
+  size_t max_manifest_file_size = 4 * 1024 * 1024;
   CacheOptions cache{};
+  /**
+   * The block cache. If it is null, a cache is created from the cache
+   * options. A cache can be shared by many DBImpls, e.g., the tables of
+   * LSMStorage, so that the memory of blocks is bounded per process.
+   */
+  std::shared_ptr<Cache> block_cache;
+  /**
+   * It runs the flushes and the compactions. If it is null, a scheduler with
+   * max_background_flushes and max_background_compactions threads is created.
+   * A scheduler can be shared by many DBImpls, and then
+   * max_background_compactions only bounds the compactions of each DBImpl.
+   */
+  std::shared_ptr<BackgroundScheduler> scheduler;
+  /**
+   * It bounds the total size of the MemTables of the DBImpls sharing it.
+   * If it is null, only the size of each MemTable is bounded by sst_file_size.
+   */
+  std::shared_ptr<WriteBufferManager> write_buffer_manager;
+  /**
+   * It deletes the files of the obsolete SSTables in the background. If it is
+   * null, a purger limited by delete_rate_bytes_per_sec is created. A purger
+   * can be shared by many DBImpls.
+   */
+  std::shared_ptr<FilePurger> file_purger;
+  /**
+   * The rate of deleting obsolete SSTables in bytes per second, so that a
+   * burst of unlinks after a large compaction does not stall the reads and
+   * the writes. 0 disables it.
+   */
+  size_t delete_rate_bytes_per_sec = 256 * 1024 * 1024;
+  /**
+   * The budget of the write buffer manager created by LSMStorage for all its
+   * tables. 0 disables it.
+   */
+  size_t db_write_buffer_size = 256 * 1024 * 1024;
 };
 
 }  // namespace lsm
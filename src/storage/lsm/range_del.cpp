@@ -0,0 +1,107 @@
+#include "storage/lsm/range_del.hpp"
+
+#include <algorithm>
+#include <set>
+
+namespace wing {
+
+namespace lsm {
+
+seq_t MaxCoveringSeq(
+    std::span<const RangeTombstone> tombstones, Slice user_key, seq_t seq) {
+  seq_t ret = 0;
+  for (auto& t : tombstones) {
+    if (t.seq_ <= seq && t.seq_ > ret && t.begin_ <= user_key &&
+        user_key < t.end_) {
+      ret = t.seq_;
+    }
+  }
+  return ret;
+}
+
+std::vector<RangeTombstone> ClipRangeTombstones(
+    std::span<const RangeTombstone> tombstones, Slice begin,
+    std::optional<Slice> end) {
+  std::vector<RangeTombstone> ret;
+  for (auto& t : tombstones) {
+    auto clipped_begin = std::max<Slice>(t.begin_, begin);
+    auto clipped_end = end ? std::min<Slice>(t.end_, *end) : Slice(t.end_);
+    if (clipped_begin < clipped_end) {
+      ret.push_back(RangeTombstone{
+          std::string(clipped_begin), std::string(clipped_end), t.seq_});
+    }
+  }
+  std::sort(ret.begin(), ret.end(),
+      [](const RangeTombstone& a, const RangeTombstone& b) {
+        return a.begin_ < b.begin_;
+      });
+  return ret;
+}
+
+InternalKey RangeTombstoneLargestKey(Slice end) {
+  if (!end.empty() && end.back() == '\0') {
+    return InternalKey(
+        end.substr(0, end.size() - 1), 0, RecordType::RangeDeletion);
+  }
+  return InternalKey(
+      end, std::numeric_limits<seq_t>::max(), RecordType::RangeDeletion);
+}
+
+void RangeDelAggregator::Add(
+    std::span<const RangeTombstone> tombstones, seq_t seq) {
+  for (auto& t : tombstones) {
+    if (t.seq_ <= seq) {
+      tombstones_.push_back(t);
+      max_seq_ = std::max(max_seq_, t.seq_);
+    }
+  }
+}
+
+void RangeDelAggregator::Build() {
+  starts_.clear();
+  seqs_.clear();
+  if (tombstones_.empty()) {
+    return;
+  }
+  std::vector<std::pair<Slice, seq_t>> begins, ends;
+  std::vector<Slice> keys;
+  for (auto& t : tombstones_) {
+    begins.emplace_back(t.begin_, t.seq_);
+    ends.emplace_back(t.end_, t.seq_);
+    keys.push_back(t.begin_);
+    keys.push_back(t.end_);
+  }
+  std::sort(begins.begin(), begins.end());
+  std::sort(ends.begin(), ends.end());
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  // Sweep the boundaries with the tombstones covering the current fragment.
+  std::multiset<seq_t> active;
+  size_t b = 0, e = 0;
+  for (auto key : keys) {
+    for (; e < ends.size() && ends[e].first == key; e++) {
+      active.erase(active.find(ends[e].second));
+    }
+    for (; b < begins.size() && begins[b].first == key; b++) {
+      active.insert(begins[b].second);
+    }
+    seq_t seq = active.empty() ? 0 : *active.rbegin();
+    if (seqs_.empty() || seqs_.back() != seq) {
+      starts_.emplace_back(key);
+      seqs_.push_back(seq);
+    }
+  }
+}
+
+seq_t RangeDelAggregator::MaxCoveringSeq(Slice user_key) const {
+  auto it = std::upper_bound(starts_.begin(), starts_.end(), user_key,
+      [](Slice key, const std::string& start) { return key < start; });
+  if (it == starts_.begin()) {
+    return 0;
+  }
+  return seqs_[it - starts_.begin() - 1];
+}
+
+}  // namespace lsm
+
+}  // namespace wing
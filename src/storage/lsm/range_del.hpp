@@ -0,0 +1,90 @@
+#pragma once
+
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "storage/lsm/common.hpp"
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * A range tombstone. It deletes the records whose user keys are in
+ * [begin_, end_) and whose sequence numbers are smaller than seq_.
+ */
+struct RangeTombstone {
+  std::string begin_;
+  std::string end_;
+  seq_t seq_;
+};
+
+/**
+ * The largest sequence number <= seq of the tombstones that cover user_key.
+ * It is 0 if there is none, which is smaller than every sequence number.
+ */
+seq_t MaxCoveringSeq(
+    std::span<const RangeTombstone> tombstones, Slice user_key, seq_t seq);
+
+/**
+ * The parts of the tombstones inside [begin, end), sorted by begin_.
+ * If end is not given, the range is unbounded.
+ */
+std::vector<RangeTombstone> ClipRangeTombstones(
+    std::span<const RangeTombstone> tombstones, Slice begin,
+    std::optional<Slice> end);
+
+/**
+ * The largest internal key covered by a tombstone ending at end, which is the
+ * largest key of an SSTable storing it. If end is the successor of a user
+ * key u, i.e. u + '\0', it is the last record of u, so that the SSTables of a
+ * sorted run still have different user keys at their boundaries.
+ */
+InternalKey RangeTombstoneLargestKey(Slice end);
+
+/**
+ * The tombstones of many MemTables and SSTables, cut into fragments that do
+ * not overlap. Each fragment keeps the largest sequence number of the
+ * tombstones covering it, so a key is looked up by binary search. It is used by
+ * the iterators and the compactions, which check the keys in order.
+ */
+class RangeDelAggregator {
+ public:
+  RangeDelAggregator() = default;
+
+  /* Only the tombstones whose sequence numbers <= seq are visible. */
+  void Add(std::span<const RangeTombstone> tombstones,
+      seq_t seq = std::numeric_limits<seq_t>::max());
+
+  /* Cut the added tombstones into fragments. */
+  void Build();
+
+  /* It is equivalent to MaxCoveringSeq of the added tombstones. */
+  seq_t MaxCoveringSeq(Slice user_key) const;
+
+  /* Whether the record is deleted by a newer tombstone. */
+  bool ShouldDelete(ParsedKey key) const {
+    return !starts_.empty() && MaxCoveringSeq(key.user_key_) > key.seq_;
+  }
+
+  bool empty() const { return tombstones_.empty(); }
+
+  /* The largest sequence number of the added tombstones, or 0. */
+  seq_t max_seq() const { return max_seq_; }
+
+ private:
+  std::vector<RangeTombstone> tombstones_;
+  seq_t max_seq_{0};
+  /* Fragment i is [starts_[i], starts_[i + 1]). The last one is unbounded. */
+  std::vector<std::string> starts_;
+  /* The largest sequence number of each fragment. It is 0 in the gaps. */
+  std::vector<seq_t> seqs_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+
+#include "common/threadpool.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * The background threads of the DBImpls sharing it. A job is one flush or one
+ * compaction of a DBImpl, and the DBImpl schedules the next job when it
+ * finishes, so that the DBImpls take turns. Flushes and compactions run in
+ * separate pools, so that the flushes, which unblock the writes, do not wait
+ * for long compactions.
+ */
+class BackgroundScheduler {
+ public:
+  BackgroundScheduler(size_t flush_threads, size_t compaction_threads)
+    : flush_pool_(std::max<size_t>(flush_threads, 1)),
+      compaction_pool_(std::max<size_t>(compaction_threads, 1)) {}
+
+  void ScheduleFlush(std::function<void()> &&job) {
+    flush_pool_.Push(std::move(job));
+  }
+
+  void ScheduleCompaction(std::function<void()> &&job) {
+    compaction_pool_.Push(std::move(job));
+  }
+
+ private:
+  ThreadPool flush_pool_;
+  ThreadPool compaction_pool_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
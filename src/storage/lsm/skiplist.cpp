@@ -0,0 +1,108 @@
+#include "storage/lsm/skiplist.hpp"
+
+#include <new>
+
+#include "common/serializer.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+SkipList::SkipList(ArenaAllocator* alloc) : alloc_(alloc) {
+  head_ = NewNode(ParsedKey(), Slice(), kMaxHeight);
+}
+
+SkipList::Node* SkipList::NewNode(ParsedKey key, Slice value, int height) {
+  auto node_size = sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1);
+  auto ptr = reinterpret_cast<char*>(alloc_->AllocateAligned(
+      node_size + key.size() + value.size(), alignof(Node)));
+  auto data = ptr + node_size;
+  utils::Serializer(data)
+      .WriteString(key.user_key_)
+      .Write(key.seq_)
+      .Write(key.type_)
+      .WriteString(value);
+  auto node = new (ptr)
+      Node{ParsedKey(Slice(data, key.user_key_.size()), key.seq_, key.type_),
+          Slice(data + key.size(), value.size()), {}};
+  for (int i = 0; i < height; i++) {
+    new (&node->next_[i]) std::atomic<Node*>(nullptr);
+  }
+  return node;
+}
+
+int SkipList::RandomHeight() {
+  int height = 1;
+  while (height < kMaxHeight) {
+    // xorshift32
+    rnd_ ^= rnd_ << 13;
+    rnd_ ^= rnd_ >> 17;
+    rnd_ ^= rnd_ << 5;
+    if (rnd_ % kBranching != 0) {
+      break;
+    }
+    height += 1;
+  }
+  return height;
+}
+
+SkipList::Node* SkipList::FindGreaterOrEqual(
+    const ParsedKey& key, Node** prev) const {
+  Node* x = head_;
+  int level = GetMaxHeight() - 1;
+  /* The node which is known to be >= key. Do not compare with it again. */
+  Node* last_bigger = nullptr;
+  while (true) {
+    Node* next = x->Next(level);
+    if (next != nullptr && next != last_bigger && next->key_ < key) {
+      x = next;
+    } else {
+      last_bigger = next;
+      if (prev != nullptr) {
+        prev[level] = x;
+      }
+      if (level == 0) {
+        return next;
+      }
+      level -= 1;
+    }
+  }
+}
+
+SkipList::Node* SkipList::FindGreaterOrEqual(const ParsedKey& key) const {
+  return FindGreaterOrEqual(key, nullptr);
+}
+
+bool SkipList::Insert(ParsedKey key, Slice value) {
+  Node* prev[kMaxHeight];
+  Node* x = FindGreaterOrEqual(key, prev);
+  if (x != nullptr && (x->key_ <=> key) == 0) {
+    return false;
+  }
+  int height = RandomHeight();
+  if (height > GetMaxHeight()) {
+    for (int i = GetMaxHeight(); i < height; i++) {
+      prev[i] = head_;
+    }
+    // A reader that sees the new height but not the new node finds nullptr
+    // in the head of the new levels, and simply goes down.
+    max_height_.store(height, std::memory_order_relaxed);
+  }
+  x = NewNode(key, value, height);
+  for (int i = 0; i < height; i++) {
+    x->next_[i].store(prev[i]->NoBarrierNext(i), std::memory_order_relaxed);
+    prev[i]->SetNext(i, x);
+  }
+  return true;
+}
+
+void SkipList::Clear() {
+  for (int i = 0; i < kMaxHeight; i++) {
+    head_->SetNext(i, nullptr);
+  }
+  max_height_.store(1, std::memory_order_relaxed);
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "common/allocator.hpp"
+#include "storage/lsm/common.hpp"
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * A skiplist whose nodes are allocated in an arena.
+ *
+ * Insert must be serialized by the caller, but readers (FindGreaterOrEqual,
+ * First and the traversal of nodes) do not take any lock and can run
+ * concurrently with the writer. A node is published by a release store of
+ * the next pointer of its predecessor, after the node is fully initialized,
+ * so a reader that observes the node also observes its content. Nodes are
+ * never removed.
+ */
+class SkipList {
+ public:
+  struct Node {
+    ParsedKey key_;
+    Slice value_;
+
+    Node* Next(int level) const {
+      return next_[level].load(std::memory_order_acquire);
+    }
+
+    void SetNext(int level, Node* node) {
+      next_[level].store(node, std::memory_order_release);
+    }
+
+    /* It is only used by the writer, which is the only one to modify it. */
+    Node* NoBarrierNext(int level) const {
+      return next_[level].load(std::memory_order_relaxed);
+    }
+
+    /* The node has (height) pointers, which are allocated with the node. */
+    std::atomic<Node*> next_[1];
+  };
+
+  SkipList(ArenaAllocator* alloc);
+
+  SkipList(const SkipList&) = delete;
+  SkipList& operator=(const SkipList&) = delete;
+
+  /**
+   * Insert a record. The record is copied into the node, right after its
+   * pointers, so that a comparison in the search touches only one node.
+   * Return false if there is a record with the same key and sequence number.
+   * REQUIRES: No concurrent Insert.
+   */
+  bool Insert(ParsedKey key, Slice value);
+
+  /* Return the first node >= key, or nullptr if there is no such node. */
+  Node* FindGreaterOrEqual(const ParsedKey& key) const;
+
+  /* Return the first node, or nullptr if the skiplist is empty. */
+  Node* First() const { return head_->Next(0); }
+
+  /**
+   * Remove all the nodes. The memory is not freed.
+   * REQUIRES: No concurrent readers or writers.
+   */
+  void Clear();
+
+ private:
+  static constexpr int kMaxHeight = 12;
+  /* The probability that a node has height h + 1 is 1 / kBranching of h */
+  static constexpr uint32_t kBranching = 4;
+
+  Node* NewNode(ParsedKey key, Slice value, int height);
+
+  int RandomHeight();
+
+  int GetMaxHeight() const {
+    return max_height_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Return the first node >= key, and store the last node < key of every
+   * level in prev.
+   */
+  Node* FindGreaterOrEqual(const ParsedKey& key, Node** prev) const;
+
+  ArenaAllocator* alloc_;
+  Node* head_;
+  /* The height of the highest node. */
+  std::atomic<int> max_height_{1};
+  /* The state of the random number generator. It is used by the writer. */
+  uint32_t rnd_{0x20240405};
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -5,17 +5,68 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
 
 #include "common/bloomfilter.hpp"
+#include "common/xorfilter.hpp"
+#include "common/threadpool.hpp"
+#include "storage/lsm/stats.hpp"
 
 namespace wing {
 
 namespace lsm {
 
-SSTable::SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io)
-  : sst_info_(std::move(sst_info)), block_size_(block_size) {
-  file_ = std::make_unique<ReadFile>(sst_info_.filename_, use_direct_io);
+namespace {
+
+/* Index partitions are searched by binary search on every key. */
+constexpr size_t kIndexBlockRestartInterval = 1;
+
+/* The size of the range read ahead by scans on a mapped file. */
+constexpr size_t kMmapReadaheadSize = 256 * 1024;
+
+/**
+ * A scan starts to read blocks ahead after it loads kReadaheadTrigger blocks
+ * one after another, so point lookups and short scans never read ahead. Then
+ * the number of blocks read ahead doubles every time, up to
+ * kMaxReadaheadBlocks.
+ */
+constexpr size_t kReadaheadTrigger = 8;
+constexpr size_t kInitialReadaheadBlocks = 2;
+constexpr size_t kMaxReadaheadBlocks = 32;
+constexpr size_t kReadaheadThreads = 4;
+
+ThreadPool* GetReadaheadPool() {
+  static ThreadPool pool(kReadaheadThreads);
+  return &pool;
+}
+
+/**
+ * The index partitions are shared by many data blocks, so they are always
+ * cached with high priority. Compactions and scans do not promote the blocks
+ * they hit.
+ */
+CachePriority BlockPriority(CacheFill fill_cache, bool index_partition) {
+  return fill_cache == CacheFill::kHighPriority || index_partition
+             ? CachePriority::kHigh
+             : CachePriority::kLow;
+}
+
+}  // namespace
+
+SSTable::SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io,
+    Cache* cache, bool use_mmap, FilePurger* purger)
+  : sst_info_(std::move(sst_info)),
+    block_size_(block_size),
+    purger_(purger),
+    cache_(cache),
+    cache_id_(cache ? cache->NewId() : 0) {
+  file_ = std::make_unique<ReadFile>(
+      sst_info_.filename_, use_direct_io, use_mmap);
+  if (file_->use_mmap()) {
+    // Most reads are point lookups. Scans ask for read-ahead explicitly.
+    file_->Advise(0, sst_info_.size_, ReadAdvice::kRandom);
+  }
   FileReader reader(file_.get(), block_size, 0u);
   // Get Index Value;
   auto index_offset = sst_info_.index_offset_;
@@ -36,60 +87,315 @@ SSTable::SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io)
   smallest_key_ = reader.ReadString(skey_len);
   auto lkey_len = reader.ReadValue<size_t>();
   largest_key_ = reader.ReadString(lkey_len);
+  // Footer. The SSTables in kLegacyFormatVersion do not have it.
+  auto footer_offset = sst_info_.bloom_filter_offset_ + filter_len +
+                       skey_len + lkey_len + sizeof(size_t) * 3;
+  constexpr size_t kFooterSize = sizeof(uint32_t) + sizeof(uint64_t);
+  if (footer_offset + kFooterSize <= sst_info_.size_) {
+    // The footer is at the end of the file, after the range tombstones.
+    reader.Seek(sst_info_.size_ - kFooterSize);
+    format_version_ = reader.ReadValue<uint32_t>();
+    auto magic = reader.ReadValue<uint64_t>();
+    if (magic != kSSTableMagic || format_version_ > kLatestFormatVersion) {
+      DB_ERR("Invalid SSTable footer in {}", sst_info_.filename_);
+    }
+  }
+  if (format_version_ >= kRangeDelFormatVersion) {
+    reader.Seek(footer_offset);
+    auto count = reader.ReadValue<size_t>();
+    for (size_t i = 0; i < count; i++) {
+      RangeTombstone tombstone;
+      tombstone.begin_ = reader.ReadString(reader.ReadValue<size_t>());
+      tombstone.end_ = reader.ReadString(reader.ReadValue<size_t>());
+      tombstone.seq_ = reader.ReadValue<seq_t>();
+      range_dels_.push_back(std::move(tombstone));
+    }
+  }
+  if (format_version_ >= kFilterTypeFormatVersion) {
+    if (bloom_filter_.empty() ||
+        uint8_t(bloom_filter_[0]) > uint8_t(FilterType::kXor)) {
+      DB_ERR("Invalid filter type in {}", sst_info_.filename_);
+    }
+    filter_type_ = static_cast<FilterType>(bloom_filter_[0]);
+    bloom_filter_.erase(0, sizeof(FilterType));
+  } else if (format_version_ >= kBlockedBloomFormatVersion) {
+    filter_type_ = FilterType::kBlockedBloom;
+  }
+  if (format_version_ >= kPartitionedIndexFormatVersion) {
+    if (cache_) {
+      index_partitioned_ = true;
+    } else {
+      FlattenIndex();
+    }
+  }
 }
 
 SSTable::~SSTable() {
+  {
+    std::unique_lock lck(prefetch_mutex_);
+    prefetch_cv_.wait(lck, [&]() { return pending_prefetches_ == 0; });
+  }
   if (remove_tag_) {
     file_.reset();
-    std::filesystem::remove(sst_info_.filename_);
+    if (purger_) {
+      purger_->Schedule(sst_info_.filename_, sst_info_.size_);
+    } else {
+      std::filesystem::remove(sst_info_.filename_);
+    }
   }
 }
 
-GetResult SSTable::Get(Slice key, uint64_t seq, std::string* value) {
-  if(!utils::BloomFilter::Find(key, bloom_filter_)){
-    return GetResult::kNotFound;
+void SSTable::FlattenIndex() {
+  std::vector<IndexValue> index;
+  AlignedBuffer buf;
+  std::string uncompressed_buf;
+  for (auto& partition : index_) {
+    auto handle = partition.block_;
+    auto block = ReadBlock(
+        handle, nullptr, &buf, &uncompressed_buf, CacheFill::kNone, true);
+    handle.size_ = block.size();
+    for (BlockIterator it(block.data(), handle, format_version_); it.Valid();
+         it.Next()) {
+      BlockHandle data_block;
+      memcpy(&data_block, it.value().data(), sizeof(BlockHandle));
+      index.push_back(IndexValue{InternalKey(it.key()), data_block});
+    }
   }
-  /*
-  if(key < smallest_key_.user_key() 
-    || (key == smallest_key_.user_key() && seq > smallest_key_.seq())){
-    return GetResult::kNotFound;
+  index_ = std::move(index);
+}
+
+GetResult SSTable::Get(
+    Slice key, uint64_t seq, std::string* value, int level) {
+  // The tombstones are checked first. They may cover the key even if the
+  // records of the key are not visible.
+  auto del_seq = RangeDelSeq(key, seq);
+  auto not_found = del_seq > 0 ? GetResult::kDelete : GetResult::kNotFound;
+  // The key range is checked before the bloom filter, which hashes the key.
+  // A record (key, s) with s <= seq is visible even if (key, seq) is smaller
+  // than the smallest key, so only the user key is compared with it.
+  if(key < smallest_key_.user_key()
+    || ParsedKey(key, seq, RecordType::Value) > GetLargestKey()){
+    return not_found;
   }
-  if(key > largest_key_.user_key() 
-    || (key == largest_key_.user_key() && seq < largest_key_.seq())){
-    return GetResult::kNotFound;
+  if(!MayContain(utils::BloomFilter::BloomHash(key))){
+    GetStatsContext()->RecordFilter(level, false);
+    return not_found;
   }
-  */
   auto it = Seek(key, seq);
   if(it.Valid()){
     auto find_key = ParsedKey(it.key());
     if(find_key.user_key_ == key && find_key.seq_ <= seq){
-      if(find_key.type_ == RecordType::Deletion){
+      if(find_key.type_ == RecordType::Deletion || find_key.seq_ < del_seq){
         return GetResult::kDelete;
       }
       *value = it.value();
       return GetResult::kFound;
     }
   }
-  return GetResult::kNotFound;
+  GetStatsContext()->RecordFilter(level, true);
+  return not_found;
 }
 
-SSTableIterator SSTable::Seek(Slice key, uint64_t seq) {
+bool SSTable::MayContain(size_t hash) const {
+  switch (filter_type_) {
+    case FilterType::kBlockedBloom:
+      return utils::BlockedBloomFilter::Find(hash, bloom_filter_);
+    case FilterType::kXor:
+      return utils::XorFilter::Find(hash, bloom_filter_);
+    default:
+      return utils::BloomFilter::Find(hash, bloom_filter_);
+  }
+}
+
+void SSTable::MultiGet(
+    std::span<MultiGetEntry* const> entries, uint64_t seq, int level) {
+  std::vector<MultiGetEntry*> candidates;
+  // The sequence numbers of the tombstones covering the candidates.
+  std::vector<seq_t> del_seqs;
+  for (auto entry : entries) {
+    auto del_seq = RangeDelSeq(entry->key_, seq);
+    if (MayContain(entry->hash_)) {
+      candidates.push_back(entry);
+      del_seqs.push_back(del_seq);
+      continue;
+    }
+    GetStatsContext()->RecordFilter(level, false);
+    if (del_seq > 0) {
+      entry->result_ = GetResult::kDelete;
+    }
+  }
+  if (candidates.empty()) {
+    return;
+  }
   SSTableIterator it(this);
+  // The keys are sorted, so the blocks are found in the order of offsets.
+  std::vector<BlockHandle> handles;
+  for (auto entry : candidates) {
+    if (!it.SeekIndex(entry->key_, seq)) {
+      break;
+    }
+    auto handle = it.CurrentHandle();
+    if (handles.empty() || handles.back().offset_ != handle.offset_) {
+      handles.push_back(handle);
+    }
+  }
+  if (handles.size() > 1) {
+    it.PrefetchBlocks(handles);
+  }
+  for (size_t i = 0; i < candidates.size(); i++) {
+    auto entry = candidates[i];
+    auto del_seq = del_seqs[i];
+    it.Seek(entry->key_, seq);
+    auto find_key = it.Valid() ? ParsedKey(it.key()) : ParsedKey();
+    if (it.Valid() && find_key.user_key_ == entry->key_ &&
+        find_key.seq_ <= seq) {
+      if (find_key.type_ == RecordType::Deletion || find_key.seq_ < del_seq) {
+        entry->result_ = GetResult::kDelete;
+      } else {
+        *entry->value_ = it.value();
+        entry->result_ = GetResult::kFound;
+      }
+      continue;
+    }
+    GetStatsContext()->RecordFilter(level, true);
+    if (del_seq > 0) {
+      entry->result_ = GetResult::kDelete;
+    }
+  }
+}
+
+Slice SSTable::ReadBlock(BlockHandle block,
+    std::optional<Cache::Handle>* cache_handle, AlignedBuffer* buf,
+    std::string* uncompressed_buf, CacheFill fill_cache,
+    bool index_partition) {
+  auto read_to_buf = [&]() {
+    Slice stored;
+    if (file_->use_mmap()) {
+      stored =
+          Slice(file_->ReadInPlace(block.size_, block.offset_), block.size_);
+    } else {
+      if (buf->size() < block.size_) {
+        *buf = AlignedBuffer(std::max<size_t>(block_size_, block.size_), 4096);
+      }
+      file_->Read(buf->data(), block.size_, block.offset_);
+      stored = Slice(buf->data(), block.size_);
+    }
+    if (format_version_ < kChecksumFormatVersion) {
+      return stored;
+    }
+    return DecodeBlock(stored, uncompressed_buf);
+  };
+  // The page cache already caches the mapped blocks, so the block cache only
+  // saves the decompression.
+  if (!cache_ || (file_->use_mmap() && !IsMappedBlockCompressed(block))) {
+    return read_to_buf();
+  }
+  if (PinCachedBlock(block, cache_handle, fill_cache, index_partition)) {
+    return (*cache_handle)->block();
+  }
+  (index_partition ? index_cache_miss_ : cache_miss_)
+      .fetch_add(1, std::memory_order_relaxed);
+  GetStatsContext()->block_cache_miss.fetch_add(1, std::memory_order_relaxed);
+  if (fill_cache == CacheFill::kNone) {
+    return read_to_buf();
+  }
+  std::string content;
+  if (file_->use_direct_io() || file_->use_mmap() ||
+      format_version_ >= kChecksumFormatVersion) {
+    // O_DIRECT requires an aligned destination.
+    auto data = read_to_buf();
+    if (data.data() == uncompressed_buf->data()) {
+      content = std::move(*uncompressed_buf);
+    } else {
+      content = data;
+    }
+  } else {
+    content.resize(block.size_);
+    file_->Read(content.data(), block.size_, block.offset_);
+  }
+  *cache_handle = cache_->insert(cache_id_, block, std::move(content),
+      BlockPriority(fill_cache, index_partition));
+  return (*cache_handle)->block();
+}
+
+bool SSTable::PinCachedBlock(BlockHandle block,
+    std::optional<Cache::Handle>* cache_handle, CacheFill fill_cache,
+    bool index_partition) {
+  auto handle =
+      cache_->get(cache_id_, block, BlockPriority(fill_cache, index_partition));
+  if (!handle) {
+    return false;
+  }
+  (index_partition ? index_cache_hit_ : cache_hit_)
+      .fetch_add(1, std::memory_order_relaxed);
+  GetStatsContext()->block_cache_hit.fetch_add(1, std::memory_order_relaxed);
+  *cache_handle = std::move(handle);
+  return true;
+}
+
+void SSTable::StartPrefetch() {
+  std::unique_lock lck(prefetch_mutex_);
+  pending_prefetches_ += 1;
+}
+
+void SSTable::FinishPrefetch() {
+  // The destructor may return as soon as the lock is released.
+  std::unique_lock lck(prefetch_mutex_);
+  pending_prefetches_ -= 1;
+  prefetch_cv_.notify_all();
+}
+
+bool SSTable::IsMappedBlockCompressed(BlockHandle block) const {
+  if (format_version_ < kChecksumFormatVersion ||
+      block.size_ < kBlockTrailerSize) {
+    return false;
+  }
+  auto type = static_cast<CompressionType>(
+      file_->mapped_data()[block.offset_ + block.size_ - kBlockTrailerSize]);
+  return type != CompressionType::kNone;
+}
+
+SSTableIterator SSTable::Seek(
+    Slice key, uint64_t seq, CacheFill fill_cache) {
+  SSTableIterator it(this, fill_cache);
   it.Seek(key, seq);
   return it;
 }
 
-SSTableIterator SSTable::Begin() {
-  SSTableIterator it(this);
+SSTableIterator SSTable::Begin(CacheFill fill_cache) {
+  SSTableIterator it(this, fill_cache);
   it.SeekToFirst();
   return it;
 }
 
+std::shared_ptr<PrefetchedBlock> ReadaheadQueue::Pop(offset_t offset) {
+  if (blocks_.empty()) {
+    return nullptr;
+  }
+  if (blocks_.front()->handle_.offset_ != offset) {
+    Clear();
+    return nullptr;
+  }
+  auto block = std::move(blocks_.front());
+  blocks_.pop_front();
+  // It rethrows the exception of the read, if any.
+  block->done_.get();
+  return block;
+}
+
 void SSTableIterator::Seek(Slice key, uint64_t seq) {
+  if (!SeekIndex(key, seq)) {
+    return;
+  }
+  LoadBlock();
+  block_it_.Seek(key, seq);
+}
+
+bool SSTableIterator::SeekIndex(Slice key, uint64_t seq) {
   ParsedKey pkey(key, seq, RecordType::Value);
-  if(pkey > sst_->GetLargestKey()){
+  if(sst_->index_.empty() || pkey > sst_->GetLargestKey()){
     block_id_ = sst_->index_.size();
-    return;
+    return false;
   }
   size_t lr = 0, rr = sst_->index_.size() - 1;
   while(lr < rr){
@@ -102,17 +408,180 @@ void SSTableIterator::Seek(Slice key, uint64_t seq) {
     }
   }
   block_id_ = lr;
-  BlockHandle handle = sst_->index_[block_id_].block_;
-  sst_->file_.get()->Read(buf_.data(), handle.size_, handle.offset_);
-  block_it_ = BlockIterator(buf_.data(), handle);
-  block_it_.Seek(key, seq);
+  if (sst_->IsIndexPartitioned()) {
+    // The largest key of the partition is >= pkey, so index_it_ is valid.
+    LoadPartition();
+    index_it_.Seek(key, seq);
+  }
+  return true;
+}
+
+BlockHandle SSTableIterator::CurrentHandle() const {
+  if (!sst_->IsIndexPartitioned()) {
+    return sst_->index_[block_id_].block_;
+  }
+  BlockHandle handle;
+  memcpy(&handle, index_it_.value().data(), sizeof(BlockHandle));
+  return handle;
 }
 
 void SSTableIterator::SeekToFirst() {
   block_id_ = 0u;
+  if (sst_->index_.empty()) {
+    // The SSTable only has range tombstones.
+    return;
+  }
+  if (sst_->IsIndexPartitioned()) {
+    LoadPartition();
+  }
+  LoadBlock(true);
+}
+
+void SSTableIterator::LoadPartition() {
+  if (loaded_partition_ == block_id_) {
+    index_it_.SeekToFirst();
+    return;
+  }
   BlockHandle handle = sst_->index_[block_id_].block_;
-  sst_->file_.get()->Read(buf_.data(), handle.size_, handle.offset_);
-  block_it_ = BlockIterator(buf_.data(), handle);
+  index_cache_handle_.reset();
+  auto block = sst_->ReadBlock(handle, &index_cache_handle_, &index_buf_,
+      &index_uncompressed_buf_, fill_cache_, true);
+  handle.size_ = block.size();
+  index_it_ = BlockIterator(block.data(), handle, sst_->format_version_);
+  loaded_partition_ = block_id_;
+}
+
+void SSTableIterator::NextBlock() {
+  if (sst_->IsIndexPartitioned()) {
+    index_it_.Next();
+    if (index_it_.Valid()) {
+      LoadBlock(true);
+      return;
+    }
+  }
+  ++block_id_;
+  if (block_id_ < sst_->index_.size()) {
+    if (sst_->IsIndexPartitioned()) {
+      LoadPartition();
+    }
+    LoadBlock(true);
+  }
+}
+
+void SSTableIterator::LoadBlock(bool sequential) {
+  BlockHandle handle = CurrentHandle();
+  if (handle.offset_ == loaded_offset_) {
+    // e.g., MultiGet looks up several keys in the block.
+    sequential_loads_ = 0;
+    block_it_.SeekToFirst();
+    return;
+  }
+  if (sequential && sst_->file_->use_mmap() &&
+      handle.offset_ + handle.size_ > readahead_limit_) {
+    readahead_limit_ = handle.offset_ + kMmapReadaheadSize;
+    sst_->file_->Advise(
+        handle.offset_, kMmapReadaheadSize, ReadAdvice::kWillNeed);
+  }
+  sequential_loads_ = sequential ? sequential_loads_ + 1 : 0;
+  // Unpin the previous block before pinning the next one.
+  cache_handle_.reset();
+  Slice block;
+  if (auto prefetched = readahead_.Pop(handle.offset_)) {
+    // Take over the buffers which the block points into.
+    block = prefetched->block_;
+    cache_handle_ = std::move(prefetched->cache_handle_);
+    buf_ = std::move(prefetched->buf_);
+    if (block.data() == prefetched->uncompressed_buf_.data()) {
+      uncompressed_buf_ = std::move(prefetched->uncompressed_buf_);
+      block = uncompressed_buf_;
+    }
+  } else {
+    if (!sequential) {
+      readahead_.Clear();
+      readahead_blocks_ = 0;
+    }
+    block = sst_->ReadBlock(
+        handle, &cache_handle_, &buf_, &uncompressed_buf_, fill_cache_);
+  }
+  loaded_offset_ = handle.offset_;
+  // The size of the uncompressed block, without the trailer.
+  handle.size_ = block.size();
+  block_it_ = BlockIterator(block.data(), handle, sst_->format_version_);
+  if (sequential) {
+    Readahead();
+  }
+}
+
+void SSTableIterator::Readahead() {
+  // The kernel reads mapped files ahead. See LoadBlock.
+  if (sst_->file_->use_mmap() || sequential_loads_ < kReadaheadTrigger ||
+      readahead_.size() > readahead_blocks_ / 2) {
+    return;
+  }
+  readahead_blocks_ = std::min(
+      std::max(readahead_blocks_ * 2, kInitialReadaheadBlocks),
+      kMaxReadaheadBlocks);
+  // The handles of the blocks after the queued ones. If the index is
+  // partitioned, only the blocks in the current partition are read ahead.
+  std::vector<BlockHandle> handles;
+  size_t skip = readahead_.size();
+  size_t want = readahead_blocks_ - readahead_.size();
+  if (sst_->IsIndexPartitioned()) {
+    auto it = index_it_;
+    for (it.Next(); it.Valid() && handles.size() < want; it.Next()) {
+      if (skip > 0) {
+        skip -= 1;
+        continue;
+      }
+      BlockHandle handle;
+      memcpy(&handle, it.value().data(), sizeof(BlockHandle));
+      handles.push_back(handle);
+    }
+  } else {
+    for (size_t id = block_id_ + 1 + skip;
+         id < sst_->index_.size() && handles.size() < want; id++) {
+      handles.push_back(sst_->index_[id].block_);
+    }
+  }
+  PrefetchBlocks(handles);
+}
+
+void SSTableIterator::PrefetchBlocks(const std::vector<BlockHandle>& handles) {
+  size_t count = 0;
+  for (auto& handle : handles) {
+    auto block = std::make_shared<PrefetchedBlock>();
+    block->handle_ = handle;
+    // A cached block is pinned now instead of by a background thread.
+    if (sst_->cache_ && !sst_->file_->use_mmap() &&
+        sst_->PinCachedBlock(handle, &block->cache_handle_, fill_cache_)) {
+      block->block_ = block->cache_handle_->block();
+      block->read_.set_value();
+      readahead_.Push(std::move(block));
+      continue;
+    }
+    sst_->StartPrefetch();
+    GetReadaheadPool()->Push(
+        [sst = sst_, block, fill_cache = fill_cache_]() mutable {
+          if (!block->cancelled_.load(std::memory_order_relaxed)) {
+            try {
+              block->block_ = sst->ReadBlock(block->handle_,
+                  &block->cache_handle_, &block->buf_,
+                  &block->uncompressed_buf_, fill_cache);
+              block->read_.set_value();
+            } catch (...) {
+              block->read_.set_exception(std::current_exception());
+            }
+          }
+          // A dropped block unpins its cache handle before the SSTable, and
+          // then the cache, may be destroyed.
+          block.reset();
+          sst->FinishPrefetch();
+        });
+    readahead_.Push(std::move(block));
+    count += 1;
+  }
+  GetStatsContext()->block_readahead.fetch_add(
+      count, std::memory_order_relaxed);
 }
 
 bool SSTableIterator::Valid() {
@@ -130,13 +599,8 @@ Slice SSTableIterator::value() const {
 void SSTableIterator::Next() {
   if(Valid()){
     block_it_.Next();
-    if(!block_it_.Valid()){  
-      ++block_id_;
-      if(block_id_ < sst_->index_.size()){
-        BlockHandle handle = sst_->index_[block_id_].block_;
-        sst_->file_.get()->Read(buf_.data(), handle.size_, handle.offset_);
-        block_it_ = BlockIterator(buf_.data(), handle);
-      }
+    if(!block_it_.Valid()){
+      NextBlock();
     }
   }
 }
@@ -147,9 +611,8 @@ void SSTableBuilder::Append(ParsedKey key, Slice value) {
     // Exceed size limit, new block needed.
     auto current_index_value = index_data_.end() - 1;
     current_index_value->block_.count_ = block_builder_.count();
-    current_index_value->block_.size_ = block_builder_.size();
     current_index_value->block_.offset_ = current_block_offset_;
-    block_builder_.Finish();
+    current_index_value->block_.size_ = block_builder_.Finish();
     // Create New Block
     current_block_offset_ += current_index_value->block_.size_;
     block_builder_.Clear();
@@ -167,6 +630,9 @@ void SSTableBuilder::Append(ParsedKey key, Slice value) {
   }
   // New Record, count++
   ++count_;
+  if(key.type_ == RecordType::Deletion){
+    ++tombstone_count_;
+  }
   // Update Index Value of whole block
   auto current_index_value = index_data_.end()-1;
   current_index_value->key_ = ikey;
@@ -174,28 +640,78 @@ void SSTableBuilder::Append(ParsedKey key, Slice value) {
   key_hashes_.push_back(utils::BloomFilter::BloomHash(key.user_key_));
 }
 
+void SSTableBuilder::AddRangeTombstone(const RangeTombstone& tombstone) {
+  if(format_version_ < kRangeDelFormatVersion){
+    DB_ERR("Range tombstones require format version {}",
+        kRangeDelFormatVersion);
+  }
+  range_dels_.push_back(tombstone);
+  ++tombstone_count_;
+}
+
 void SSTableBuilder::Finish() {
-  // Finish Block Builder
-  auto current_index_value = index_data_.end() - 1;
-  current_index_value->block_.count_ = block_builder_.count();
-  current_index_value->block_.size_ = block_builder_.size();
-  current_index_value->block_.offset_ = current_block_offset_;
-  block_builder_.Finish();
-  current_block_offset_ += current_index_value->block_.size_;
+  // Finish Block Builder. An SSTable with only range tombstones has no block.
+  if(count_ > 0){
+    auto current_index_value = index_data_.end() - 1;
+    current_index_value->block_.count_ = block_builder_.count();
+    current_index_value->block_.offset_ = current_block_offset_;
+    current_index_value->block_.size_ = block_builder_.Finish();
+    current_block_offset_ += current_index_value->block_.size_;
+  } else {
+    index_data_.clear();
+  }
+  // Extend the key range to cover the range tombstones.
+  std::sort(range_dels_.begin(), range_dels_.end(),
+      [](const RangeTombstone& a, const RangeTombstone& b) {
+        return a.begin_ < b.begin_;
+      });
+  bool has_range = count_ > 0;
+  for(auto& it : range_dels_){
+    InternalKey smallest(it.begin_, std::numeric_limits<seq_t>::max(),
+        RecordType::RangeDeletion);
+    auto largest = RangeTombstoneLargestKey(it.end_);
+    if(!has_range || ParsedKey(smallest) < ParsedKey(smallest_key_)){
+      smallest_key_ = smallest;
+    }
+    if(!has_range || ParsedKey(largest) > ParsedKey(largest_key_)){
+      largest_key_ = largest;
+    }
+    has_range = true;
+  }
   // Push Index Data.
-  index_offset_ = current_block_offset_;
   auto file = writer_.get();
-  for(auto it : index_data_){
-    file->AppendValue<offset_t>(it.key_.size())
-         .AppendString(it.key_.GetSlice())
-         .AppendValue<BlockHandle>(it.block_);
-    current_block_offset_ += it.key_.size() + sizeof(offset_t) + sizeof(BlockHandle);
+  if(index_data_.empty()){
+    index_offset_ = current_block_offset_;
+  } else if(format_version_ >= kPartitionedIndexFormatVersion){
+    WritePartitionedIndex();
+  } else {
+    index_offset_ = current_block_offset_;
+    for(auto it : index_data_){
+      file->AppendValue<offset_t>(it.key_.size())
+           .AppendString(it.key_.GetSlice())
+           .AppendValue<BlockHandle>(it.block_);
+      current_block_offset_ += it.key_.size() + sizeof(offset_t) + sizeof(BlockHandle);
+    }
   }
   // Create Bloom Filter with key_hashes_
   std::string bloom_bits;
-  utils::BloomFilter::Create(key_hashes_.size(), bloom_bits_per_key_, bloom_bits);
-  for(auto it : key_hashes_){
-    utils::BloomFilter::Add(it, bloom_bits);
+  if(filter_type_ == FilterType::kXor){
+    utils::XorFilter::Build(std::move(key_hashes_), bloom_bits);
+  } else if(filter_type_ == FilterType::kBlockedBloom){
+    utils::BlockedBloomFilter::Create(
+        key_hashes_.size(), bloom_bits_per_key_, bloom_bits);
+    for(auto it : key_hashes_){
+      utils::BlockedBloomFilter::Add(it, bloom_bits);
+    }
+  } else {
+    utils::BloomFilter::Create(
+        key_hashes_.size(), bloom_bits_per_key_, bloom_bits);
+    for(auto it : key_hashes_){
+      utils::BloomFilter::Add(it, bloom_bits);
+    }
+  }
+  if(format_version_ >= kFilterTypeFormatVersion){
+    bloom_bits.insert(bloom_bits.begin(), static_cast<char>(filter_type_));
   }
   // Push bloom filter
   bloom_filter_offset_ = current_block_offset_;
@@ -206,9 +722,65 @@ void SSTableBuilder::Finish() {
        .AppendString(smallest_key_.GetSlice())
        .AppendValue<size_t>(largest_key_.size())
        .AppendString(largest_key_.GetSlice());
+  // Push range tombstones
+  if(format_version_ >= kRangeDelFormatVersion){
+    file->AppendValue<size_t>(range_dels_.size());
+    for(auto& it : range_dels_){
+      file->AppendValue<size_t>(it.begin_.size())
+           .AppendString(it.begin_)
+           .AppendValue<size_t>(it.end_.size())
+           .AppendString(it.end_)
+           .AppendValue<seq_t>(it.seq_);
+    }
+  }
+  // Push footer
+  if(format_version_ != kLegacyFormatVersion){
+    file->AppendValue<uint32_t>(format_version_)
+         .AppendValue<uint64_t>(kSSTableMagic);
+  }
   // Flush
   file->Flush();
 }
+
+void SSTableBuilder::WritePartitionedIndex() {
+  auto file = writer_.get();
+  // Index partitions are not compressed: the keys are prefix-compressed and
+  // the handles hardly compress.
+  BlockBuilder partition(block_size_, file, kIndexBlockRestartInterval,
+      CompressionType::kNone, format_version_);
+  std::vector<IndexValue> top_index(1);
+  auto finish_partition = [&]() {
+    auto& handle = top_index.back().block_;
+    handle.count_ = partition.count();
+    handle.offset_ = current_block_offset_;
+    handle.size_ = partition.Finish();
+    current_block_offset_ += handle.size_;
+    partition.Clear();
+  };
+  for (auto& it : index_data_) {
+    Slice handle(
+        reinterpret_cast<const char*>(&it.block_), sizeof(BlockHandle));
+    if (!partition.Append(ParsedKey(it.key_), handle)) {
+      finish_partition();
+      top_index.push_back(IndexValue());
+      if (!partition.Append(ParsedKey(it.key_), handle)) {
+        DB_ERR("Error when appending index; block size may too small.");
+      }
+    }
+    top_index.back().key_ = it.key_;
+  }
+  finish_partition();
+  // The top-level index has the same layout as an unpartitioned index.
+  index_offset_ = current_block_offset_;
+  for (auto& it : top_index) {
+    file->AppendValue<offset_t>(it.key_.size())
+        .AppendString(it.key_.GetSlice())
+        .AppendValue<BlockHandle>(it.block_);
+    current_block_offset_ +=
+        it.key_.size() + sizeof(offset_t) + sizeof(BlockHandle);
+  }
+}
+
 }  // namespace lsm
 
 }  // namespace wing
@@ -1,5 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -7,9 +16,11 @@
 #include "storage/lsm/cache.hpp"
 #include "storage/lsm/common.hpp"
 #include "storage/lsm/file.hpp"
+#include "storage/lsm/file_purger.hpp"
 #include "storage/lsm/format.hpp"
 #include "storage/lsm/iterator.hpp"
 #include "storage/lsm/options.hpp"
+#include "storage/lsm/range_del.hpp"
 
 namespace wing {
 
@@ -17,6 +28,15 @@ namespace lsm {
 
 class SSTableIterator;
 
+/* A key looked up by MultiGet. */
+struct MultiGetEntry {
+  Slice key_;
+  /* BloomHash(key_), which is computed once for all the SSTables. */
+  size_t hash_;
+  std::string* value_;
+  GetResult result_{GetResult::kNotFound};
+};
+
 class SSTable {
  public:
   /**
@@ -25,8 +45,16 @@ class SSTable {
    * Below are global options (see lsm/options.hpp):
    * block_size: The size of data block in the SSTable
    * use_direct_io: Enable O_DIRECT or not.
+   * cache: The block cache shared by the LSM tree. If it is null, every data
+   * block is read from the file into the iterator's private buffer.
+   * use_mmap: Map the file into memory. Uncompressed blocks are read in place,
+   * without the block cache. It is ignored if use_direct_io is true.
+   * purger: It deletes the file if the SSTable is removed. If it is null, the
+   * file is deleted in the destructor.
    */
-  SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io);
+  SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io,
+      Cache* cache = nullptr, bool use_mmap = false,
+      FilePurger* purger = nullptr);
 
   ~SSTable();
 
@@ -37,15 +65,33 @@ class SSTable {
    * If the record has type RecordType::Deletion, then it does nothing to the
    * value, and returns GetResult::kDelete If there is no such record, it
    * returns GetResult::kNotFound.
+   * If a range tombstone of the SSTable is newer than the record, or there is
+   * no record but a tombstone, it returns GetResult::kDelete.
+   * level: the level of the SSTable, whose filter statistics are updated
+   * (see lsm/stats.hpp). It is -1 if the SSTable is not in a level.
    * */
-  GetResult Get(Slice key, uint64_t seq, std::string* value);
+  GetResult Get(Slice key, uint64_t seq, std::string* value, int level = -1);
+
+  /**
+   * Look up the entries, which are sorted by key, as Get does, and set their
+   * results. The bloom filter is probed for all the keys first. Then the data
+   * blocks of the remaining keys are read in parallel, each of them once.
+   */
+  void MultiGet(std::span<MultiGetEntry* const> entries, uint64_t seq,
+      int level = -1);
 
   /* Return an iterator positioned at the first record that is not smaller than
-   * (key, seq). */
-  SSTableIterator Seek(Slice key, uint64_t seq);
+   * (key, seq). fill_cache: see Begin. */
+  SSTableIterator Seek(Slice key, uint64_t seq,
+      CacheFill fill_cache = CacheFill::kHighPriority);
 
-  /* Return an iterator positioned at the beginning of the SSTable */
-  SSTableIterator Begin();
+  /**
+   * Return an iterator positioned at the beginning of the SSTable.
+   * fill_cache decides how the blocks missing in the block cache are read,
+   * see CacheFill. Long scans insert them with low priority, so that they are
+   * evicted before the blocks of point lookups.
+   */
+  SSTableIterator Begin(CacheFill fill_cache = CacheFill::kHighPriority);
 
   /* The largest key of the SSTable. */
   ParsedKey GetLargestKey() const { return largest_key_; }
@@ -65,13 +111,103 @@ class SSTable {
 
   const SSTInfo& GetSSTInfo() const { return sst_info_; }
 
+  /* The format version, see lsm/format.hpp */
+  uint32_t GetFormatVersion() const { return format_version_; }
+
+  FilterType GetFilterType() const { return filter_type_; }
+
+  /* The memory used by the filter. */
+  size_t GetFilterSize() const { return bloom_filter_.size(); }
+
+  /* The range tombstones, sorted by begin_. They are pinned in memory. */
+  const std::vector<RangeTombstone>& GetRangeTombstones() const {
+    return range_dels_;
+  }
+
+  /**
+   * If it is true, the index partitions are loaded through the block cache.
+   * Without a block cache, the partitions of an SSTable in
+   * kPartitionedIndexFormatVersion are merged into a flat index instead.
+   */
+  bool IsIndexPartitioned() const { return index_partitioned_; }
+
+  Cache* GetCache() const { return cache_; }
+
+  /* The number of data block reads served by the block cache. */
+  uint64_t GetCacheHitCount() const {
+    return cache_hit_.load(std::memory_order_relaxed);
+  }
+
+  /* The number of data block reads that went to the file. */
+  uint64_t GetCacheMissCount() const {
+    return cache_miss_.load(std::memory_order_relaxed);
+  }
+
+  /* The number of index partition reads served by the block cache. */
+  uint64_t GetIndexCacheHitCount() const {
+    return index_cache_hit_.load(std::memory_order_relaxed);
+  }
+
+  /* The number of index partition reads that went to the file. */
+  uint64_t GetIndexCacheMissCount() const {
+    return index_cache_miss_.load(std::memory_order_relaxed);
+  }
+
  private:
+  /**
+   * Load the data block and return its uncompressed content.
+   * If the block cache is enabled, the block is pinned by cache_handle.
+   * The cache stores uncompressed blocks, so a block is decompressed once.
+   * If the file is mapped and the block is not compressed, the returned block
+   * points into the mapping and the block cache is not used.
+   * Otherwise, or if the block is not cached and fill_cache is kNone, it is
+   * read into buf, and decompressed into uncompressed_buf if necessary.
+   * index_partition: whether it is an index partition or a data block.
+   */
+  Slice ReadBlock(BlockHandle block, std::optional<Cache::Handle>* cache_handle,
+      AlignedBuffer* buf, std::string* uncompressed_buf,
+      CacheFill fill_cache = CacheFill::kHighPriority,
+      bool index_partition = false);
+
+  /**
+   * Pin the block by cache_handle if it is in the block cache. See ReadBlock.
+   * Require: cache_ is not null.
+   */
+  bool PinCachedBlock(BlockHandle block,
+      std::optional<Cache::Handle>* cache_handle, CacheFill fill_cache,
+      bool index_partition = false);
+
+  /* A readahead task of an iterator is scheduled or finished. */
+  void StartPrefetch();
+  void FinishPrefetch();
+
+  /**
+   * Replace the top-level index with the entries of all the partitions.
+   * Otherwise every lookup without a block cache would read its partition
+   * from the file before the data block.
+   */
+  void FlattenIndex();
+
+  /* Probe the filter of type filter_type_. */
+  bool MayContain(size_t hash) const;
+
+  /* MaxCoveringSeq of the range tombstones. */
+  seq_t RangeDelSeq(Slice key, uint64_t seq) const {
+    return range_dels_.empty() ? 0 : MaxCoveringSeq(range_dels_, key, seq);
+  }
+
   /* The information of SSTable. */
   SSTInfo sst_info_;
   /* The file manager. */
   std::unique_ptr<ReadFile> file_;
-  /* The index data, which is initialized in construction. */
+  /**
+   * The index data, which is initialized in construction and pinned in memory.
+   * If the index is partitioned, it is the top-level index, and the
+   * partitions are loaded through the block cache.
+   */
   std::vector<IndexValue> index_;
+  /* See IsIndexPartitioned. */
+  bool index_partitioned_{false};
   /* The block size of the data block. */
   size_t block_size_;
   /* The key range of the SSTable, which is initialized in construction. */
@@ -80,17 +216,105 @@ class SSTable {
   bool compaction_in_process_{false};
   /* If it is true, then the SSTable file will be removed in deconstrution. */
   bool remove_tag_{false};
-  /* The bloom filter buffer */
+  /* It deletes the file if remove_tag_ is true. It can be null. */
+  FilePurger* purger_{nullptr};
+  /* The filter buffer, without the FilterType byte */
   std::string bloom_filter_;
+  /* The type of the filter, see lsm/format.hpp */
+  FilterType filter_type_{FilterType::kBloom};
+  /* The range tombstones. They are in kRangeDelFormatVersion. */
+  std::vector<RangeTombstone> range_dels_;
+  /* The format version of the data blocks, which is read from the footer. */
+  uint32_t format_version_{kLegacyFormatVersion};
+  /* The block cache. It can be null. */
+  Cache* cache_{nullptr};
+  /* The id of the blocks in the block cache. See Cache::NewId. */
+  uint64_t cache_id_{0};
+  /* Block cache statistics of this SSTable. */
+  std::atomic<uint64_t> cache_hit_{0};
+  std::atomic<uint64_t> cache_miss_{0};
+  std::atomic<uint64_t> index_cache_hit_{0};
+  std::atomic<uint64_t> index_cache_miss_{0};
+  /**
+   * The number of the readahead tasks which have not finished. The tasks of
+   * the dropped iterators still refer to the SSTable, so the destructor waits
+   * for them.
+   */
+  size_t pending_prefetches_{0};
+  std::mutex prefetch_mutex_;
+  std::condition_variable prefetch_cv_;
+
+  /* Whether the data of the block is compressed. It requires a mapped file. */
+  bool IsMappedBlockCompressed(BlockHandle block) const;
 
   friend class SSTableIterator;
 };
 
+/**
+ * A data block which is read by a background readahead task. The task owns
+ * a reference to it, so an iterator can drop it without waiting for the read.
+ */
+struct PrefetchedBlock {
+  BlockHandle handle_;
+  /* It is set when the block is read. */
+  std::promise<void> read_;
+  std::future<void> done_{read_.get_future()};
+  /* The iterator has dropped it, so the task does not read it. */
+  std::atomic<bool> cancelled_{false};
+  /* The uncompressed block, which points into one of the fields below. */
+  Slice block_;
+  std::optional<Cache::Handle> cache_handle_;
+  AlignedBuffer buf_;
+  std::string uncompressed_buf_;
+};
+
+/**
+ * The blocks being read ahead by an iterator, in the order of the scan.
+ * The pending reads are cancelled rather than waited for when they are
+ * dropped. SSTable waits for the tasks before it is destroyed.
+ */
+class ReadaheadQueue {
+ public:
+  ReadaheadQueue() = default;
+  ReadaheadQueue(ReadaheadQueue&& rhs) = default;
+  ReadaheadQueue& operator=(ReadaheadQueue&& rhs) {
+    Clear();
+    blocks_ = std::move(rhs.blocks_);
+    return *this;
+  }
+  ~ReadaheadQueue() { Clear(); }
+
+  /* Cancel the pending reads and drop all the blocks. */
+  void Clear() {
+    for (auto& block : blocks_) {
+      block->cancelled_.store(true, std::memory_order_relaxed);
+    }
+    blocks_.clear();
+  }
+
+  /**
+   * Return the first block if it is the block at offset, after its read
+   * finishes. Otherwise, the scan has left the queue, so it is cleared.
+   */
+  std::shared_ptr<PrefetchedBlock> Pop(offset_t offset);
+
+  void Push(std::shared_ptr<PrefetchedBlock> block) {
+    blocks_.push_back(std::move(block));
+  }
+
+  size_t size() const { return blocks_.size(); }
+
+ private:
+  std::deque<std::shared_ptr<PrefetchedBlock>> blocks_;
+};
+
 class SSTableIterator final : public Iterator {
  public:
   SSTableIterator() = default;
 
-  SSTableIterator(SSTable* sst) : sst_(sst), buf_(sst->block_size_, 4096) {
+  SSTableIterator(
+      SSTable* sst, CacheFill fill_cache = CacheFill::kHighPriority)
+    : sst_(sst), fill_cache_(fill_cache) {
     block_id_ = sst_->index_.size();
   }
 
@@ -111,28 +335,102 @@ class SSTableIterator final : public Iterator {
  private:
   /* The reference to the SSTable */
   SSTable* sst_{nullptr};
-  /* Current data block id */
+  /* Current data block id, or the index partition id if it is partitioned */
   size_t block_id_{0};
   /* The block iterator of the current data block. */
   BlockIterator block_it_;
-  /* The buffer */
+  /* The pinned data block in the block cache */
+  std::optional<Cache::Handle> cache_handle_;
+  /* The buffer, which is used if the block is not in the block cache */
   AlignedBuffer buf_;
+  /* The decompressed block, which is used if it is not in the block cache */
+  std::string uncompressed_buf_;
+  /* Whether the blocks read from the file are inserted into the cache */
+  CacheFill fill_cache_{CacheFill::kHighPriority};
+  /* The iterator of the current index partition and its buffers. */
+  BlockIterator index_it_;
+  std::optional<Cache::Handle> index_cache_handle_;
+  AlignedBuffer index_buf_;
+  std::string index_uncompressed_buf_;
+  /* The end of the range which is advised to be read ahead. */
+  size_t readahead_limit_{0};
+  /* The data blocks read ahead by the background threads. */
+  ReadaheadQueue readahead_;
+  /* The number of blocks loaded one after another since the last Seek. */
+  size_t sequential_loads_{0};
+  /* The number of blocks to read ahead. It grows as the scan goes on. */
+  size_t readahead_blocks_{0};
+  /* The offset of the data block in block_it_, and the loaded partition. */
+  size_t loaded_offset_{std::numeric_limits<size_t>::max()};
+  size_t loaded_partition_{std::numeric_limits<size_t>::max()};
+
+  /**
+   * Load the current data block and position block_it_ at its beginning.
+   * sequential: the block is loaded by a scan, so the following blocks are
+   * read ahead if the file is mapped.
+   */
+  void LoadBlock(bool sequential = false);
+
+  /* Load the index partition block_id_ and position index_it_ at its beginning */
+  void LoadPartition();
+
+  /* Move to the next data block, or to the end */
+  void NextBlock();
+
+  /* Read the blocks after the current one ahead, if the scan is long enough. */
+  void Readahead();
+
+  /* Read the blocks on the background threads, in this order. */
+  void PrefetchBlocks(const std::vector<BlockHandle>& handles);
+
+  /**
+   * Position the index at the first data block which may contain records
+   * >= (key, seq), without loading it. Return false if there is none.
+   */
+  bool SeekIndex(Slice key, uint64_t seq);
+
+  /* The handle of the data block which the index is positioned at. */
+  BlockHandle CurrentHandle() const;
+
+  friend class SSTable;
 };
 
 class SSTableBuilder {
  public:
   SSTableBuilder(std::unique_ptr<FileWriter> writer, size_t block_size,
-      size_t bloom_bits_per_key)
+      size_t bloom_bits_per_key, size_t block_restart_interval = 16,
+      CompressionType compression = CompressionType::kNone,
+      uint32_t format_version = kLatestFormatVersion,
+      FilterType filter_type = FilterType::kBlockedBloom)
     : writer_(std::move(writer)),
-      block_builder_(block_size, writer_.get()),
-      bloom_bits_per_key_(bloom_bits_per_key) {
+      block_builder_(block_size, writer_.get(), block_restart_interval,
+          compression, format_version),
+      bloom_bits_per_key_(bloom_bits_per_key),
+      block_size_(block_size),
+      format_version_(format_version) {
         index_data_.resize(1);
+        // The filter type is implied by the format version before
+        // kFilterTypeFormatVersion.
+        if(format_version_ >= kFilterTypeFormatVersion){
+          filter_type_ = filter_type;
+        } else if(format_version_ >= kBlockedBloomFormatVersion){
+          filter_type_ = FilterType::kBlockedBloom;
+        } else {
+          filter_type_ = FilterType::kBloom;
+        }
       }
 
   ~SSTableBuilder() = default;
 
   void Append(ParsedKey key, Slice value);
 
+  /**
+   * Add a range tombstone. The key range of the SSTable is extended to cover
+   * it. The tombstones of a sorted run must not overlap the other SSTables.
+   * It requires kRangeDelFormatVersion.
+   */
+  void AddRangeTombstone(const RangeTombstone& tombstone);
+
   void Finish();
 
   std::vector<IndexValue> GetIndexData() const { return index_data_; }
@@ -145,11 +443,17 @@ class SSTableBuilder {
 
   size_t count() const { return count_; }
 
+  /* The number of deletion records and range tombstones. */
+  size_t tombstone_count() const { return tombstone_count_; }
+
   size_t GetIndexOffset() const { return index_offset_; }
 
   size_t GetBloomFilterOffset() const { return bloom_filter_offset_; }
 
  private:
+  /* Write the index partitions, and then the top-level index. */
+  void WritePartitionedIndex();
+
   /* The file writer */
   std::unique_ptr<FileWriter> writer_;
   /* The builder for the data block */
@@ -162,14 +466,24 @@ class SSTableBuilder {
   InternalKey largest_key_, smallest_key_;
   /* The number of records in this SSTable. */
   size_t count_{0};
+  /* The number of deletion records and range tombstones. */
+  size_t tombstone_count_{0};
   /* Current offset */
   size_t current_block_offset_{0};
   /* hashes of keys used to build bloom filter */
   std::vector<size_t> key_hashes_;
+  /* The range tombstones */
+  std::vector<RangeTombstone> range_dels_;
   /* The offset of the bloom filter */
   size_t bloom_filter_offset_{0};
   /* The number of bits per key in bloom filter */
   size_t bloom_bits_per_key_{0};
+  /* The type of the filter */
+  FilterType filter_type_{FilterType::kBlockedBloom};
+  /* The size of data blocks and index partitions */
+  size_t block_size_{0};
+  /* The format version of the SSTable */
+  uint32_t format_version_{kLatestFormatVersion};
 };
 
 }  // namespace lsm
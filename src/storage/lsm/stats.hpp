@@ -1,11 +1,15 @@
 #pragma once
 
+#include <array>
 #include <atomic>
 
 namespace wing {
 
 namespace lsm {
 
+/* The number of levels whose filter statistics are recorded. */
+constexpr size_t kFilterStatsLevels = 16;
+
 struct StatsContext {
   /* Total bytes of all read operations */
   std::atomic<uint64_t> total_read_bytes{0};
@@ -13,11 +17,56 @@ struct StatsContext {
   std::atomic<uint64_t> total_write_bytes{0};
   /* Total bytes of flushed MemTable */
   std::atomic<uint64_t> total_input_bytes{0};
+  /* Total bytes written to the write-ahead logs */
+  std::atomic<uint64_t> total_wal_bytes{0};
+  /* Total number of data blocks found in the block cache */
+  std::atomic<uint64_t> block_cache_hit{0};
+  /* Total number of data blocks read from disk because of cache misses */
+  std::atomic<uint64_t> block_cache_miss{0};
+  /* Total number of data blocks read ahead by scans */
+  std::atomic<uint64_t> block_readahead{0};
+  /* Total microseconds writes are delayed by the write slowdown */
+  std::atomic<uint64_t> write_slowdown_micros{0};
+  /* Total microseconds writes are stopped */
+  std::atomic<uint64_t> write_stop_micros{0};
+  /* Per level: the number of SSTable lookups rejected by the filter */
+  std::array<std::atomic<uint64_t>, kFilterStatsLevels> filter_negatives{};
+  /* Per level: the number of SSTable lookups which pass the filter but find
+   * no record of the key */
+  std::array<std::atomic<uint64_t>, kFilterStatsLevels>
+      filter_false_positives{};
+
+  /* Record a lookup of an SSTable in the level. A negative level is ignored. */
+  void RecordFilter(int level, bool false_positive) {
+    if (level < 0 || size_t(level) >= kFilterStatsLevels) {
+      return;
+    }
+    auto& counter = false_positive ? filter_false_positives[level]
+                                   : filter_negatives[level];
+    counter.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /* The observed false positive rate of the filters in the level. */
+  double GetFilterFalsePositiveRate(size_t level) const {
+    double fp = filter_false_positives[level].load(std::memory_order_relaxed);
+    double negatives = filter_negatives[level].load(std::memory_order_relaxed);
+    return fp + negatives == 0 ? 0 : fp / (fp + negatives);
+  }
 
   void Reset() {
     total_read_bytes = 0;
     total_write_bytes = 0;
     total_input_bytes = 0;
+    total_wal_bytes = 0;
+    block_cache_hit = 0;
+    block_cache_miss = 0;
+    block_readahead = 0;
+    write_slowdown_micros = 0;
+    write_stop_micros = 0;
+    for (size_t i = 0; i < kFilterStatsLevels; i++) {
+      filter_negatives[i] = 0;
+      filter_false_positives[i] = 0;
+    }
   }
 };
 
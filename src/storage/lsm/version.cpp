@@ -1,19 +1,100 @@
 #include "storage/lsm/version.hpp"
 
+#include <cmath>
+
+#include "common/bloomfilter.hpp"
+
 namespace wing {
 
 namespace lsm {
 
 bool Version::Get(std::string_view user_key, seq_t seq, std::string* value) {
-  for(auto it : levels_){
-    auto res = it.Get(user_key, seq, value);
-    if(res != GetResult::kNotFound){
-      return res == GetResult::kFound;
+  std::call_once(hints_once_, [this]() { BuildCascadeHints(); });
+  ParsedKey pkey(user_key, seq, RecordType::Value);
+  // The range of SSTables in the current level which may contain the key.
+  size_t lr = 0, rr = std::numeric_limits<size_t>::max();
+  for (size_t i = 0; i < levels_.size(); i++) {
+    auto& runs = levels_[i].GetRuns();
+    if (runs.size() != 1) {
+      auto res = levels_[i].Get(user_key, seq, value);
+      if (res != GetResult::kNotFound) {
+        return res == GetResult::kFound;
+      }
+      lr = 0, rr = std::numeric_limits<size_t>::max();
+      continue;
+    }
+    auto& run = *runs[0];
+    auto& ssts = run.GetSSTs();
+    size_t id = run.FindSST(pkey, lr, std::min(rr, ssts.size()));
+    if (id < ssts.size()) {
+      auto res = ssts[id]->Get(user_key, seq, value, i);
+      if (res != GetResult::kNotFound) {
+        return res == GetResult::kFound;
+      }
+    }
+    if (i >= hints_.size() || hints_[i].lower_.empty()) {
+      lr = 0, rr = std::numeric_limits<size_t>::max();
+      continue;
+    }
+    auto& hint = hints_[i];
+    if (id == ssts.size()) {
+      // The key is larger than all the SSTables.
+      lr = hint.upper_.back(), rr = std::numeric_limits<size_t>::max();
+    } else if (pkey >= ssts[id]->GetSmallestKey()) {
+      lr = hint.lower_[id], rr = hint.upper_[id];
+    } else {
+      // The key is in the gap between SSTable id - 1 and SSTable id.
+      lr = id > 0 ? hint.upper_[id - 1] : 0, rr = hint.lower_[id];
     }
   }
   return false;
 }
 
+const RangeDelAggregator& Version::GetRangeDelAggregator() {
+  std::call_once(range_del_once_, [this]() {
+    for (auto& level : levels_) {
+      for (auto& run : level.GetRuns()) {
+        for (auto& sst : run->GetSSTs()) {
+          range_del_agg_.Add(sst->GetRangeTombstones());
+        }
+      }
+    }
+    range_del_agg_.Build();
+  });
+  return range_del_agg_;
+}
+
+void Version::BuildCascadeHints() {
+  hints_.resize(levels_.size() > 0 ? levels_.size() - 1 : 0);
+  for (size_t i = 0; i < hints_.size(); i++) {
+    auto& runs = levels_[i].GetRuns();
+    auto& next_runs = levels_[i + 1].GetRuns();
+    if (runs.size() != 1 || next_runs.size() != 1) {
+      continue;
+    }
+    auto& next = *next_runs[0];
+    for (auto& sst : runs[0]->GetSSTs()) {
+      hints_[i].lower_.push_back(
+          next.FindSST(sst->GetSmallestKey(), 0, next.SSTCount()));
+      hints_[i].upper_.push_back(
+          next.FindSST(sst->GetLargestKey(), 0, next.SSTCount()));
+    }
+  }
+}
+
+void Version::MultiGet(std::span<MultiGetEntry* const> entries, seq_t seq) {
+  std::vector<MultiGetEntry*> pending(entries.begin(), entries.end());
+  for (auto& level : levels_) {
+    if (pending.empty()) {
+      break;
+    }
+    level.MultiGet(pending, seq);
+    std::erase_if(pending, [](MultiGetEntry* entry) {
+      return entry->result_ != GetResult::kNotFound;
+    });
+  }
+}
+
 void Version::Append(
     uint32_t level_id, std::vector<std::shared_ptr<SortedRun>> sorted_runs) {
   while (levels_.size() <= level_id) {
@@ -28,13 +109,74 @@ void Version::Append(uint32_t level_id, std::shared_ptr<SortedRun> sorted_run) {
   levels_[level_id].Append(std::move(sorted_run));
 }
 
+size_t Version::GetFilterBitsPerKey(
+    size_t level, size_t new_size, size_t bits_per_key) const {
+  std::vector<size_t> runs(std::max(levels_.size(), level + 1));
+  std::vector<size_t> sizes(runs.size());
+  for (size_t i = 0; i < levels_.size(); i++) {
+    runs[i] = levels_[i].GetRuns().size();
+    sizes[i] = levels_[i].size();
+  }
+  if (level == 0 || sizes[level] == 0) {
+    runs[level] += 1;
+    sizes[level] += new_size;
+  }
+  auto bits = MonkeyBitsPerKey(runs, sizes, bits_per_key);
+  // The hash functions of the bloom filters are capped.
+  return std::clamp<size_t>(std::llround(bits[level]), 1, 4 * bits_per_key);
+}
+
+std::vector<double> MonkeyBitsPerKey(const std::vector<size_t>& runs,
+    const std::vector<size_t>& sizes, double bits_per_key) {
+  // The false positive rate of b bits per key is about exp(-b * ln(2)^2).
+  const double c = std::log(2) * std::log(2);
+  std::vector<double> bits(sizes.size(), 0);
+  std::vector<bool> active(sizes.size());
+  double memory = 0;
+  for (size_t i = 0; i < sizes.size(); i++) {
+    active[i] = sizes[i] > 0 && runs[i] > 0;
+    memory += bits_per_key * sizes[i];
+  }
+  while (true) {
+    // With the Lagrange multiplier, the false positive rate of level i is
+    // lambda * sizes[i] / runs[i], and the memory adds up to the budget.
+    double total = 0, weighted_log = 0;
+    for (size_t i = 0; i < sizes.size(); i++) {
+      if (active[i]) {
+        total += sizes[i];
+        weighted_log += sizes[i] * std::log(double(sizes[i]) / runs[i]);
+      }
+    }
+    if (total == 0) {
+      return bits;
+    }
+    double log_lambda = -(c * memory + weighted_log) / total;
+    bool changed = false;
+    for (size_t i = 0; i < sizes.size(); i++) {
+      if (!active[i]) {
+        continue;
+      }
+      bits[i] = -(log_lambda + std::log(double(sizes[i]) / runs[i])) / c;
+      // A false positive rate >= 1 means that the level has no filter.
+      if (bits[i] <= 0) {
+        bits[i] = 0;
+        active[i] = false;
+        changed = true;
+      }
+    }
+    if (!changed) {
+      return bits;
+    }
+  }
+}
+
 bool SuperVersion::Get(
     std::string_view user_key, seq_t seq, std::string* value) {
   GetResult res = mt_->Get(user_key, seq, value);
   if(res != GetResult::kNotFound){
       return res == GetResult::kFound;
   }
-  for(auto it : *imms_){
+  for(auto& it : *imms_){
     res = it->Get(user_key, seq, value);
     if(res != GetResult::kNotFound){
       return res == GetResult::kFound;
@@ -43,6 +185,38 @@ bool SuperVersion::Get(
   return version_->Get(user_key, seq, value);
 }
 
+std::vector<bool> SuperVersion::MultiGet(
+    std::span<const Slice> keys, seq_t seq, std::vector<std::string>* values) {
+  values->resize(keys.size());
+  std::vector<MultiGetEntry> entries(keys.size());
+  std::vector<MultiGetEntry*> pending;
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto& entry = entries[i];
+    entry.key_ = keys[i];
+    entry.value_ = &(*values)[i];
+    // The MemTables are probed key by key.
+    entry.result_ = mt_->Get(entry.key_, seq, entry.value_);
+    for (auto& imm : *imms_) {
+      if (entry.result_ != GetResult::kNotFound) {
+        break;
+      }
+      entry.result_ = imm->Get(entry.key_, seq, entry.value_);
+    }
+    if (entry.result_ == GetResult::kNotFound) {
+      entry.hash_ = utils::BloomFilter::BloomHash(entry.key_);
+      pending.push_back(&entry);
+    }
+  }
+  std::sort(pending.begin(), pending.end(),
+      [](MultiGetEntry* a, MultiGetEntry* b) { return a->key_ < b->key_; });
+  version_->MultiGet(pending, seq);
+  std::vector<bool> found(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    found[i] = entries[i].result_ == GetResult::kFound;
+  }
+  return found;
+}
+
 std::string SuperVersion::ToString() const {
   std::string ret;
   ret += fmt::format("Memtable: size {}, ", mt_->size());
@@ -66,10 +240,9 @@ void SuperVersionIterator::SeekToFirst() {
     mt_its_.push_back((*it)->Begin());
   }
   sst_its_.clear();
-  auto levels = sv_->GetVersion()->GetLevels();
-  for(auto lev : levels){
-    for(auto it : lev.GetRuns()){
-      sst_its_.push_back(it->Begin());
+  for(auto& lev : sv_->GetVersion()->GetLevels()){
+    for(auto& it : lev.GetRuns()){
+      sst_its_.push_back(it->Begin(fill_cache_));
     }
   }
   it_ = IteratorHeap<Iterator>();
@@ -89,10 +262,9 @@ void SuperVersionIterator::Seek(Slice key, seq_t seq) {
     mt_its_.push_back((*it)->Seek(key, seq));
   }
   sst_its_.clear();
-  auto levels = sv_->GetVersion()->GetLevels();
-  for(auto lev : levels){
-    for(auto it : lev.GetRuns()){
-      sst_its_.push_back(it->Seek(key, seq));
+  for(auto& lev : sv_->GetVersion()->GetLevels()){
+    for(auto& it : lev.GetRuns()){
+      sst_its_.push_back(it->Seek(key, seq, fill_cache_));
     }
   }
   it_ = IteratorHeap<Iterator>();
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <mutex>
+
 #include "storage/lsm/common.hpp"
 #include "storage/lsm/iterator_heap.hpp"
 #include "storage/lsm/level.hpp"
 #include "storage/lsm/memtable.hpp"
+#include "storage/lsm/range_del.hpp"
 #include "storage/lsm/sst.hpp"
 
 namespace wing {
@@ -16,12 +19,29 @@ class Version {
 
   Version() = default;
 
+  /* It copies the levels. The hints are built again for the copy. */
+  Version(const Version& version) : levels_(version.levels_) {}
+
   // Return true if the GetResult is kFound
   // Otherwise return false
+  // If adjacent levels have one sorted run each, the SSTable found in the
+  // upper level narrows the binary search in the lower level.
   bool Get(Slice user_key, seq_t seq, std::string* value);
 
+  /**
+   * Look up the entries, which are sorted by key, level by level. Every level
+   * only looks up the keys which are not found in the upper levels.
+   */
+  void MultiGet(std::span<MultiGetEntry* const> entries, seq_t seq);
+
   const std::vector<Level>& GetLevels() const { return levels_; }
 
+  /**
+   * The range tombstones of all the SSTables. It is built by the first
+   * iterator, after the levels are final, and shared by the later ones.
+   */
+  const RangeDelAggregator& GetRangeDelAggregator();
+
   /**
    * Append sorted runs to the Level level_id
    * It will create new levels if level_id >= levels_.size()
@@ -35,10 +55,51 @@ class Version {
    * */
   void Append(uint32_t level_id, std::shared_ptr<SortedRun> sorted_run);
 
+  /**
+   * The bits per key of the filters of a new sorted run of new_size bytes in
+   * the level, if the filters of all the levels take bits_per_key bits per
+   * key in total. It is added to Level 0, and merged into the other levels.
+   * See MonkeyBitsPerKey.
+   */
+  size_t GetFilterBitsPerKey(
+      size_t level, size_t new_size, size_t bits_per_key) const;
+
  private:
+  /**
+   * The hints of fractional cascading from the sorted run in level i to the
+   * sorted run in level i + 1. They are empty unless both levels have exactly
+   * one sorted run. The SSTables in level i + 1 which overlap the j-th SSTable
+   * in level i are in [lower_[j], upper_[j]]. See SortedRun::FindSST.
+   */
+  struct CascadeHint {
+    std::vector<size_t> lower_;
+    std::vector<size_t> upper_;
+  };
+
+  /* Build hints_. It is called by the first Get, after the levels are final. */
+  void BuildCascadeHints();
+
   std::vector<Level> levels_;
+  std::vector<CascadeHint> hints_;
+  std::once_flag hints_once_;
+  RangeDelAggregator range_del_agg_;
+  std::once_flag range_del_once_;
 };
 
+/**
+ * The Monkey allocation of filter memory (Dayan et al., SIGMOD 2017).
+ * A zero-result lookup probes the filter of every sorted run, so the expected
+ * number of wasted reads is the sum of their false positive rates. For a
+ * fixed total memory it is minimized when the false positive rate of a run is
+ * proportional to its size, i.e., the small runs in the upper levels get more
+ * bits per key. runs[i] and sizes[i] are the number of sorted runs and the
+ * size of level i. The sizes are used in place of the numbers of keys.
+ * Return the bits per key of each level, whose average weighted by the sizes
+ * is bits_per_key. A level gets no bits if its filters are not worth it.
+ */
+std::vector<double> MonkeyBitsPerKey(const std::vector<size_t>& runs,
+    const std::vector<size_t>& sizes, double bits_per_key);
+
 class SuperVersionIterator;
 
 class SuperVersion {
@@ -60,6 +121,13 @@ class SuperVersion {
   // Otherwise return false
   bool Get(Slice user_key, seq_t seq, std::string* value);
 
+  /**
+   * Get the values of keys in a batch. It returns found, where found[i] is
+   * true if keys[i] is found, and then (*values)[i] is its value.
+   */
+  std::vector<bool> MultiGet(
+      std::span<const Slice> keys, seq_t seq, std::vector<std::string>* values);
+
   std::string ToString() const;
 
  private:
@@ -72,7 +140,9 @@ class SuperVersion {
 
 class SuperVersionIterator final : public Iterator {
  public:
-  SuperVersionIterator(SuperVersion* sv) : sv_(sv) {}
+  SuperVersionIterator(
+      SuperVersion* sv, CacheFill fill_cache = CacheFill::kHighPriority)
+    : sv_(sv), fill_cache_(fill_cache) {}
 
   /* Move the the beginning */
   void SeekToFirst();
@@ -91,6 +161,8 @@ class SuperVersionIterator final : public Iterator {
  private:
   /* The referenced superversion */
   SuperVersion* sv_;
+  /* How the blocks read from the SSTables fill the block cache */
+  CacheFill fill_cache_{CacheFill::kHighPriority};
   /* The iterators */
   IteratorHeap<Iterator> it_;
   /* The memtable iterators */
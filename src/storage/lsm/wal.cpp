@@ -0,0 +1,188 @@
+#include "storage/lsm/wal.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include <filesystem>
+
+#include "common/exception.hpp"
+#include "common/murmurhash.hpp"
+#include "common/serializer.hpp"
+#include "storage/lsm/file.hpp"
+#include "storage/lsm/stats.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+static constexpr size_t kLogChecksumSeed = 0x202404051733;
+
+static constexpr size_t kLogHeaderSize = sizeof(uint64_t) + sizeof(offset_t);
+
+/* The file is extended by at least this size. */
+static constexpr size_t kLogChunkSize = 1 << 20;
+
+LogWriter::LogWriter(const std::string& filename) : filename_(filename) {
+  auto flag = O_RDWR | O_CREAT | O_TRUNC;
+#if defined(__MINGW64__)
+  flag |= O_BINARY;
+#endif
+  fd_ = ::open(filename.c_str(), flag, 0644);
+  if (fd_ < 0) {
+    throw DBException("::open file {} error! Error: {}", filename, errno);
+  }
+}
+
+LogWriter::~LogWriter() {
+#if defined(__linux__)
+  if (map_ != nullptr) {
+    ::munmap(map_, capacity_);
+  }
+  // Cut the zero tail. The records are in the page cache already.
+  if (::ftruncate(fd_, size_) < 0) {
+    DB_INFO("::ftruncate {} Error: {}", filename_, errno);
+  }
+#else
+  if (!buffer_.empty()) {
+    Flush();
+  }
+#endif
+  ::close(fd_);
+}
+
+char* LogWriter::Reserve(size_t n) {
+#if defined(__linux__)
+  if (size_ + n > capacity_) {
+    size_t capacity = std::max(capacity_ * 2, size_ + n + kLogChunkSize);
+    if (::ftruncate(fd_, capacity) < 0) {
+      throw DBException("::ftruncate Error! Error: {}", errno);
+    }
+    void* map =
+        ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (map == MAP_FAILED) {
+      throw DBException("::mmap Error! Error: {}", errno);
+    }
+    if (map_ != nullptr) {
+      ::munmap(map_, capacity_);
+    }
+    map_ = reinterpret_cast<char*>(map);
+    capacity_ = capacity;
+  }
+  return map_ + size_;
+#else
+  size_t pos = buffer_.size();
+  buffer_.resize(pos + n);
+  return buffer_.data() + pos;
+#endif
+}
+
+void LogWriter::AddRecord(ParsedKey key, Slice value) {
+  offset_t payload_size =
+      sizeof(offset_t) * 2 + key.size() + value.size();
+  char* record = Reserve(kLogHeaderSize + payload_size);
+  char* payload = record + kLogHeaderSize;
+  utils::Serializer(payload)
+      .Write<offset_t>(key.size())
+      .WriteString(key.user_key_)
+      .Write<seq_t>(key.seq_)
+      .Write<RecordType>(key.type_)
+      .Write<offset_t>(value.size())
+      .WriteString(value);
+  utils::Serializer(record)
+      .Write<uint64_t>(utils::Hash(payload, payload_size, kLogChecksumSeed))
+      .Write<offset_t>(payload_size);
+  size_ += kLogHeaderSize + payload_size;
+  GetStatsContext()->total_wal_bytes.fetch_add(
+      kLogHeaderSize + payload_size, std::memory_order_relaxed);
+}
+
+void LogWriter::Flush() {
+#if !defined(__linux__)
+  size_t written = 0;
+  while (written < buffer_.size()) {
+    ssize_t ret =
+        ::write(fd_, buffer_.data() + written, buffer_.size() - written);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw DBException("::write Error! Error: {}", errno);
+    }
+    written += ret;
+  }
+  buffer_.clear();
+#endif
+}
+
+void LogWriter::Sync() {
+#if defined(__linux__)
+  // It also writes back the pages dirtied through the mapping.
+  int ret = ::fdatasync(fd_);
+#elif defined(__MINGW64__)
+  int ret = ::_commit(fd_);
+#else
+  int ret = ::fsync(fd_);
+#endif
+  if (ret < 0) {
+    throw DBException("::fdatasync Error! Error: {}", errno);
+  }
+}
+
+LogReader::LogReader(const std::string& filename) {
+  size_t size = std::filesystem::file_size(filename);
+  data_.resize(size);
+  if (size > 0) {
+    ReadFile(filename, false).Read(data_.data(), size, 0);
+  }
+}
+
+bool LogReader::ReadRecord(ParsedKey* key, Slice* value) {
+  if (offset_ + kLogHeaderSize > data_.size()) {
+    return false;
+  }
+  auto header = utils::Deserializer(data_.data() + offset_);
+  auto checksum = header.Read<uint64_t>();
+  auto payload_size = header.Read<offset_t>();
+  if (offset_ + kLogHeaderSize + payload_size > data_.size() ||
+      payload_size < sizeof(offset_t) * 2) {
+    return false;
+  }
+  const char* payload = header.data();
+  if (utils::Hash(payload, payload_size, kLogChecksumSeed) != checksum) {
+    return false;
+  }
+  auto key_size = *reinterpret_cast<const offset_t*>(payload);
+  *key = ParsedKey(Slice(payload + sizeof(offset_t), key_size));
+  auto value_size =
+      *reinterpret_cast<const offset_t*>(payload + sizeof(offset_t) + key_size);
+  *value = Slice(payload + sizeof(offset_t) * 2 + key_size, value_size);
+  offset_ += kLogHeaderSize + payload_size;
+  return true;
+}
+
+std::string LogFileName(const std::string& db_path, uint64_t log_number) {
+  return fmt::format("{}/{}.log", db_path, log_number);
+}
+
+bool ParseLogFileName(const std::string& filename, uint64_t* log_number) {
+  auto name = std::filesystem::path(filename).filename().string();
+  if (name.size() <= 4 || name.substr(name.size() - 4) != ".log") {
+    return false;
+  }
+  uint64_t ret = 0;
+  for (size_t i = 0; i + 4 < name.size(); i++) {
+    if (name[i] < '0' || name[i] > '9') {
+      return false;
+    }
+    ret = ret * 10 + (name[i] - '0');
+  }
+  *log_number = ret;
+  return true;
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+
+#include "storage/lsm/common.hpp"
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * The write-ahead log of a MemTable.
+ *
+ * Each record is stored as
+ * | checksum (8B) | payload length (4B) | payload |
+ * and the payload is
+ * | key length (4B) | internal key | value length (4B) | value |
+ * The checksum is the hash of the payload. A torn record at the end of the
+ * file (e.g. the process crashes while writing it) fails the check and is
+ * ignored during recovery.
+ *
+ * On Linux the file is mapped with MAP_SHARED and records are copied into
+ * the mapping, so that they are in the page cache (and survive a crash of
+ * the process) without a system call per write. The file grows in chunks,
+ * and the tail of the last chunk is zero, which ends the recovery like a
+ * torn record. Otherwise records are buffered and written with ::write.
+ */
+class LogWriter {
+ public:
+  LogWriter(const std::string& filename);
+
+  ~LogWriter();
+
+  LogWriter(const LogWriter&) = delete;
+  LogWriter(LogWriter&&) = delete;
+  LogWriter& operator=(const LogWriter&) = delete;
+  LogWriter& operator=(LogWriter&&) = delete;
+
+  /* Append a record to the log. */
+  void AddRecord(ParsedKey key, Slice value);
+
+  /* Write all the buffered records to the file. */
+  void Flush();
+
+  /* Make the written records durable. */
+  void Sync();
+
+  /* The number of bytes of the records (including buffered bytes). */
+  size_t size() const { return size_; }
+
+ private:
+  /* Return the address where the next n bytes are stored. */
+  char* Reserve(size_t n);
+
+  int fd_;
+  std::string filename_;
+#if defined(__linux__)
+  /* The mapping of the file. */
+  char* map_{nullptr};
+  /* The size of the file and the mapping. */
+  size_t capacity_{0};
+#else
+  /* The records that have not been written. */
+  std::string buffer_;
+#endif
+  size_t size_{0};
+};
+
+class LogReader {
+ public:
+  LogReader(const std::string& filename);
+
+  /**
+   * Read the next record. The returned key and value are valid until the
+   * LogReader is destroyed.
+   * Return false if it reaches the end of the log or a corrupted record.
+   */
+  bool ReadRecord(ParsedKey* key, Slice* value);
+
+ private:
+  /* The content of the log file. */
+  std::string data_;
+  size_t offset_{0};
+};
+
+/* The file name of the log with number log_number. */
+std::string LogFileName(const std::string& db_path, uint64_t log_number);
+
+/**
+ * Parse the log number from a file name.
+ * Return false if it is not a log file.
+ */
+bool ParseLogFileName(const std::string& filename, uint64_t* log_number);
+
+}  // namespace lsm
+
+}  // namespace wing
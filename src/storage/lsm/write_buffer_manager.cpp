@@ -0,0 +1,49 @@
+#include "storage/lsm/write_buffer_manager.hpp"
+
+#include <algorithm>
+
+#include "storage/lsm/lsm.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+void WriteBufferManager::Register(DBImpl *db) {
+  std::unique_lock lck(mutex_);
+  dbs_.push_back(db);
+}
+
+void WriteBufferManager::Unregister(DBImpl *db) {
+  // It waits for MaybeFlush, which may be switching the MemTable of db.
+  std::unique_lock lck(mutex_);
+  dbs_.erase(std::find(dbs_.begin(), dbs_.end(), db));
+}
+
+void WriteBufferManager::MaybeFlush() {
+  if (!ShouldFlush()) {
+    return;
+  }
+  std::unique_lock lck(mutex_, std::try_to_lock);
+  if (!lck.owns_lock()) {
+    return;
+  }
+  while (ShouldFlush()) {
+    DBImpl *largest = nullptr;
+    size_t largest_size = 0;
+    for (auto db : dbs_) {
+      auto size = db->GetSV()->GetMt()->size();
+      if (size > largest_size) {
+        largest = db;
+        largest_size = size;
+      }
+    }
+    if (!largest) {
+      return;
+    }
+    largest->ExclusiveWrite([&]() { largest->SwitchMemtable(true); });
+  }
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace wing {
+
+namespace lsm {
+
+class DBImpl;
+
+/**
+ * It bounds the total size of the MemTables of the DBImpls sharing it. When
+ * the MemTables take too much memory, the largest mutable MemTable among the
+ * DBImpls is switched to an immutable one, so that it is flushed, even if the
+ * DBImpl which owns it is not written any more.
+ */
+class WriteBufferManager {
+ public:
+  explicit WriteBufferManager(size_t buffer_size)
+    : buffer_size_(buffer_size), mutable_limit_(buffer_size / 8 * 7) {}
+
+  size_t buffer_size() const { return buffer_size_; }
+
+  /* The total size of the mutable and the immutable MemTables. */
+  size_t memory_usage() const {
+    return memory_usage_.load(std::memory_order_relaxed);
+  }
+
+  size_t mutable_memory_usage() const {
+    return mutable_memory_usage_.load(std::memory_order_relaxed);
+  }
+
+  /* A mutable MemTable grows by bytes. */
+  void ReserveMem(size_t bytes) {
+    memory_usage_.fetch_add(bytes, std::memory_order_relaxed);
+    mutable_memory_usage_.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  /* A mutable MemTable of bytes becomes immutable. */
+  void ScheduleFreeMem(size_t bytes) {
+    mutable_memory_usage_.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+
+  /* An immutable MemTable of bytes is flushed or dropped. */
+  void FreeMem(size_t bytes) {
+    memory_usage_.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+
+  /**
+   * The mutable MemTables take most of the budget, or the budget is exceeded
+   * and at least half of it can be freed by switching MemTables. The
+   * immutable MemTables are being flushed, so switching more MemTables does
+   * not help if they take the budget.
+   */
+  bool ShouldFlush() const {
+    if (buffer_size_ == 0) {
+      return false;
+    }
+    return mutable_memory_usage() > mutable_limit_ ||
+           (memory_usage() >= buffer_size_ &&
+               mutable_memory_usage() >= buffer_size_ / 2);
+  }
+
+  void Register(DBImpl *db);
+
+  void Unregister(DBImpl *db);
+
+  /**
+   * Switch the largest mutable MemTable of the registered DBImpls while
+   * ShouldFlush. The writers call it after they release the locks of their
+   * DBImpls. Only one of them switches MemTables at a time, and the others
+   * return immediately.
+   */
+  void MaybeFlush();
+
+ private:
+  const size_t buffer_size_;
+  const size_t mutable_limit_;
+  std::atomic<size_t> memory_usage_{0};
+  std::atomic<size_t> mutable_memory_usage_{0};
+  /* It protects dbs_, and is held while switching MemTables. */
+  std::mutex mutex_;
+  std::vector<DBImpl *> dbs_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
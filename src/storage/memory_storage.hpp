@@ -60,6 +60,16 @@ class MemoryTable {
     bool Update(std::string_view key, std::string_view tuple) override {
       return table_.Update(key, tuple);
     }
+    bool BulkInsert(
+        std::span<const std::pair<std::string_view, std::string_view>> rows)
+        override {
+      for (auto [key, tuple] : rows) {
+        if (!table_.Insert(key, tuple)) {
+          return false;
+        }
+      }
+      return true;
+    }
 
    private:
     MemoryTable& table_;
@@ -72,6 +82,14 @@ class MemoryTable {
     const uint8_t* Search(std::string_view key) override {
       return table_.Search(key);
     }
+    std::vector<const uint8_t*> MultiSearch(
+        std::span<const std::string_view> keys) override {
+      std::vector<const uint8_t*> ret;
+      for (auto key : keys) {
+        ret.push_back(table_.Search(key));
+      }
+      return ret;
+    }
 
    private:
     MemoryTable& table_;
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <memory>
+#include <span>
+#include <utility>
 #include <vector>
 
 #include "catalog/schema.hpp"
@@ -34,6 +36,13 @@ class ModifyHandle {
   virtual bool Delete(std::string_view key) = 0;
   virtual bool Insert(std::string_view key, std::string_view value) = 0;
   virtual bool Update(std::string_view key, std::string_view new_value) = 0;
+  /**
+   * Insert a batch of rows, e.g., the rows of an INSERT statement. It returns
+   * false if a key is duplicate. The storage may load a large batch at once
+   * instead of inserting the rows one by one.
+   */
+  virtual bool BulkInsert(
+      std::span<const std::pair<std::string_view, std::string_view>> rows) = 0;
 };
 
 /**
@@ -53,6 +62,13 @@ class SearchHandle {
   virtual ~SearchHandle() = default;
   virtual void Init() = 0;
   virtual const uint8_t* Search(std::string_view key) = 0;
+  /**
+   * Search a batch of keys, e.g., the keys of a TupleBatch. The i-th result is
+   * the same as Search(keys[i]). The results are valid until the next
+   * Search() or MultiSearch() is called.
+   */
+  virtual std::vector<const uint8_t*> MultiSearch(
+      std::span<const std::string_view> keys) = 0;
 };
 
 class Storage {
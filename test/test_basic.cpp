@@ -3,6 +3,7 @@
 #include <filesystem>
 
 #include "common/bloomfilter.hpp"
+#include "common/xorfilter.hpp"
 #include "common/threadpool.hpp"
 #include "instance/instance.hpp"
 #include "test.hpp"
@@ -674,3 +675,56 @@ TEST(UtilsTest, BloomFilter) {
   DB_INFO("{}", fp / (double)N);
   ASSERT_TRUE(fp / (double)N <= 0.01);
 }
+
+TEST(UtilsTest, BlockedBloomFilter) {
+  using wing::utils::BlockedBloomFilter;
+  using wing::utils::BloomFilter;
+  std::string bf;
+  size_t N = 1e5;
+  BlockedBloomFilter::Create(N, 10, bf);
+  auto kv = wing::wing_testing::GenKVData(0x202404161530, 2 * N, 10, 9);
+  for (uint32_t i = 0; i < N; i++) {
+    BlockedBloomFilter::Add(kv[i].key(), bf);
+  }
+  for (uint32_t i = 0; i < N; i++) {
+    ASSERT_TRUE(BlockedBloomFilter::Find(kv[i].key(), bf));
+  }
+  size_t fp = 0;
+  for (uint32_t i = N; i < 2 * N; i++) {
+    auto h = BloomFilter::BloomHash(kv[i].key());
+    bool found = BlockedBloomFilter::Find(h, bf);
+    /* The SIMD kernel and the portable kernel must agree. */
+    ASSERT_EQ(found, BlockedBloomFilter::FindPortable(h, bf));
+    fp += found;
+  }
+  DB_INFO("{}", fp / (double)N);
+  ASSERT_TRUE(fp / (double)N <= 0.02);
+}
+
+TEST(UtilsTest, XorFilter) {
+  using wing::utils::BloomFilter;
+  using wing::utils::XorFilter;
+  std::string bf;
+  size_t N = 1e5;
+  auto kv = wing::wing_testing::GenKVData(0x202404171501, 2 * N, 10, 9);
+  std::vector<size_t> hashes;
+  for (uint32_t i = 0; i < N; i++) {
+    hashes.push_back(BloomFilter::BloomHash(kv[i].key()));
+  }
+  /* Duplicated keys are allowed. */
+  for (uint32_t i = 0; i < N; i += 7) {
+    hashes.push_back(BloomFilter::BloomHash(kv[i].key()));
+  }
+  XorFilter::Build(hashes, bf);
+  DB_INFO("bits per key: {}", bf.size() * 8 / (double)N);
+  ASSERT_TRUE(bf.size() * 8 <= N * 10);
+  for (uint32_t i = 0; i < N; i++) {
+    ASSERT_TRUE(XorFilter::Find(BloomFilter::BloomHash(kv[i].key()), bf));
+  }
+  size_t fp = 0;
+  for (uint32_t i = N; i < 2 * N; i++) {
+    fp += XorFilter::Find(BloomFilter::BloomHash(kv[i].key()), bf);
+  }
+  DB_INFO("{}", fp / (double)N);
+  ASSERT_TRUE(fp / (double)N <= 0.006);
+}
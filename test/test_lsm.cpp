@@ -1,6 +1,7 @@
 #include "common/stopwatch.hpp"
 #include "gtest/gtest.h"
 #include "storage/lsm/block.hpp"
+#include "storage/lsm/bulk_load.hpp"
 #include "storage/lsm/compaction_job.hpp"
 #include "storage/lsm/file.hpp"
 #include "storage/lsm/iterator_heap.hpp"
@@ -80,6 +81,53 @@ TEST(LSMTest, MemTableSmallTest) {
     f.get();
 }
 
+TEST(LSMTest, MemTableSkipListTest) {
+  MemTable t(MemTableType::kSkipList);
+  MemTable ref(MemTableType::kMap);
+  size_t n = 100000, TH = 4;
+  auto kv = GenKVData(0x202404061544, n, 13, 32);
+  std::atomic<bool> stop{false};
+  std::vector<std::future<void>> pool;
+  /* Readers scan the skiplist while the writer inserts. */
+  for (uint32_t i = 0; i < TH; i++) {
+    pool.push_back(std::async([&]() {
+      while (!stop) {
+        size_t count = 0;
+        std::string last;
+        for (auto it = t.Begin(); it.Valid(); it.Next()) {
+          std::string key(ParsedKey(it.key()).user_key_);
+          ASSERT_TRUE(count == 0 || last < key);
+          last = std::move(key);
+          count += 1;
+        }
+        ASSERT_LE(count, n);
+      }
+    }));
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    t.Put(kv[i].key(), i + 1, kv[i].value());
+    ref.Put(kv[i].key(), i + 1, kv[i].value());
+  }
+  stop = true;
+  for (auto& f : pool)
+    f.get();
+  ASSERT_EQ(t.size(), ref.size());
+  auto it = t.Begin();
+  auto ref_it = ref.Begin();
+  for (; ref_it.Valid(); ref_it.Next(), it.Next()) {
+    ASSERT_TRUE(it.Valid());
+    ASSERT_EQ(it.key(), ref_it.key());
+    ASSERT_EQ(it.value(), ref_it.value());
+  }
+  ASSERT_FALSE(it.Valid());
+  for (uint32_t i = 0; i < n; i++) {
+    std::string value;
+    ASSERT_EQ(t.Get(kv[i].key(), i, &value), GetResult::kNotFound);
+    ASSERT_EQ(t.Get(kv[i].key(), n, &value), GetResult::kFound);
+    ASSERT_EQ(value, kv[i].value());
+  }
+}
+
 TEST(LSMTest, FileWriterTest) {
   FileWriter writer(
       std::make_unique<SeqWriteFile>("__tmpLSMFileWriterTest", false), 4096);
@@ -214,67 +262,42 @@ TEST(LSMTest, SSTableTest) {
   std::remove("__tmpLSMSSTableTest");
 }
 
-TEST(LSMTest, SortedRunTest) {
-  uint32_t klen = 9, vlen = 13, N = 3e6, fileN = 10;
-  auto kv =
-      GenKVDataWithRandomLen(0x202403191425, N, {klen - 1, klen}, {1, vlen});
+TEST(LSMTest, SSTableBlockCacheTest) {
+  SSTableBuilder builder(
+      std::make_unique<FileWriter>(
+          std::make_unique<SeqWriteFile>("__tmpLSMSSTableBlockCacheTest", false),
+          4096),
+      4096, 10);
+  uint32_t klen = 9, vlen = 13, N = 1e4;
+  auto kv = GenKVData(0x202404021530, N, klen, vlen);
   std::sort(kv.begin(), kv.end());
-  /* Create 10 SSTables */
-  wing::StopWatch sw;
-  std::vector<SSTInfo> sst_infos;
-  for (uint32_t i = 0; i < fileN; i++) {
-    auto L = (i) * (N / fileN);
-    auto R = std::min((i + 1) * (N / fileN), N);
-    SSTableBuilder builder(
-        std::make_unique<FileWriter>(
-            std::make_unique<SeqWriteFile>(
-                fmt::format("__tmpSortedRunTest{}", i), false),
-            1 << 20),
-        4096, 10);
-    /* Build the SSTable */
-    for (uint32_t j = L; j < R; j++) {
-      builder.Append(
-          ParsedKey(kv[j].key(), 1, RecordType::Value), kv[j].value());
-    }
-    builder.Finish();
-    /* Add the SSTable*/
-    SSTInfo info;
-    info.count_ = builder.count();
-    info.filename_ = fmt::format("__tmpSortedRunTest{}", i);
-    info.index_offset_ = builder.GetIndexOffset();
-    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
-    info.size_ = builder.size();
-    info.sst_id_ = i;
-    sst_infos.emplace_back(info);
-  }
-  DB_INFO("Create Sorted Run Cost: {}s", sw.GetTimeInSeconds());
-  sw.Reset();
-  SortedRun sr(sst_infos, 4096, false);
-  /* Test SortedRun::Get */
   for (uint32_t i = 0; i < N; i++) {
-    std::string value;
-    ASSERT_EQ(sr.Get(kv[i].key(), 1, &value), GetResult::kFound);
-    ASSERT_EQ(value, kv[i].value());
+    builder.Append(ParsedKey(kv[i].key(), 1, RecordType::Value), kv[i].value());
   }
-  DB_INFO("SortedRun::Get Cost: {}s", sw.GetTimeInSeconds());
-  sw.Reset();
-  /* Test SortedRun::Seek */
-  for (uint32_t i = 0; i < 500; i++) {
-    size_t step = (N / 499);
-    size_t id = i * step;
-    auto it = sr.Seek(kv[id].key(), 1);
-    for (uint32_t j = id; j < N && j < id + step * 10; j++) {
-      ASSERT_TRUE(it.Valid());
-      ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[j].key());
-      ASSERT_EQ(it.value(), kv[j].value());
-      it.Next();
+  builder.Finish();
+  SSTInfo info;
+  info.count_ = N;
+  info.size_ = builder.size();
+  info.filename_ = "__tmpLSMSSTableBlockCacheTest";
+  info.index_offset_ = builder.GetIndexOffset();
+  info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+  info.sst_id_ = 0;
+  /* The cache is large enough to hold all the data blocks */
+  Cache cache(CacheOptions{1 << 20});
+  SSTable sst(info, 4096, false, &cache);
+  for (uint32_t round = 0; round < 2; round++) {
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_EQ(sst.Get(kv[i].key(), 1, &value), GetResult::kFound);
+      ASSERT_EQ(value, kv[i].value());
     }
   }
-  DB_INFO("Short Range Scan Cost: {}s", sw.GetTimeInSeconds());
-  sw.Reset();
-  /* Test SortedRun::Begin */
+  /* Every data block is read from the file exactly once. */
+  ASSERT_EQ(sst.GetCacheMissCount(), builder.GetIndexData().size());
+  ASSERT_EQ(sst.GetCacheHitCount() + sst.GetCacheMissCount(), 2 * N);
+  /* Iterators pin the blocks in the cache */
   {
-    auto it = sr.Begin();
+    auto it = sst.Begin();
     for (uint32_t i = 0; i < N; i++) {
       ASSERT_TRUE(it.Valid());
       ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[i].key());
@@ -283,86 +306,755 @@ TEST(LSMTest, SortedRunTest) {
     }
     ASSERT_FALSE(it.Valid());
   }
-  DB_INFO("Full Scan Cost: {}s", sw.GetTimeInSeconds());
-  /* Delete all SSTables */
-  for (uint32_t i = 0; i < fileN * 2; i++) {
-    std::remove(fmt::format("__tmpSortedRunTest{}", i).c_str());
+  ASSERT_EQ(sst.GetCacheMissCount(), builder.GetIndexData().size());
+  std::remove("__tmpLSMSSTableBlockCacheTest");
+}
+
+TEST(LSMTest, SSTableScanResistantCacheTest) {
+  SSTableBuilder builder(
+      std::make_unique<FileWriter>(
+          std::make_unique<SeqWriteFile>(
+              "__tmpLSMSSTableScanResistantCacheTest", false),
+          4096),
+      4096, 10);
+  uint32_t klen = 9, vlen = 13, N = 1e5;
+  auto kv = GenKVData(0x202410171530, N, klen, vlen);
+  std::sort(kv.begin(), kv.end());
+  for (uint32_t i = 0; i < N; i++) {
+    builder.Append(ParsedKey(kv[i].key(), 1, RecordType::Value), kv[i].value());
+  }
+  builder.Finish();
+  SSTInfo info;
+  info.count_ = N;
+  info.size_ = builder.size();
+  info.filename_ = "__tmpLSMSSTableScanResistantCacheTest";
+  info.index_offset_ = builder.GetIndexOffset();
+  info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+  info.sst_id_ = 0;
+  /* The cache holds about 1/3 of the data blocks. */
+  ASSERT_GT(info.size_, 3u << 20);
+  /* The hot records take about 1/4 of the cache. */
+  uint32_t hot = N / 12;
+  for (auto [policy, fill_cache] :
+      std::vector<std::pair<CachePolicyType, CacheFill>>{
+          {CachePolicyType::kLRU, CacheFill::kHighPriority},
+          {CachePolicyType::kLRU, CacheFill::kLowPriority},
+          {CachePolicyType::kTinyLFU, CacheFill::kHighPriority},
+          {CachePolicyType::kTinyLFU, CacheFill::kLowPriority}}) {
+    Cache cache(CacheOptions{1 << 20, policy});
+    SSTable sst(info, 4096, false, &cache);
+    for (uint32_t round = 0; round < 3; round++) {
+      for (uint32_t i = 0; i < hot; i++) {
+        std::string value;
+        ASSERT_EQ(sst.Get(kv[i].key(), 1, &value), GetResult::kFound);
+      }
+    }
+    {
+      auto it = sst.Begin(fill_cache);
+      for (uint32_t i = 0; i < N; i++) {
+        ASSERT_TRUE(it.Valid());
+        ASSERT_EQ(it.value(), kv[i].value());
+        it.Next();
+      }
+      ASSERT_FALSE(it.Valid());
+    }
+    size_t miss = sst.GetCacheMissCount();
+    for (uint32_t i = 0; i < hot; i++) {
+      std::string value;
+      ASSERT_EQ(sst.Get(kv[i].key(), 1, &value), GetResult::kFound);
+    }
+    miss = sst.GetCacheMissCount() - miss;
+    if (policy == CachePolicyType::kLRU &&
+        fill_cache == CacheFill::kHighPriority) {
+      /* The scan flushes the hot blocks out of an LRU cache. */
+      ASSERT_GT(miss, 0u);
+    } else {
+      /* The hot blocks survive the scan. */
+      ASSERT_EQ(miss, 0u);
+    }
   }
+  std::remove("__tmpLSMSSTableScanResistantCacheTest");
 }
 
-TEST(LSMTest, IteratorHeapTest) {
-  uint32_t klen = 9, vlen = 50, N = 1e6, fileN = 10;
-  auto kv = GenKVData(0x202403152328, N, klen, vlen);
-  std::vector<std::shared_ptr<SSTable>> ssts;
-  /* Create 20 SSTables */
-  for (uint32_t i = 0; i < fileN * 2; i++) {
-    auto L = (i >= fileN ? i - fileN : i) * (N / fileN);
-    auto R = std::min(L + (N / fileN), N);
-    std::sort(kv.begin() + L, kv.begin() + R);
+TEST(LSMTest, SSTableShardedCacheTest) {
+  /* Each shard has at least 512 KiB, and there are at most 64 shards. */
+  ASSERT_EQ(Cache(CacheOptions{256 << 10}).shard_count(), 1u);
+  ASSERT_EQ(Cache(CacheOptions{1 << 20}).shard_count(), 2u);
+  ASSERT_EQ(Cache(CacheOptions{8 << 20}).shard_count(), 16u);
+  ASSERT_EQ(Cache(CacheOptions{1 << 30}).shard_count(), 64u);
+  ASSERT_EQ(
+      Cache(CacheOptions{1 << 20, CachePolicyType::kLRU, 3}).shard_count(), 8u);
+  SSTableBuilder builder(
+      std::make_unique<FileWriter>(
+          std::make_unique<SeqWriteFile>(
+              "__tmpLSMSSTableShardedCacheTest", false),
+          4096),
+      4096, 10);
+  uint32_t klen = 9, vlen = 13, N = 1e4, TH = 8;
+  auto kv = GenKVData(0x202410171620, N, klen, vlen);
+  std::sort(kv.begin(), kv.end());
+  for (uint32_t i = 0; i < N; i++) {
+    builder.Append(ParsedKey(kv[i].key(), 1, RecordType::Value), kv[i].value());
+  }
+  builder.Finish();
+  SSTInfo info;
+  info.count_ = N;
+  info.size_ = builder.size();
+  info.filename_ = "__tmpLSMSSTableShardedCacheTest";
+  info.index_offset_ = builder.GetIndexOffset();
+  info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+  info.sst_id_ = 0;
+  /* The small cache evicts blocks while other threads pin and release them. */
+  for (size_t capacity : {64u << 10, 16u << 20}) {
+    Cache cache(CacheOptions{capacity, CachePolicyType::kTinyLFU, 3});
+    SSTable sst(info, 4096, false, &cache);
+    std::vector<std::thread> pool;
+    for (uint32_t t = 0; t < TH; t++) {
+      pool.emplace_back([&, seed = t]() {
+        std::mt19937_64 rgen(0x202410171620 + seed);
+        for (uint32_t i = 0; i < N; i++) {
+          uint32_t id = rgen() % N;
+          std::string value;
+          ASSERT_EQ(sst.Get(kv[id].key(), 1, &value), GetResult::kFound);
+          ASSERT_EQ(value, kv[id].value());
+        }
+        auto it = sst.Begin();
+        for (uint32_t i = 0; i < N; i++) {
+          ASSERT_TRUE(it.Valid());
+          ASSERT_EQ(it.value(), kv[i].value());
+          it.Next();
+        }
+      });
+    }
+    for (auto& f : pool) {
+      f.join();
+    }
+    if (capacity == 16u << 20) {
+      /* All the blocks stay in the cache. */
+      size_t miss = sst.GetCacheMissCount();
+      for (uint32_t i = 0; i < N; i++) {
+        std::string value;
+        ASSERT_EQ(sst.Get(kv[i].key(), 1, &value), GetResult::kFound);
+      }
+      ASSERT_EQ(sst.GetCacheMissCount(), miss);
+    }
+  }
+  std::remove("__tmpLSMSSTableShardedCacheTest");
+}
+
+TEST(LSMTest, SSTableFormatTest) {
+  uint32_t N = 2e4;
+  /* The keys share long prefixes, like the keys of a table. */
+  std::vector<std::pair<std::string, std::string>> kv;
+  for (uint32_t i = 0; i < N; i++) {
+    kv.emplace_back(fmt::format("table_orders.pk.{:010}", i * 7),
+        fmt::format("value{}", i));
+  }
+  std::vector<size_t> sizes;
+  for (auto [version, restart_interval] :
+      std::vector<std::pair<uint32_t, size_t>>{
+          {kLegacyFormatVersion, 16}, {kPrefixFormatVersion, 1},
+          {kPrefixFormatVersion, 16}}) {
     SSTableBuilder builder(
         std::make_unique<FileWriter>(
-            std::make_unique<SeqWriteFile>(
-                fmt::format("__tmpLSMIteratorHeapTest{}", i), false),
+            std::make_unique<SeqWriteFile>("__tmpLSMSSTableFormatTest", false),
             4096),
-        4096, 10);
-    /* Build the SSTable */
-    for (uint32_t j = L; j < R; j++) {
-      builder.Append(
-          ParsedKey(kv[j].key(), i >= fileN ? 114514 : 1, RecordType::Value),
-          kv[j].value());
+        4096, 10, restart_interval, CompressionType::kNone, version);
+    for (auto& [k, v] : kv) {
+      builder.Append(ParsedKey(k, 1, RecordType::Value), v);
     }
     builder.Finish();
-    /* Add the SSTable*/
+    sizes.push_back(builder.size());
     SSTInfo info;
-    info.count_ = builder.count();
-    info.filename_ = fmt::format("__tmpLSMIteratorHeapTest{}", i);
+    info.count_ = N;
+    info.size_ = builder.size();
+    info.filename_ = "__tmpLSMSSTableFormatTest";
     info.index_offset_ = builder.GetIndexOffset();
     info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
-    info.size_ = builder.size();
-    info.sst_id_ = i;
-    ssts.emplace_back(std::make_shared<SSTable>(info, 4096, false));
+    info.sst_id_ = 0;
+    SSTable sst(info, 4096, false);
+    ASSERT_EQ(sst.GetFormatVersion(), version);
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_EQ(sst.Get(kv[i].first, 1, &value), GetResult::kFound);
+      ASSERT_EQ(value, kv[i].second);
+      /* A key between two keys. */
+      auto it = sst.Seek(kv[i].first + "0", 1);
+      if (i + 1 < N) {
+        ASSERT_TRUE(it.Valid());
+        ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[i + 1].first);
+        ASSERT_EQ(it.value(), kv[i + 1].second);
+      } else {
+        ASSERT_FALSE(it.Valid());
+      }
+    }
+    size_t count = 0;
+    for (auto it = sst.Begin(); it.Valid(); it.Next()) {
+      ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[count].first);
+      ASSERT_EQ(it.value(), kv[count].second);
+      count += 1;
+    }
+    ASSERT_EQ(count, N);
   }
-  /* Add the iterators of the SSTables */
-  IteratorHeap<SSTableIterator> its;
-  std::vector<SSTableIterator> sst_its;
-  for (auto& sst : ssts) {
-    sst_its.push_back(sst->Begin());
+  DB_INFO("SSTable sizes: legacy {}, restart interval 1 {}, 16 {}", sizes[0],
+      sizes[1], sizes[2]);
+  ASSERT_LT(sizes[2], sizes[1]);
+  ASSERT_LT(sizes[1], sizes[0]);
+  std::remove("__tmpLSMSSTableFormatTest");
+}
+
+TEST(LSMTest, SSTableCompressionTest) {
+  uint32_t N = 2e4;
+  /* The values are compressible. */
+  std::vector<std::pair<std::string, std::string>> kv;
+  for (uint32_t i = 0; i < N; i++) {
+    kv.emplace_back(fmt::format("key{:010}", i),
+        fmt::format("value-of-key-{:04}-value-of-key", i % 100));
   }
-  for (auto& sst : sst_its) {
-    its.Push(&sst);
+  std::vector<size_t> sizes;
+  for (auto compression : {CompressionType::kNone, CompressionType::kLZ}) {
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>(
+                "__tmpLSMSSTableCompressionTest", false),
+            4096),
+        4096, 10, 16, compression);
+    for (auto& [k, v] : kv) {
+      builder.Append(ParsedKey(k, 1, RecordType::Value), v);
+    }
+    builder.Finish();
+    sizes.push_back(builder.size());
+    SSTInfo info;
+    info.count_ = N;
+    info.size_ = builder.size();
+    info.filename_ = "__tmpLSMSSTableCompressionTest";
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.sst_id_ = 0;
+    /* Blocks are decompressed into the cache, or into the iterator. */
+    Cache cache(CacheOptions{1 << 20});
+    for (auto cache_ptr : {&cache, static_cast<Cache*>(nullptr)}) {
+      SSTable sst(info, 4096, false, cache_ptr);
+      for (uint32_t i = 0; i < N; i++) {
+        std::string value;
+        ASSERT_EQ(sst.Get(kv[i].first, 1, &value), GetResult::kFound);
+        ASSERT_EQ(value, kv[i].second);
+      }
+      size_t count = 0;
+      for (auto it = sst.Begin(); it.Valid(); it.Next()) {
+        ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[count].first);
+        ASSERT_EQ(it.value(), kv[count].second);
+        count += 1;
+      }
+      ASSERT_EQ(count, N);
+    }
   }
-  its.Build();
-  std::sort(kv.begin(), kv.end());
-  /* Do merge-sort. */
+  DB_INFO("SSTable sizes: uncompressed {}, compressed {}", sizes[0], sizes[1]);
+  ASSERT_LT(sizes[1], sizes[0]);
+  /* A corrupted block is detected by the checksum. */
+  {
+    std::string block;
+    auto file = std::make_unique<FileWriter>(
+        std::make_unique<SeqWriteFile>("__tmpLSMSSTableCompressionTest", false),
+        4096);
+    BlockBuilder builder(4096, file.get(), 16, CompressionType::kLZ);
+    for (uint32_t i = 0; i < 50; i++) {
+      ASSERT_TRUE(builder.Append(
+          ParsedKey(kv[i].first, 1, RecordType::Value), kv[i].second));
+    }
+    auto size = builder.Finish();
+    file->Flush();
+    ReadFile reader("__tmpLSMSSTableCompressionTest", false);
+    block.resize(size);
+    reader.Read(block.data(), size, 0);
+    std::string buf;
+    ASSERT_EQ(DecodeBlock(block, &buf).size(), builder.size());
+    block[size / 2] ^= 1;
+    ASSERT_DEATH(DecodeBlock(block, &buf), "");
+  }
+  std::remove("__tmpLSMSSTableCompressionTest");
+}
+
+TEST(LSMTest, SSTablePartitionedIndexTest) {
+  uint32_t N = 5e4;
+  std::vector<std::pair<std::string, std::string>> kv;
   for (uint32_t i = 0; i < N; i++) {
-    ASSERT_TRUE(its.Valid());
-    ASSERT_EQ(ParsedKey(its.key()).user_key_, kv[i].key());
-    ASSERT_EQ(ParsedKey(its.key()).seq_, 114514);
-    ASSERT_EQ(its.value(), kv[i].value());
-    its.Next();
-    ASSERT_TRUE(its.Valid());
-    ASSERT_EQ(ParsedKey(its.key()).user_key_, kv[i].key());
-    ASSERT_EQ(ParsedKey(its.key()).seq_, 1);
-    ASSERT_EQ(its.value(), kv[i].value());
-    its.Next();
+    kv.emplace_back(fmt::format("key{:010}", i * 3), fmt::format("value{}", i));
   }
-  ASSERT_FALSE(its.Valid());
-  /* Delete all SSTables */
-  ssts.clear();
-  for (uint32_t i = 0; i < fileN * 2; i++) {
-    std::remove(fmt::format("__tmpLSMIteratorHeapTest{}", i).c_str());
+  /* The size of the index region which is read in construction. */
+  std::vector<size_t> pinned_index_sizes;
+  for (auto version : {kChecksumFormatVersion, kPartitionedIndexFormatVersion}) {
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>(
+                "__tmpLSMSSTablePartitionedIndexTest", false),
+            4096),
+        512, 10, 16, CompressionType::kNone, version);
+    for (auto& [k, v] : kv) {
+      builder.Append(ParsedKey(k, 1, RecordType::Value), v);
+    }
+    builder.Finish();
+    pinned_index_sizes.push_back(
+        builder.GetBloomFilterOffset() - builder.GetIndexOffset());
+    SSTInfo info;
+    info.count_ = N;
+    info.size_ = builder.size();
+    info.filename_ = "__tmpLSMSSTablePartitionedIndexTest";
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.sst_id_ = 0;
+    Cache cache(CacheOptions{16 << 20});
+    for (auto cache_ptr : {&cache, static_cast<Cache*>(nullptr)}) {
+      SSTable sst(info, 512, false, cache_ptr);
+      ASSERT_EQ(sst.GetFormatVersion(), version);
+      for (uint32_t i = 0; i < N; i++) {
+        std::string value;
+        ASSERT_EQ(sst.Get(kv[i].first, 1, &value), GetResult::kFound);
+        ASSERT_EQ(value, kv[i].second);
+        auto it = sst.Seek(kv[i].first + "0", 1);
+        if (i + 1 < N) {
+          ASSERT_TRUE(it.Valid());
+          ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[i + 1].first);
+        } else {
+          ASSERT_FALSE(it.Valid());
+        }
+      }
+      size_t count = 0;
+      for (auto it = sst.Begin(); it.Valid(); it.Next()) {
+        ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[count].first);
+        ASSERT_EQ(it.value(), kv[count].second);
+        count += 1;
+      }
+      ASSERT_EQ(count, N);
+      if (cache_ptr != nullptr && sst.IsIndexPartitioned()) {
+        /* The index partitions are read through the block cache. */
+        ASSERT_GT(sst.GetIndexCacheMissCount(), 0);
+        ASSERT_GT(sst.GetIndexCacheHitCount(), sst.GetIndexCacheMissCount());
+      }
+    }
   }
+  DB_INFO("Pinned index sizes: {}, partitioned {}", pinned_index_sizes[0],
+      pinned_index_sizes[1]);
+  ASSERT_LT(pinned_index_sizes[1] * 10, pinned_index_sizes[0]);
+  std::remove("__tmpLSMSSTablePartitionedIndexTest");
 }
 
-TEST(LSMTest, SuperVersionTest) {
-  auto mt = std::make_shared<MemTable>();
-  auto imms = std::make_shared<std::vector<std::shared_ptr<MemTable>>>();
-  auto version = std::make_shared<Version>();
-  std::filesystem::create_directories("__tmpSuperVersionTest");
-  uint32_t klen = 9, vlen = 50;
-  auto kv_mt = GenKVData(0x202403220134, 1e4, klen, vlen);
-  for (auto& k : kv_mt) {
-    mt->Put(k.key(), 114514, k.value());
+TEST(LSMTest, SSTableUncachedLookupTest) {
+  uint32_t N = 2e5;
+  std::vector<std::pair<std::string, std::string>> kv;
+  for (uint32_t i = 0; i < N; i++) {
+    kv.emplace_back(fmt::format("key{:010}", i * 3), fmt::format("value{}", i));
+  }
+  std::mt19937_64 rgen(0x202410171530);
+  std::vector<uint32_t> ids;
+  for (uint32_t i = 0; i < N; i++) {
+    ids.push_back(rgen() % N);
+  }
+  /* The bytes read and the time of the lookups in each format version. */
+  std::vector<size_t> read_bytes;
+  std::vector<double> times;
+  for (auto version : {kChecksumFormatVersion, kPartitionedIndexFormatVersion}) {
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>(
+                "__tmpLSMSSTableUncachedLookupTest", false),
+            4096),
+        4096, 10, 16, CompressionType::kNone, version);
+    for (auto& [k, v] : kv) {
+      builder.Append(ParsedKey(k, 1, RecordType::Value), v);
+    }
+    builder.Finish();
+    SSTInfo info;
+    info.count_ = N;
+    info.size_ = builder.size();
+    info.filename_ = "__tmpLSMSSTableUncachedLookupTest";
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.sst_id_ = 0;
+    /* Without a block cache, the index partitions are pinned. */
+    SSTable sst(info, 4096, false, nullptr);
+    ASSERT_EQ(sst.GetFormatVersion(), version);
+    auto bytes = GetStatsContext()->total_read_bytes.load();
+    wing::StopWatch sw;
+    for (auto id : ids) {
+      std::string value;
+      ASSERT_EQ(sst.Get(kv[id].first, 1, &value), GetResult::kFound);
+      ASSERT_EQ(value, kv[id].second);
+    }
+    times.push_back(sw.GetTimeInSeconds());
+    read_bytes.push_back(GetStatsContext()->total_read_bytes.load() - bytes);
+  }
+  DB_INFO("Uncached lookup cost: {}s, partitioned {}s", times[0], times[1]);
+  /* The lookups only read the data blocks. */
+  ASSERT_EQ(read_bytes[1], read_bytes[0]);
+  ASSERT_LT(times[1], times[0] * 1.5);
+  std::remove("__tmpLSMSSTableUncachedLookupTest");
+}
+
+TEST(LSMTest, SSTableMmapTest) {
+  uint32_t N = 2e4;
+  std::vector<std::pair<std::string, std::string>> kv;
+  for (uint32_t i = 0; i < N; i++) {
+    kv.emplace_back(fmt::format("key{:010}", i * 3),
+        fmt::format("value-of-key-{:04}-value-of-key", i % 100));
+  }
+  for (auto compression : {CompressionType::kNone, CompressionType::kLZ}) {
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>("__tmpLSMSSTableMmapTest", false),
+            4096),
+        4096, 10, 16, compression);
+    for (auto& [k, v] : kv) {
+      builder.Append(ParsedKey(k, 1, RecordType::Value), v);
+    }
+    builder.Finish();
+    SSTInfo info;
+    info.count_ = N;
+    info.size_ = builder.size();
+    info.filename_ = "__tmpLSMSSTableMmapTest";
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.sst_id_ = 0;
+    Cache cache(CacheOptions{16 << 20});
+    SSTable sst(info, 4096, false, &cache, true);
+    auto read_bytes = GetStatsContext()->total_read_bytes.load();
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_EQ(sst.Get(kv[i].first, 1, &value), GetResult::kFound);
+      ASSERT_EQ(value, kv[i].second);
+      auto it = sst.Seek(kv[i].first + "0", 1);
+      if (i + 1 < N) {
+        ASSERT_TRUE(it.Valid());
+        ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[i + 1].first);
+      } else {
+        ASSERT_FALSE(it.Valid());
+      }
+    }
+    size_t count = 0;
+    for (auto it = sst.Begin(); it.Valid(); it.Next()) {
+      ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[count].first);
+      ASSERT_EQ(it.value(), kv[count].second);
+      count += 1;
+    }
+    ASSERT_EQ(count, N);
+    /* The blocks read in place are counted as read bytes. */
+    ASSERT_GT(GetStatsContext()->total_read_bytes.load(), read_bytes);
+    if (compression == CompressionType::kNone) {
+      /* Uncompressed blocks are read in place without the block cache. */
+      ASSERT_EQ(sst.GetCacheHitCount() + sst.GetCacheMissCount(), 0);
+    } else {
+      /* Compressed blocks are decompressed once into the block cache. */
+      ASSERT_GT(sst.GetCacheHitCount(), sst.GetCacheMissCount());
+    }
+  }
+  std::remove("__tmpLSMSSTableMmapTest");
+}
+
+TEST(LSMTest, SSTableReadaheadTest) {
+  uint32_t N = 5e4;
+  std::vector<std::pair<std::string, std::string>> kv;
+  for (uint32_t i = 0; i < N; i++) {
+    kv.emplace_back(fmt::format("key{:010}", i * 3), fmt::format("value{}", i));
+  }
+  for (auto compression : {CompressionType::kNone, CompressionType::kLZ}) {
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>(
+                "__tmpLSMSSTableReadaheadTest", false),
+            4096),
+        4096, 10, 16, compression);
+    for (auto& [k, v] : kv) {
+      builder.Append(ParsedKey(k, 1, RecordType::Value), v);
+    }
+    builder.Finish();
+    SSTInfo info;
+    info.count_ = N;
+    info.size_ = builder.size();
+    info.filename_ = "__tmpLSMSSTableReadaheadTest";
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.sst_id_ = 0;
+    Cache cache(CacheOptions{1 << 20});
+    for (auto cache_ptr : {&cache, static_cast<Cache*>(nullptr)}) {
+      SSTable sst(info, 4096, false, cache_ptr);
+      /* Point lookups do not read ahead. */
+      GetStatsContext()->block_readahead = 0;
+      for (uint32_t i = 0; i < N; i += 7) {
+        std::string value;
+        ASSERT_EQ(sst.Get(kv[i].first, 1, &value), GetResult::kFound);
+        ASSERT_EQ(value, kv[i].second);
+      }
+      ASSERT_EQ(GetStatsContext()->block_readahead.load(), 0);
+      /* Short scans do not read ahead either. */
+      {
+        auto it = sst.Seek(kv[N / 2].first, 1);
+        for (uint32_t i = N / 2; i < N / 2 + 200; i++) {
+          ASSERT_EQ(it.value(), kv[i].second);
+          it.Next();
+        }
+      }
+      ASSERT_EQ(GetStatsContext()->block_readahead.load(), 0);
+      /* Scans read ahead, and stop in the middle. */
+      for (uint32_t begin : {0u, N / 3}) {
+        auto it = sst.Seek(kv[begin].first, 1);
+        for (uint32_t i = begin; i < N; i++) {
+          ASSERT_TRUE(it.Valid());
+          ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[i].first);
+          ASSERT_EQ(it.value(), kv[i].second);
+          if (begin > 0 && i == begin + N / 3) {
+            break;
+          }
+          it.Next();
+        }
+      }
+      ASSERT_GT(GetStatsContext()->block_readahead.load(), 0);
+      size_t count = 0;
+      for (auto it = sst.Begin(CacheFill::kNone); it.Valid(); it.Next()) {
+        ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[count].first);
+        count += 1;
+      }
+      ASSERT_EQ(count, N);
+    }
+    /* The cached blocks are not read by the background threads. */
+    Cache large_cache(CacheOptions{16 << 20});
+    SSTable sst(info, 4096, false, &large_cache);
+    for (size_t round = 0; round < 2; round++) {
+      GetStatsContext()->block_readahead = 0;
+      size_t count = 0;
+      for (auto it = sst.Begin(); it.Valid(); it.Next()) {
+        ASSERT_EQ(it.value(), kv[count].second);
+        count += 1;
+      }
+      ASSERT_EQ(count, N);
+      if (round == 0) {
+        ASSERT_GT(GetStatsContext()->block_readahead.load(), 0);
+      } else {
+        ASSERT_EQ(GetStatsContext()->block_readahead.load(), 0);
+      }
+    }
+  }
+  std::remove("__tmpLSMSSTableReadaheadTest");
+}
+
+TEST(LSMTest, SSTableFilterTest) {
+  uint32_t N = 5e4;
+  /* The format version, the requested filter and the filter in the file. */
+  std::vector<std::tuple<uint32_t, FilterType, FilterType>> configs = {
+      {kPartitionedIndexFormatVersion, FilterType::kXor, FilterType::kBloom},
+      {kBlockedBloomFormatVersion, FilterType::kXor, FilterType::kBlockedBloom},
+      {kLatestFormatVersion, FilterType::kBloom, FilterType::kBloom},
+      {kLatestFormatVersion, FilterType::kBlockedBloom,
+          FilterType::kBlockedBloom},
+      {kLatestFormatVersion, FilterType::kXor, FilterType::kXor}};
+  std::vector<SSTInfo> infos;
+  std::vector<std::vector<std::pair<std::string, std::string>>> kvs;
+  for (uint32_t id = 0; id < configs.size(); id++) {
+    auto [version, filter_type, _] = configs[id];
+    auto& kv = kvs.emplace_back();
+    for (uint32_t i = 0; i < N; i++) {
+      kv.emplace_back(
+          fmt::format("key{}.{:010}", id, i * 3), fmt::format("value{}", i));
+    }
+    auto filename = fmt::format("__tmpLSMSSTableFilterTest{}", id);
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>(filename, false), 4096),
+        4096, 10, 16, CompressionType::kNone, version, filter_type);
+    for (uint32_t i = 0; i < N; i++) {
+      /* Some keys have two versions, whose hashes are the same. */
+      if (i % 5 == 0) {
+        builder.Append(ParsedKey(kv[i].first, 2, RecordType::Value), "new");
+      }
+      builder.Append(ParsedKey(kv[i].first, 1, RecordType::Value),
+          kv[i].second);
+    }
+    builder.Finish();
+    SSTInfo info;
+    info.count_ = builder.count();
+    info.size_ = builder.size();
+    info.filename_ = filename;
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.sst_id_ = id;
+    infos.push_back(info);
+  }
+  std::vector<size_t> filter_sizes;
+  for (uint32_t id = 0; id < configs.size(); id++) {
+    SSTable sst(infos[id], 4096, false);
+    ASSERT_EQ(sst.GetFilterType(), std::get<2>(configs[id]));
+    filter_sizes.push_back(sst.GetFilterSize());
+  }
+  DB_INFO("Filter sizes: bloom {}, blocked bloom {}, xor {}",
+      filter_sizes[2], filter_sizes[3], filter_sizes[4]);
+  /* The xor filter has a lower false positive rate in less memory. */
+  ASSERT_LE(filter_sizes[4], filter_sizes[2]);
+  /* A sorted run with different filters. */
+  SortedRun run(infos, 4096, false);
+  for (uint32_t id = 0; id < configs.size(); id++) {
+    auto& kv = kvs[id];
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_EQ(run.Get(kv[i].first, 1, &value), GetResult::kFound);
+      ASSERT_EQ(value, kv[i].second);
+      ASSERT_EQ(run.Get(kv[i].first, 2, &value), GetResult::kFound);
+      ASSERT_EQ(value, i % 5 == 0 ? "new" : kv[i].second);
+      ASSERT_EQ(run.Get(kv[i].first + "0", 2, &value), GetResult::kNotFound);
+    }
+  }
+  for (auto& info : infos) {
+    std::remove(info.filename_.c_str());
+  }
+}
+
+TEST(LSMTest, SortedRunTest) {
+  uint32_t klen = 9, vlen = 13, N = 3e6, fileN = 10;
+  auto kv =
+      GenKVDataWithRandomLen(0x202403191425, N, {klen - 1, klen}, {1, vlen});
+  std::sort(kv.begin(), kv.end());
+  /* Create 10 SSTables */
+  wing::StopWatch sw;
+  std::vector<SSTInfo> sst_infos;
+  for (uint32_t i = 0; i < fileN; i++) {
+    auto L = (i) * (N / fileN);
+    auto R = std::min((i + 1) * (N / fileN), N);
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>(
+                fmt::format("__tmpSortedRunTest{}", i), false),
+            1 << 20),
+        4096, 10);
+    /* Build the SSTable */
+    for (uint32_t j = L; j < R; j++) {
+      builder.Append(
+          ParsedKey(kv[j].key(), 1, RecordType::Value), kv[j].value());
+    }
+    builder.Finish();
+    /* Add the SSTable*/
+    SSTInfo info;
+    info.count_ = builder.count();
+    info.filename_ = fmt::format("__tmpSortedRunTest{}", i);
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.size_ = builder.size();
+    info.sst_id_ = i;
+    sst_infos.emplace_back(info);
+  }
+  DB_INFO("Create Sorted Run Cost: {}s", sw.GetTimeInSeconds());
+  sw.Reset();
+  SortedRun sr(sst_infos, 4096, false);
+  /* Test SortedRun::Get */
+  for (uint32_t i = 0; i < N; i++) {
+    std::string value;
+    ASSERT_EQ(sr.Get(kv[i].key(), 1, &value), GetResult::kFound);
+    ASSERT_EQ(value, kv[i].value());
+  }
+  DB_INFO("SortedRun::Get Cost: {}s", sw.GetTimeInSeconds());
+  sw.Reset();
+  /* Test SortedRun::Seek */
+  for (uint32_t i = 0; i < 500; i++) {
+    size_t step = (N / 499);
+    size_t id = i * step;
+    auto it = sr.Seek(kv[id].key(), 1);
+    for (uint32_t j = id; j < N && j < id + step * 10; j++) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[j].key());
+      ASSERT_EQ(it.value(), kv[j].value());
+      it.Next();
+    }
+  }
+  DB_INFO("Short Range Scan Cost: {}s", sw.GetTimeInSeconds());
+  sw.Reset();
+  /* Test SortedRun::Begin */
+  {
+    auto it = sr.Begin();
+    for (uint32_t i = 0; i < N; i++) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[i].key());
+      ASSERT_EQ(it.value(), kv[i].value());
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+  }
+  DB_INFO("Full Scan Cost: {}s", sw.GetTimeInSeconds());
+  /* Delete all SSTables */
+  for (uint32_t i = 0; i < fileN * 2; i++) {
+    std::remove(fmt::format("__tmpSortedRunTest{}", i).c_str());
+  }
+}
+
+TEST(LSMTest, IteratorHeapTest) {
+  uint32_t klen = 9, vlen = 50, N = 1e6, fileN = 10;
+  auto kv = GenKVData(0x202403152328, N, klen, vlen);
+  std::vector<std::shared_ptr<SSTable>> ssts;
+  /* Create 20 SSTables */
+  for (uint32_t i = 0; i < fileN * 2; i++) {
+    auto L = (i >= fileN ? i - fileN : i) * (N / fileN);
+    auto R = std::min(L + (N / fileN), N);
+    std::sort(kv.begin() + L, kv.begin() + R);
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>(
+                fmt::format("__tmpLSMIteratorHeapTest{}", i), false),
+            4096),
+        4096, 10);
+    /* Build the SSTable */
+    for (uint32_t j = L; j < R; j++) {
+      builder.Append(
+          ParsedKey(kv[j].key(), i >= fileN ? 114514 : 1, RecordType::Value),
+          kv[j].value());
+    }
+    builder.Finish();
+    /* Add the SSTable*/
+    SSTInfo info;
+    info.count_ = builder.count();
+    info.filename_ = fmt::format("__tmpLSMIteratorHeapTest{}", i);
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.size_ = builder.size();
+    info.sst_id_ = i;
+    ssts.emplace_back(std::make_shared<SSTable>(info, 4096, false));
+  }
+  /* Add the iterators of the SSTables */
+  IteratorHeap<SSTableIterator> its;
+  std::vector<SSTableIterator> sst_its;
+  for (auto& sst : ssts) {
+    sst_its.push_back(sst->Begin());
+  }
+  for (auto& sst : sst_its) {
+    its.Push(&sst);
+  }
+  its.Build();
+  std::sort(kv.begin(), kv.end());
+  /* Do merge-sort. */
+  for (uint32_t i = 0; i < N; i++) {
+    ASSERT_TRUE(its.Valid());
+    ASSERT_EQ(ParsedKey(its.key()).user_key_, kv[i].key());
+    ASSERT_EQ(ParsedKey(its.key()).seq_, 114514);
+    ASSERT_EQ(its.value(), kv[i].value());
+    its.Next();
+    ASSERT_TRUE(its.Valid());
+    ASSERT_EQ(ParsedKey(its.key()).user_key_, kv[i].key());
+    ASSERT_EQ(ParsedKey(its.key()).seq_, 1);
+    ASSERT_EQ(its.value(), kv[i].value());
+    its.Next();
+  }
+  ASSERT_FALSE(its.Valid());
+  /* Delete all SSTables */
+  ssts.clear();
+  for (uint32_t i = 0; i < fileN * 2; i++) {
+    std::remove(fmt::format("__tmpLSMIteratorHeapTest{}", i).c_str());
+  }
+}
+
+TEST(LSMTest, SuperVersionTest) {
+  auto mt = std::make_shared<MemTable>();
+  auto imms = std::make_shared<std::vector<std::shared_ptr<MemTable>>>();
+  auto version = std::make_shared<Version>();
+  std::filesystem::create_directories("__tmpSuperVersionTest");
+  uint32_t klen = 9, vlen = 50;
+  auto kv_mt = GenKVData(0x202403220134, 1e4, klen, vlen);
+  for (auto& k : kv_mt) {
+    mt->Put(k.key(), 114514, k.value());
   }
   auto kv_imm1 = GenKVData(0x202403220135, 1e4, klen, vlen);
   auto kv_imm2 = GenKVData(0x202403220136, 1e4, klen, vlen);
@@ -987,24 +1679,70 @@ TEST(LSMTest, LSMSaveTest) {
   std::filesystem::remove_all(options.db_path);
 }
 
-TEST(LSMTest, LSMBigScanTest) {
+TEST(LSMTest, LSMWALRecoveryTest) {
   Options options;
   options.compaction_strategy_name = "leveled";
   options.sst_file_size = 1 << 20;
-  options.db_path = "__tmpLSMBigScanTest/";
+  options.db_path = "__tmpLSMWALRecoveryTest/";
   std::filesystem::remove_all(options.db_path);
   std::filesystem::create_directories(options.db_path);
-  auto lsm = DBImpl::Create(options);
-  GetStatsContext()->Reset();
-
-  uint32_t klen = 10, vlen = 514, N = 3e6;
+  uint32_t klen = 10, vlen = 100, N = 5e4;
   auto kv =
-      GenKVDataWithRandomLen(0x202403180237, N, {klen - 1, klen}, {1, vlen});
-  std::mt19937_64 rgen(0x202403180238);
-
-  /* Insert all key-value pairs into LSM tree */
-  wing::StopWatch sw;
-  wing::wing_testing::TestTimeout(
+      GenKVDataWithRandomLen(0x202404061012, N, {klen - 1, klen}, {1, vlen});
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+    }
+    for (uint32_t i = 0; i < N / 10; i++) {
+      lsm->Del(kv[i].key());
+    }
+    lsm->WaitForFlushAndCompaction();
+    /* Crash without flushing the MemTable or saving the metadata. */
+    DBImpl::SimulateCrash(std::move(lsm));
+  }
+
+  {
+    options.create_new = false;
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      if (i < N / 10) {
+        ASSERT_FALSE(lsm->Get(kv[i].key(), &value));
+      } else {
+        ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+        ASSERT_EQ(value, kv[i].value());
+      }
+    }
+    /* New writes are not mixed up with the recovered ones. */
+    lsm->Put(kv[0].key(), kv[0].value());
+    std::string value;
+    ASSERT_TRUE(lsm->Get(kv[0].key(), &value));
+    ASSERT_EQ(value, kv[0].value());
+    lsm->WaitForFlushAndCompaction();
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMBigScanTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 1 << 20;
+  options.db_path = "__tmpLSMBigScanTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  GetStatsContext()->Reset();
+
+  uint32_t klen = 10, vlen = 514, N = 3e6;
+  auto kv =
+      GenKVDataWithRandomLen(0x202403180237, N, {klen - 1, klen}, {1, vlen});
+  std::mt19937_64 rgen(0x202403180238);
+
+  /* Insert all key-value pairs into LSM tree */
+  wing::StopWatch sw;
+  wing::wing_testing::TestTimeout(
       [&]() {
         for (uint32_t i = 0; i < N; i++) {
           lsm->Put(kv[i].key(), kv[i].value());
@@ -1134,6 +1872,926 @@ TEST(LSMTest, LSMDuplicateKeyTest) {
   }
 }
 
+TEST(LSMTest, LSMSubcompactionTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 1 << 20;
+  options.compaction_size_ratio = 4;
+  options.max_subcompactions = 4;
+  options.db_path = "__tmpLSMSubcompactionTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+
+  uint32_t klen = 10, vlen = 100, N = 2e5;
+  auto kv =
+      GenKVDataWithRandomLen(0x202404071121, N, {klen - 1, klen}, {1, vlen});
+  std::mt19937_64 rgen(0x202404071122);
+  /* Overwrite every key so that the subcompactions have duplicate keys. */
+  for (uint32_t i = 0; i < 3; i++) {
+    std::shuffle(kv.begin(), kv.end(), rgen);
+    for (auto& k : kv) {
+      lsm->Put(k.key(), k.value());
+    }
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  ASSERT_TRUE(SanityCheck(lsm.get()));
+  for (auto& k : kv) {
+    std::string value;
+    ASSERT_TRUE(lsm->Get(k.key(), &value));
+    ASSERT_EQ(value, k.value());
+  }
+  size_t count = 0;
+  for (auto it = lsm->Begin(); it.Valid(); it.Next()) {
+    count += 1;
+  }
+  ASSERT_EQ(count, N);
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMConcurrentCompactionTest) {
+  for (auto strategy : {"leveled", "tiered"}) {
+    Options options;
+    options.compaction_strategy_name = strategy;
+    options.sst_file_size = 1 << 18;
+    options.compaction_size_ratio = 2;
+    options.max_background_compactions = 4;
+    options.db_path = "__tmpLSMConcurrentCompactionTest/";
+    std::filesystem::remove_all(options.db_path);
+    std::filesystem::create_directories(options.db_path);
+    auto lsm = DBImpl::Create(options);
+
+    uint32_t klen = 10, vlen = 100, N = 4e5;
+    auto kv =
+        GenKVDataWithRandomLen(0x202404081530, N, {klen - 1, klen}, {1, vlen});
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+      /* kv[i / 2] has been inserted. */
+      if (i % 3 == 0) {
+        lsm->Del(kv[i / 2].key());
+      }
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    std::set<std::string> deleted;
+    for (uint32_t i = 0; i < N; i += 3) {
+      deleted.insert(std::string(kv[i / 2].key()));
+    }
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      if (deleted.count(std::string(kv[i].key()))) {
+        ASSERT_FALSE(lsm->Get(kv[i].key(), &value));
+      } else {
+        ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+        ASSERT_EQ(value, kv[i].value());
+      }
+    }
+    lsm.reset();
+    std::filesystem::remove_all(options.db_path);
+  }
+}
+
+TEST(LSMTest, LSMWriteSlowdownTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.level0_slowdown_writes_trigger = 1;
+  options.delayed_write_rate = 4 << 20;
+  options.db_path = "__tmpLSMWriteSlowdownTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  GetStatsContext()->Reset();
+
+  uint32_t klen = 10, vlen = 100, N = 2e4;
+  auto kv =
+      GenKVDataWithRandomLen(0x202404091010, N, {klen - 1, klen}, {1, vlen});
+  size_t bytes = 0;
+  for (auto& k : kv) {
+    lsm->Put(k.key(), k.value());
+    bytes += k.key().size() + k.value().size();
+  }
+  /* The writes are delayed after the first flush, but not stopped. */
+  auto slowdown = GetStatsContext()->write_slowdown_micros.load();
+  ASSERT_GT(slowdown, 0);
+  ASSERT_LE(slowdown, bytes * 1e6 / options.delayed_write_rate + 1);
+  ASSERT_EQ(GetStatsContext()->write_stop_micros.load(), 0);
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  ASSERT_TRUE(SanityCheck(lsm.get()));
+  for (auto& k : kv) {
+    std::string value;
+    ASSERT_TRUE(lsm->Get(k.key(), &value));
+    ASSERT_EQ(value, k.value());
+  }
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMDeepLevelGetTest) {
+  Options options;
+  options.sst_file_size = 1 << 18;
+  options.write_buffer_size = 1 << 18;
+  options.compaction_size_ratio = 2;
+  options.compaction_strategy_name = "leveled";
+  options.db_path = "__tmpLSMDeepLevelGetTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+
+  uint32_t klen = 10, vlen = 20, N = 2e5;
+  auto kv =
+      GenKVDataWithRandomLen(0x202404121010, N, {klen - 1, klen}, {1, vlen});
+  for (auto& k : kv) {
+    lsm->Put(k.key(), k.value());
+  }
+  for (uint32_t i = 0; i < N; i += 3) {
+    lsm->Del(kv[i].key());
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  ASSERT_TRUE(SanityCheck(lsm.get()));
+  /* The lookups cascade through the levels which have one sorted run. */
+  size_t single_run_levels = 0;
+  for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+    single_run_levels += level.GetRuns().size() == 1;
+  }
+  ASSERT_GE(single_run_levels, 3);
+  for (uint32_t i = 0; i < N; i++) {
+    std::string value;
+    /* The missing keys fall into the gaps between SSTables. */
+    ASSERT_FALSE(lsm->Get(kv[i].key() + "0", &value));
+    if (i % 3 == 0) {
+      ASSERT_FALSE(lsm->Get(kv[i].key(), &value));
+    } else {
+      ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+      ASSERT_EQ(value, kv[i].value());
+    }
+  }
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMMultiGetTest) {
+  Options options;
+  options.sst_file_size = 1 << 18;
+  options.compaction_size_ratio = 4;
+  options.db_path = "__tmpLSMMultiGetTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+
+  uint32_t klen = 10, vlen = 20, N = 2e5;
+  auto kv =
+      GenKVDataWithRandomLen(0x202404111530, N, {klen - 1, klen}, {1, vlen});
+  for (auto& k : kv) {
+    lsm->Put(k.key(), k.value());
+  }
+  /* Some keys are deleted, and some are in the MemTable. */
+  for (uint32_t i = 0; i < N; i += 5) {
+    lsm->Del(kv[i].key());
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  for (uint32_t i = 1; i < N; i += 10) {
+    lsm->Put(kv[i].key(), kv[i].value() + "new");
+  }
+  /* The batches contain missing keys and duplicate keys. */
+  std::mt19937_64 rgen(0x202404111531);
+  std::vector<std::string> missing;
+  for (uint32_t i = 0; i < N / 10; i++) {
+    missing.push_back(fmt::format("missing{}", i));
+  }
+  for (uint32_t round = 0; round < 50; round++) {
+    std::vector<Slice> keys;
+    for (uint32_t i = 0; i < 200; i++) {
+      auto r = rgen() % 10;
+      keys.push_back(r == 0 ? Slice(missing[rgen() % missing.size()])
+                            : Slice(kv[rgen() % N].key()));
+    }
+    keys.push_back(keys.front());
+    std::vector<std::string> values;
+    auto found = lsm->MultiGet(keys, &values);
+    ASSERT_EQ(found.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      std::string value;
+      ASSERT_EQ(found[i], lsm->Get(keys[i], &value));
+      if (found[i]) {
+        ASSERT_EQ(values[i], value);
+      }
+    }
+  }
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMMonkeyFilterTest) {
+  /* The smaller levels get more bits, and the memory is the same. */
+  std::vector<size_t> runs = {4, 1, 1, 1}, sizes = {4, 10, 100, 1000};
+  auto bits = MonkeyBitsPerKey(runs, sizes, 10);
+  double memory = 0;
+  for (size_t i = 0; i < bits.size(); i++) {
+    memory += bits[i] * sizes[i];
+    if (i > 0) {
+      ASSERT_GT(bits[i - 1], bits[i]);
+    }
+  }
+  ASSERT_NEAR(memory, 10 * (4 + 10 + 100 + 1000), 1e-6);
+  ASSERT_LT(bits.back(), 10);
+
+  Options options;
+  options.sst_file_size = 1 << 18;
+  options.write_buffer_size = 1 << 18;
+  options.compaction_size_ratio = 4;
+  options.compaction_strategy_name = "leveled";
+  options.monkey_filter_allocation = true;
+  options.db_path = "__tmpLSMMonkeyFilterTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  uint32_t klen = 10, vlen = 20, N = 3e5;
+  auto kv =
+      GenKVDataWithRandomLen(0x202404181132, N, {klen - 1, klen}, {1, vlen});
+  for (auto& k : kv) {
+    lsm->Put(k.key(), k.value());
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  ASSERT_TRUE(SanityCheck(lsm.get()));
+  auto version = lsm->GetSV()->GetVersion();
+  auto& levels = version->GetLevels();
+  ASSERT_GE(levels.size(), 3);
+  /* The bits per key of the filters in each level. */
+  std::vector<double> level_bits;
+  size_t total_bits = 0, total_keys = 0;
+  for (auto& level : levels) {
+    size_t filter_bits = 0, keys = 0;
+    for (auto& run : level.GetRuns()) {
+      for (auto& sst : run->GetSSTs()) {
+        filter_bits += sst->GetFilterSize() * 8;
+        keys += sst->GetSSTInfo().count_;
+      }
+    }
+    level_bits.push_back(keys ? filter_bits / (double)keys : 0);
+    total_bits += filter_bits;
+    total_keys += keys;
+    DB_INFO("Level {}: {} bits per key", level.GetID(), level_bits.back());
+  }
+  ASSERT_GT(level_bits[1], level_bits.back());
+  ASSERT_LT(total_bits / (double)total_keys, 11);
+  /* The false positive rates of zero-result lookups are recorded. */
+  GetStatsContext()->Reset();
+  auto kv_notinsert =
+      GenKVDataWithRandomLen(0x202404181133, N, {klen - 1, klen}, {1, vlen});
+  for (auto& k : kv_notinsert) {
+    std::string value;
+    lsm->Get(k.key(), &value);
+  }
+  size_t bottom = levels.size() - 1;
+  for (size_t i = 0; i <= bottom; i++) {
+    DB_INFO("Level {}: false positive rate {}", i,
+        GetStatsContext()->GetFilterFalsePositiveRate(i));
+  }
+  ASSERT_GT(GetStatsContext()->filter_negatives[bottom].load(), 0);
+  ASSERT_GT(GetStatsContext()->GetFilterFalsePositiveRate(bottom),
+      GetStatsContext()->GetFilterFalsePositiveRate(1));
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMRangeDeleteTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 1 << 18;
+  options.db_path = "__tmpLSMRangeDeleteTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 1e5;
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  std::map<std::string, std::string> model;
+  auto check = [&](DBImpl* lsm) {
+    for (uint32_t i = 0; i < N; i += 7) {
+      std::string value;
+      auto it = model.find(key(i));
+      ASSERT_EQ(lsm->Get(key(i), &value), it != model.end());
+      if (it != model.end()) {
+        ASSERT_EQ(value, it->second);
+      }
+    }
+    std::vector<std::string> keys;
+    for (uint32_t i = 0; i < N; i += 13) {
+      keys.push_back(key(i));
+    }
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    std::vector<std::string> values;
+    auto found = lsm->MultiGet(slices, &values);
+    for (size_t i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(found[i], model.count(keys[i]) > 0);
+    }
+    auto it = lsm->Begin();
+    for (auto& [k, v] : model) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), k);
+      ASSERT_EQ(it.value(), v);
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+    /* The first key after a deleted range. */
+    auto seek = lsm->Seek(key(N / 2));
+    auto expect = model.lower_bound(key(N / 2));
+    ASSERT_EQ(seek.Valid(), expect != model.end());
+    if (seek.Valid()) {
+      ASSERT_EQ(seek.key(), expect->first);
+    }
+  };
+  auto put = [&](DBImpl* lsm, uint32_t i, std::string value) {
+    lsm->Put(key(i), value);
+    model[key(i)] = value;
+  };
+  auto delete_range = [&](DBImpl* lsm, uint32_t begin, uint32_t end) {
+    lsm->DeleteRange(key(begin), key(end));
+    model.erase(model.lower_bound(key(begin)), model.lower_bound(key(end)));
+  };
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      put(lsm.get(), i, fmt::format("value{}", i));
+    }
+    /* The records are in the SSTables and the tombstones are not. */
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    delete_range(lsm.get(), 100, 2000);
+    delete_range(lsm.get(), N / 2 - 500, N / 2 + 500);
+    for (uint32_t i = 1000; i < 1100; i++) {
+      put(lsm.get(), i, fmt::format("new{}", i));
+    }
+    check(lsm.get());
+    /* The tombstones overlap each other and the SSTables. */
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    delete_range(lsm.get(), 1050, 3000);
+    delete_range(lsm.get(), 5000, 5001);
+    delete_range(lsm.get(), N - 10, N + 10);
+    check(lsm.get());
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    check(lsm.get());
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    /* The tombstones are recovered from the log. */
+    delete_range(lsm.get(), 6000, 7000);
+    put(lsm.get(), 6500, "recovered");
+    DBImpl::SimulateCrash(std::move(lsm));
+  }
+  {
+    options.create_new = false;
+    auto lsm = DBImpl::Create(options);
+    check(lsm.get());
+    /* Delete everything. */
+    delete_range(lsm.get(), 0, N);
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    check(lsm.get());
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMTombstoneCompactionTest) {
+  uint32_t N = 2e5;
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  auto tombstones = [](DBImpl* lsm) {
+    size_t ret = 0;
+    for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+      for (auto& run : level.GetRuns()) {
+        for (auto& sst : run->GetSSTs()) {
+          ret += sst->GetSSTInfo().tombstone_count_;
+        }
+      }
+    }
+    return ret;
+  };
+  for (double ratio : {0.0, 0.5}) {
+    Options options;
+    options.compaction_strategy_name = "leveled";
+    options.sst_file_size = 1 << 18;
+    options.level0_compaction_trigger = 1;
+    options.tombstone_compaction_ratio = ratio;
+    options.db_path = "__tmpLSMTombstoneCompactionTest/";
+    std::filesystem::remove_all(options.db_path);
+    std::filesystem::create_directories(options.db_path);
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(key(i), fmt::format("value{}", i));
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    ASSERT_GE(lsm->GetSV()->GetVersion()->GetLevels().size(), 3);
+    /* The tombstones are in Level 1, which is not full. */
+    for (uint32_t i = 0; i < N; i++) {
+      if (i % 4 != 0) {
+        lsm->Del(key(i));
+      }
+    }
+    lsm->DeleteRange(key(N / 2), key(N / 2 + 1000));
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    if (ratio == 0) {
+      ASSERT_GT(tombstones(lsm.get()), 0);
+    } else {
+      /* They are dropped in the bottom level. */
+      ASSERT_EQ(tombstones(lsm.get()), 0);
+      ASSERT_TRUE(SanityCheck(lsm.get()));
+    }
+    for (uint32_t i = 0; i < N; i += 3) {
+      std::string value;
+      bool deleted = i % 4 != 0 || (i >= N / 2 && i < N / 2 + 1000);
+      ASSERT_EQ(lsm->Get(key(i), &value), !deleted);
+    }
+    size_t count = 0;
+    for (auto it = lsm->Begin(); it.Valid(); it.Next()) {
+      count += 1;
+    }
+    ASSERT_EQ(count, N / 4 - 250);
+    if (ratio > 0) {
+      /* All the tombstones in Level 1 are moved down. */
+      ASSERT_TRUE(lsm->GetSV()->GetVersion()->GetLevels()[1].GetRuns().empty());
+    }
+    /* Level 0 is compacted into the empty Level 1. */
+    for (uint32_t i = 0; i < N; i += 2) {
+      lsm->Put(key(i), fmt::format("new{}", i));
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    for (uint32_t i = 0; i < N; i += 3) {
+      std::string value;
+      bool deleted = i % 4 != 0 || (i >= N / 2 && i < N / 2 + 1000);
+      if (i % 2 == 0) {
+        ASSERT_TRUE(lsm->Get(key(i), &value));
+        ASSERT_EQ(value, fmt::format("new{}", i));
+      } else {
+        ASSERT_EQ(lsm->Get(key(i), &value), !deleted);
+      }
+    }
+    lsm.reset();
+    std::filesystem::remove_all(options.db_path);
+  }
+  /* The last level of tiering is rewritten in place. */
+  Options options;
+  options.compaction_strategy_name = "tiered";
+  options.sst_file_size = 1 << 18;
+  options.level0_compaction_trigger = 1;
+  options.db_path = "__tmpLSMTombstoneCompactionTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(key(i), fmt::format("value{}", i));
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  size_t level_count = lsm->GetSV()->GetVersion()->GetLevels().size();
+  ASSERT_GE(level_count, 2);
+  for (uint32_t i = 0; i < N; i++) {
+    if (i % 4 != 0) {
+      lsm->Del(key(i));
+    }
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  ASSERT_EQ(lsm->GetSV()->GetVersion()->GetLevels().size(), level_count);
+  ASSERT_EQ(tombstones(lsm.get()), 0);
+  ASSERT_TRUE(SanityCheck(lsm.get()));
+  for (uint32_t i = 0; i < N; i += 3) {
+    std::string value;
+    ASSERT_EQ(lsm->Get(key(i), &value), i % 4 == 0);
+  }
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMSnapshotTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 1 << 18;
+  options.level0_compaction_trigger = 1;
+  options.db_path = "__tmpLSMSnapshotTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  uint32_t N = 1e5;
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  /* models[j] is the database when snapshot j is taken. */
+  std::vector<std::map<std::string, std::string>> models(1);
+  std::vector<seq_t> snapshots;
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(key(i), fmt::format("value{}", i));
+    models[0][key(i)] = fmt::format("value{}", i);
+  }
+  snapshots.push_back(lsm->GetSnapshot());
+  models.push_back(models.back());
+  for (uint32_t i = 0; i < N; i += 2) {
+    lsm->Put(key(i), fmt::format("new{}", i));
+    models.back()[key(i)] = fmt::format("new{}", i);
+  }
+  lsm->FlushAll();
+  for (uint32_t i = 0; i < N; i += 3) {
+    lsm->Del(key(i));
+    models.back().erase(key(i));
+  }
+  lsm->DeleteRange(key(N / 2), key(N / 2 + 1000));
+  models.back().erase(models.back().lower_bound(key(N / 2)),
+      models.back().lower_bound(key(N / 2 + 1000)));
+  snapshots.push_back(lsm->GetSnapshot());
+  models.push_back(models.back());
+  for (uint32_t i = 0; i < N; i += 5) {
+    lsm->Put(key(i), fmt::format("last{}", i));
+    models.back()[key(i)] = fmt::format("last{}", i);
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  ASSERT_TRUE(SanityCheck(lsm.get()));
+  auto check = [&](size_t j) {
+    std::optional<seq_t> snapshot;
+    if (j < snapshots.size()) {
+      snapshot = snapshots[j];
+    }
+    auto& model = models[j];
+    for (uint32_t i = 0; i < N; i += 7) {
+      std::string value;
+      auto it = model.find(key(i));
+      ASSERT_EQ(lsm->Get(key(i), &value, snapshot), it != model.end());
+      if (it != model.end()) {
+        ASSERT_EQ(value, it->second);
+      }
+    }
+    std::vector<std::string> keys;
+    for (uint32_t i = N / 2 - 500; i < N / 2 + 500; i++) {
+      keys.push_back(key(i));
+    }
+    std::vector<Slice> key_slices(keys.begin(), keys.end());
+    std::vector<std::string> values;
+    auto found = lsm->MultiGet(key_slices, &values, snapshot);
+    for (size_t i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(found[i], model.count(keys[i]) > 0);
+    }
+    auto it = lsm->Seek(key(N / 3), snapshot);
+    for (auto mit = model.lower_bound(key(N / 3)); mit != model.end();
+         ++mit, it.Next()) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), mit->first);
+      ASSERT_EQ(it.value(), mit->second);
+    }
+    ASSERT_FALSE(it.Valid());
+  };
+  for (size_t j = 0; j < models.size(); j++) {
+    check(j);
+  }
+  /* The old versions are dropped after the snapshots are released. */
+  for (auto snapshot : snapshots) {
+    lsm->ReleaseSnapshot(snapshot);
+  }
+  snapshots.clear();
+  models.erase(models.begin(), models.end() - 1);
+  for (uint32_t i = 1; i < N; i += 2) {
+    lsm->Put(key(i), fmt::format("again{}", i));
+    models[0][key(i)] = fmt::format("again{}", i);
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  ASSERT_TRUE(SanityCheck(lsm.get()));
+  check(0);
+  size_t records = 0;
+  for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+    for (auto& run : level.GetRuns()) {
+      for (auto& sst : run->GetSSTs()) {
+        records += sst->GetSSTInfo().count_;
+      }
+    }
+  }
+  ASSERT_LT(records, 2 * N);
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMBulkLoadTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 1 << 18;
+  options.level0_compaction_trigger = 1;
+  options.db_path = "__tmpLSMBulkLoadTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 1e5;
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  std::map<std::string, std::string> model;
+  {
+    auto lsm = DBImpl::Create(options);
+    /* The old records of the keys in [N, 2N). */
+    for (uint32_t i = N; i < 2 * N; i += 2) {
+      lsm->Put(key(i), "old");
+      model[key(i)] = "old";
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    /* [0, N) overlaps nothing, so it is put in the bottom level. */
+    std::vector<uint32_t> ids;
+    for (uint32_t i = 0; i < N; i++) {
+      ids.push_back(i);
+    }
+    std::shuffle(ids.begin(), ids.end(), std::mt19937(0x20241017));
+    BulkLoader loader(lsm.get());
+    for (auto i : ids) {
+      loader.Add(key(i), "first");
+      loader.Add(key(i), fmt::format("value{}", i));
+      model[key(i)] = fmt::format("value{}", i);
+    }
+    loader.Finish();
+    {
+      auto version = lsm->GetSV()->GetVersion();
+      ASSERT_EQ(version->GetLevels()[0].GetRuns().size(), 0);
+      ASSERT_EQ(version->GetLevels().back().GetRuns().size(), 1);
+    }
+    /* [2N - 100, 3N) overlaps the MemTable, which is flushed first. */
+    lsm->Put(key(2 * N + 5), "memtable");
+    for (uint32_t i = 2 * N - 100; i < 3 * N; i++) {
+      loader.Add(key(i), fmt::format("value{}", i));
+      model[key(i)] = fmt::format("value{}", i);
+    }
+    loader.Finish();
+    lsm->WaitForFlushAndCompaction();
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+  }
+  options.create_new = false;
+  auto lsm = DBImpl::Create(options);
+  for (uint32_t i = 0; i < 3 * N; i += 7) {
+    std::string value;
+    auto it = model.find(key(i));
+    ASSERT_EQ(lsm->Get(key(i), &value), it != model.end());
+    if (it != model.end()) {
+      ASSERT_EQ(value, it->second);
+    }
+  }
+  {
+    auto it = lsm->Begin();
+    for (auto& [k, v] : model) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), k);
+      ASSERT_EQ(it.value(), v);
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+  }
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMSharedResourcesTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  /* The MemTables are switched only by the write buffer manager. */
+  options.sst_file_size = 64 << 20;
+  options.block_cache = std::make_shared<Cache>(options.cache);
+  options.scheduler = std::make_shared<BackgroundScheduler>(1, 1);
+  options.write_buffer_manager = std::make_shared<WriteBufferManager>(1 << 20);
+  auto& wbm = *options.write_buffer_manager;
+  size_t num_dbs = 4;
+  std::vector<std::unique_ptr<DBImpl>> dbs;
+  for (size_t db = 0; db < num_dbs; db++) {
+    options.db_path = fmt::format("__tmpLSMSharedResourcesTest/db{}/", db);
+    std::filesystem::remove_all(options.db_path);
+    std::filesystem::create_directories(options.db_path);
+    dbs.push_back(DBImpl::Create(options));
+  }
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  auto value = [](size_t db, uint32_t i) {
+    return fmt::format("db{}value{:08}", db, i);
+  };
+  /* DB 0 is written first, and then its MemTable is the largest one. */
+  uint32_t N = 0;
+  while (wbm.memory_usage() < (600 << 10)) {
+    dbs[0]->Put(key(N), value(0, N));
+    N += 1;
+  }
+  ASSERT_TRUE(dbs[0]->GetSV()->GetImms()->empty());
+  for (size_t db = 1; db < num_dbs; db++) {
+    for (uint32_t i = 0; i < N; i++) {
+      dbs[db]->Put(key(i), value(db, i));
+    }
+  }
+  size_t total = 0;
+  for (auto& db : dbs) {
+    db->WaitForFlushAndCompaction();
+    total += db->GetSV()->GetMt()->size();
+  }
+  /* DB 0 is not written any more, but its MemTable is flushed. */
+  ASSERT_EQ(dbs[0]->GetSV()->GetMt()->size(), 0);
+  ASSERT_GT(dbs[0]->GetSV()->GetVersion()->GetLevels()[0].GetRuns().size(), 0);
+  ASSERT_LE(total, wbm.buffer_size());
+  ASSERT_EQ(wbm.memory_usage(), total);
+  ASSERT_EQ(wbm.mutable_memory_usage(), total);
+  /**
+   * The SSTables of the DBImpls have the same ids and the same keys, but
+   * they share the block cache without mixing their blocks up.
+   */
+  for (size_t round = 0; round < 2; round++) {
+    for (size_t db = 0; db < num_dbs; db++) {
+      for (uint32_t i = 0; i < N; i += 13) {
+        std::string v;
+        ASSERT_TRUE(dbs[db]->Get(key(i), &v));
+        ASSERT_EQ(v, value(db, i));
+      }
+    }
+  }
+  for (auto& db : dbs) {
+    ASSERT_TRUE(SanityCheck(db.get()));
+  }
+  dbs.clear();
+  ASSERT_EQ(wbm.memory_usage(), 0);
+  ASSERT_EQ(wbm.mutable_memory_usage(), 0);
+}
+
+TEST(LSMTest, LSMManifestTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 1 << 18;
+  /* The MANIFEST is rewritten whenever it is twice the snapshot. */
+  options.max_manifest_file_size = 0;
+  options.db_path = "__tmpLSMManifestTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t klen = 10, vlen = 100, N = 1e5;
+  auto kv =
+      GenKVDataWithRandomLen(0x202410171530, N, {klen - 1, klen}, {1, vlen});
+  auto get_layout = [](DBImpl* lsm) {
+    std::vector<std::vector<std::vector<size_t>>> ret;
+    for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+      auto& runs = ret.emplace_back();
+      for (auto& run : level.GetRuns()) {
+        auto& ids = runs.emplace_back();
+        for (auto& sst : run->GetSSTs()) {
+          ids.push_back(sst->GetSSTInfo().sst_id_);
+        }
+      }
+    }
+    return ret;
+  };
+  auto check = [&](DBImpl* lsm) {
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      if (i % 10 == 0) {
+        ASSERT_FALSE(lsm->Get(kv[i].key(), &value));
+      } else {
+        ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+        ASSERT_EQ(value, kv[i].value());
+      }
+    }
+  };
+  decltype(get_layout(nullptr)) layout;
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+    }
+    for (uint32_t i = 0; i < N; i += 10) {
+      lsm->Del(kv[i].key());
+    }
+    lsm->WaitForFlushAndCompaction();
+    ASSERT_GT(lsm->GetSV()->GetVersion()->GetLevels().size(), 1);
+    layout = get_layout(lsm.get());
+    /* Crash. The tree is in the edits of the MANIFEST. */
+    DBImpl::SimulateCrash(std::move(lsm));
+  }
+  ASSERT_FALSE(std::filesystem::exists(options.db_path / "metadata"));
+  options.create_new = false;
+  {
+    auto lsm = DBImpl::Create(options);
+    ASSERT_EQ(get_layout(lsm.get()), layout);
+    check(lsm.get());
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    DBImpl::SimulateCrash(std::move(lsm));
+  }
+  {
+    /* A record torn by a crash is ignored. */
+    std::ofstream out(
+        options.db_path / "MANIFEST", std::ios::binary | std::ios::app);
+    out << std::string(20, '\x7f');
+  }
+  {
+    auto lsm = DBImpl::Create(options);
+    ASSERT_EQ(get_layout(lsm.get()), layout);
+    check(lsm.get());
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMOrphanFileTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 1 << 18;
+  options.db_path = "__tmpLSMOrphanFileTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t klen = 10, vlen = 100, N = 1e5;
+  auto kv =
+      GenKVDataWithRandomLen(0x202410171620, N, {klen - 1, klen}, {1, vlen});
+  auto get_files = [](DBImpl* lsm) {
+    std::set<std::string> ret;
+    for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+      for (auto& run : level.GetRuns()) {
+        for (auto& sst : run->GetSSTs()) {
+          ret.insert(sst->GetSSTInfo().filename_);
+        }
+      }
+    }
+    return ret;
+  };
+  auto max_sst_id = [](DBImpl* lsm) {
+    size_t ret = 0;
+    for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+      for (auto& run : level.GetRuns()) {
+        for (auto& sst : run->GetSSTs()) {
+          ret = std::max(ret, sst->GetSSTInfo().sst_id_);
+        }
+      }
+    }
+    return ret;
+  };
+  size_t orphan_id;
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N / 2; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+    }
+    lsm->WaitForFlushAndCompaction();
+    /* A reader keeps the SSTables of the old version. */
+    auto old_sv = lsm->GetSV();
+    auto old_files = get_files(lsm.get());
+    for (uint32_t i = N / 2; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    std::vector<std::string> obsolete_files;
+    std::ranges::set_difference(
+        old_files, get_files(lsm.get()), std::back_inserter(obsolete_files));
+    ASSERT_FALSE(obsolete_files.empty());
+    for (auto& filename : obsolete_files) {
+      ASSERT_TRUE(std::filesystem::exists(filename));
+    }
+    /* The files are deleted in the background when the reader finishes. */
+    old_sv.reset();
+    lsm->WaitForFlushAndCompaction();
+    for (auto& filename : obsolete_files) {
+      ASSERT_FALSE(std::filesystem::exists(filename));
+    }
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    /* The output of a compaction interrupted by a crash. */
+    orphan_id = max_sst_id(lsm.get()) + 10;
+    std::ofstream(options.db_path / fmt::format("{}.sst", orphan_id))
+        << std::string(100, 'x');
+    DBImpl::SimulateCrash(std::move(lsm));
+  }
+  options.create_new = false;
+  {
+    auto lsm = DBImpl::Create(options);
+    lsm->WaitForFlushAndCompaction();
+    ASSERT_FALSE(std::filesystem::exists(
+        options.db_path / fmt::format("{}.sst", orphan_id)));
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    /* The ids of the orphans are not reused. */
+    lsm->Put(kv[0].key(), kv[0].value());
+    lsm->FlushAll();
+    ASSERT_GT(max_sst_id(lsm.get()), orphan_id);
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+      ASSERT_EQ(value, kv[i].value());
+    }
+  }
+  {
+    /* A file is deleted at most every second. */
+    FilePurger purger(1);
+    auto a = options.db_path / "a.sst", b = options.db_path / "b.sst";
+    std::ofstream(a) << "a";
+    std::ofstream(b) << "b";
+    purger.Schedule(a.string(), 1);
+    purger.Schedule(b.string(), 1);
+    while (std::filesystem::exists(a)) {
+      std::this_thread::yield();
+    }
+    ASSERT_TRUE(std::filesystem::exists(b));
+    ASSERT_EQ(purger.pending(), 1);
+    /* Drain does not wait for the rate limit. */
+    purger.Drain();
+    ASSERT_FALSE(std::filesystem::exists(b));
+    ASSERT_EQ(purger.pending(), 0);
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
 TEST(LSMTest, LeveledCompactionTest) {
   Options options;
   options.sst_file_size = 1 << 20;